@@ -196,6 +196,13 @@ struct
   /* The value of the option --s2k-count.  If this option is not given
    * or 0 an auto-calibrated value is used.  */
   unsigned long s2k_count;
+
+  /* The values of --keygen-pool; i.e. the kind of keys to generate in
+   * advance.  */
+  strlist_t keygen_pool;
+
+  /* The number of keys of each kind to generate in advance.  */
+  unsigned int keygen_pool_size;
 } opt;
 
 
@@ -422,6 +429,7 @@ gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
      GPGRT_ATTR_PRINTF(3,4);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+unsigned int get_eventcounter_tick (void);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
                                unsigned char **buffer, size_t *size,
@@ -486,6 +494,7 @@ gpg_error_t agent_delete_key (ctrl_t ctrl, const char *desc_text,
                               const unsigned char *grip,
                               int force, int only_stubs);
 gpg_error_t agent_update_private_key (const unsigned char *grip, nvc_t pk);
+void agent_flush_key_file_cache (void);
 
 /*-- call-pinentry.c --*/
 void initialize_module_call_pinentry (void);
@@ -523,6 +532,15 @@ void agent_store_cache_hit (const char *key);
 
 
 /*-- pksign.c --*/
+
+/* A hash to be signed by agent_pksign_multi.  */
+struct pksign_hash_s
+{
+  int algo;
+  int valuelen;
+  unsigned char value[MAX_DIGEST_LEN];
+};
+
 gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
                              const char *desc_text,
                              gcry_sexp_t *signature_sexp,
@@ -531,11 +549,22 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const struct pksign_hash_s *hashes,
+                                int nhashes,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
+/* Maximum number of ciphertexts for PKDECRYPT --multi.  */
+#define MAX_PKDECRYPT_ITEMS 256
+
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
                              const unsigned char *ciphertext, size_t ciphertextlen,
                              membuf_t *outbuf, int *r_padding);
+gpg_error_t agent_pkdecrypt_multi (ctrl_t ctrl, const char *desc_text,
+                                   const unsigned char *ciphertexts,
+                                   size_t ciphertextslen, membuf_t *outbuf);
 
 /*-- genkey.c --*/
 #define CHECK_CONSTRAINTS_NOT_EMPTY  1
@@ -552,9 +581,17 @@ int agent_genkey (ctrl_t ctrl, const char *cache_nonce, time_t timestamp,
                   int preset, membuf_t *outbuf);
 gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
                                      char **passphrase_addr);
+gpg_error_t agent_keygen_pool_check (const char *spec);
+int agent_keygen_pool_fill (void);
 
 /*-- protect.c --*/
 void set_s2k_calibration_time (unsigned int milliseconds);
+void set_s2k_calibration_persistent (int yes);
+unsigned int get_s2k_calibration_time (void);
+int s2k_calibration_uses_thread_time (void);
+unsigned long calibrate_s2k_count (unsigned int milliseconds);
+void set_s2k_calibrated_count (unsigned int milliseconds,
+                               unsigned long count);
 unsigned long get_calibrated_s2k_count (void);
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
@@ -34,6 +34,13 @@
 /* The size of the encryption key in bytes.  */
 #define ENCRYPTION_KEYSIZE (128/8)
 
+/* The number of buckets of the cache hash table.  Must be a power
+ * of 2.  */
+#define CACHE_TABLE_SIZE 1024
+
+/* Unused slots are removed after this many seconds.  */
+#define CACHE_SLOT_TIMEOUT (60*30)
+
 /* A mutex used to serialize access to the cache.  */
 static npth_mutex_t cache_lock;
 /* The encryption context.  This is the only place where the
@@ -56,18 +63,38 @@ struct secret_data_s {
 /* The cache object.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* Next item in the same hash bucket.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
   cache_mode_t cache_mode;
   int restricted;  /* The value of ctrl->restricted is part of the key.  */
+  time_t expires;   /* Time of the next housekeeping event.  */
+  int heapidx;      /* Index into EXPIRY_HEAP or -1.  */
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the key
+ * string; the cache mode and the restricted flag are compared while
+ * walking the bucket.  New items are inserted at the head of a
+ * bucket so that the most recent item is found first.  */
+static ITEM cache_table[CACHE_TABLE_SIZE];
+
+/* The number of items in CACHE_TABLE.  */
+static unsigned int cache_count;
+
+/* A binary min-heap of all items which need to be looked at by the
+ * housekeeping, ordered by their EXPIRES field.  The heap has always
+ * room for all items in the cache so that updating an item never
+ * needs to allocate memory.  */
+static ITEM *expiry_heap;
+static unsigned int expiry_heap_used;
+static unsigned int expiry_heap_size;
+
+/* The max-cache-ttl values used to compute the expiration times.  */
+static unsigned long heap_max_cache_ttl;
+static unsigned long heap_max_cache_ttl_ssh;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
@@ -95,6 +122,19 @@ deinitialize_module_cache (void)
 }
 
 
+/* Return the hash bucket for KEY.  */
+static unsigned int
+cache_bucket (const char *key)
+{
+  const unsigned char *s = (const unsigned char *)key;
+  unsigned int hash = 5381;
+
+  for (; *s; s++)
+    hash = ((hash << 5) + hash) + *s;
+  return hash & (CACHE_TABLE_SIZE - 1);
+}
+
+
 /* We do the encryption init on the fly.  We can't do it in the module
    init code because that is run before we listen for connections and
    in case we are started on demand by gpg etc. it will only wait for
@@ -194,16 +234,213 @@ new_data (const char *string, struct secret_data_s **r_data)
 
 
 
-/* Check whether there are items to expire.  */
+/* Return true if the max-cache-ttl options apply to items of
+ * CACHE_MODE.  */
+static int
+maxttl_applies (cache_mode_t cache_mode)
+{
+  return !(cache_mode == CACHE_MODE_DATA || cache_mode == CACHE_MODE_PIN);
+}
+
+
+/* Compute the time at which the housekeeping needs to look at item
+ * R.  Returns false if R never expires.  */
+static int
+compute_expiry (ITEM r, time_t *r_expires)
+{
+  unsigned long maxttl;
+  time_t t = 0;
+  int have = 0;
+
+  if (r->pw)
+    {
+      if (r->cache_mode != CACHE_MODE_PIN && r->ttl >= 0)
+        {
+          t = r->accessed + r->ttl;
+          have = 1;
+        }
+      if (maxttl_applies (r->cache_mode))
+        {
+          maxttl = (r->cache_mode == CACHE_MODE_SSH? opt.max_cache_ttl_ssh
+                    /**/                         : opt.max_cache_ttl);
+          if (!have || r->created + maxttl < t)
+            {
+              t = r->created + maxttl;
+              have = 1;
+            }
+        }
+    }
+  else if (r->ttl >= 0)
+    {
+      t = r->accessed + CACHE_SLOT_TIMEOUT;
+      have = 1;
+    }
+
+  *r_expires = t;
+  return have;
+}
+
+
+/* Helper to swap two elements of the expiry heap.  */
+static void
+heap_swap (unsigned int a, unsigned int b)
+{
+  ITEM tmp = expiry_heap[a];
+
+  expiry_heap[a] = expiry_heap[b];
+  expiry_heap[b] = tmp;
+  expiry_heap[a]->heapidx = a;
+  expiry_heap[b]->heapidx = b;
+}
+
+
+/* Restore the heap property for the element at IDX.  */
+static void
+heap_fix (unsigned int idx)
+{
+  unsigned int parent, child;
+
+  while (idx && (expiry_heap[idx]->expires
+                 < expiry_heap[(parent = (idx - 1) / 2)]->expires))
+    {
+      heap_swap (idx, parent);
+      idx = parent;
+    }
+
+  for (;;)
+    {
+      child = 2 * idx + 1;
+      if (child >= expiry_heap_used)
+        break;
+      if (child + 1 < expiry_heap_used
+          && expiry_heap[child + 1]->expires < expiry_heap[child]->expires)
+        child++;
+      if (!(expiry_heap[child]->expires < expiry_heap[idx]->expires))
+        break;
+      heap_swap (idx, child);
+      idx = child;
+    }
+}
+
+
+/* Remove item R from the expiry heap.  */
+static void
+heap_remove (ITEM r)
+{
+  unsigned int idx;
+
+  if (r->heapidx < 0)
+    return;
+  idx = r->heapidx;
+  r->heapidx = -1;
+  expiry_heap_used--;
+  if (idx != expiry_heap_used)
+    {
+      expiry_heap[idx] = expiry_heap[expiry_heap_used];
+      expiry_heap[idx]->heapidx = idx;
+      heap_fix (idx);
+    }
+}
+
+
+/* Recompute the expiration time of item R and update its position in
+ * the expiry heap.  */
+static void
+heap_update (ITEM r)
+{
+  time_t expires;
+
+  if (!compute_expiry (r, &expires))
+    {
+      heap_remove (r);
+      return;
+    }
+
+  r->expires = expires;
+  if (r->heapidx < 0)
+    {
+      /* There is always room - see make_room_for_item.  */
+      log_assert (expiry_heap_used < expiry_heap_size);
+      r->heapidx = expiry_heap_used++;
+      expiry_heap[r->heapidx] = r;
+    }
+  heap_fix (r->heapidx);
+}
+
+
+/* Make sure that the expiry heap has room for one more item.  */
+static gpg_error_t
+make_room_for_item (void)
+{
+  ITEM *newheap;
+  unsigned int newsize;
+
+  if (cache_count < expiry_heap_size)
+    return 0;
+
+  newsize = expiry_heap_size? expiry_heap_size * 2 : 64;
+  newheap = xtryrealloc (expiry_heap, newsize * sizeof *newheap);
+  if (!newheap)
+    return gpg_error_from_syserror ();
+  expiry_heap = newheap;
+  expiry_heap_size = newsize;
+  return 0;
+}
+
+
+/* Recompute the expiration times of all items.  This is required
+ * after a change of the max-cache-ttl options.  */
+static void
+rebuild_expiry_heap (void)
+{
+  ITEM r;
+  unsigned int i;
+
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    for (r = cache_table[i]; r; r = r->next)
+      heap_update (r);
+  heap_max_cache_ttl = opt.max_cache_ttl;
+  heap_max_cache_ttl_ssh = opt.max_cache_ttl_ssh;
+}
+
+
+/* Unlink item R from the hash table and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  for (rp = &cache_table[cache_bucket (r->key)]; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  heap_remove (r);
+  release_data (r->pw);
+  xfree (r);
+  cache_count--;
+}
+
+
+/* Check whether there are items to expire.  Only items whose
+ * expiration time has been reached are looked at.  */
 static void
 housekeeping (void)
 {
-  ITEM r, rprev;
+  ITEM r;
   time_t current = gnupg_get_time ();
+  unsigned long maxttl;
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  if (heap_max_cache_ttl != opt.max_cache_ttl
+      || heap_max_cache_ttl_ssh != opt.max_cache_ttl_ssh)
+    rebuild_expiry_heap ();
+
+  while (expiry_heap_used && expiry_heap[0]->expires < current)
     {
+      r = expiry_heap[0];
+
+      /* First expire the actual data */
       if (r->cache_mode == CACHE_MODE_PIN)
         ; /* Don't let it expire - scdaemon explicitly flushes them.  */
       else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
@@ -215,25 +452,16 @@ housekeeping (void)
           r->pw = NULL;
           r->accessed = current;
         }
-    }
-
-  /* Second, make sure that we also remove them based on the created
-   * stamp so that the user has to enter it from time to time.  We
-   * don't do this for data items which are used to storage secrets in
-   * meory and are not user entered passphrases etc.  */
-  for (r=thecache; r; r = r->next)
-    {
-      unsigned long maxttl;
 
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_DATA:
-        case CACHE_MODE_PIN:
-          continue;  /* No MAX TTL here.  */
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
+      /* Second, make sure that we also remove them based on the
+       * created stamp so that the user has to enter it from time to
+       * time.  We don't do this for data items which are used to
+       * storage secrets in meory and are not user entered
+       * passphrases etc.  */
+      maxttl = (r->cache_mode == CACHE_MODE_SSH? opt.max_cache_ttl_ssh
+                /**/                         : opt.max_cache_ttl);
+      if (r->pw && maxttl_applies (r->cache_mode)
+          && r->created + maxttl < current)
         {
           if (DBG_CACHE)
             log_debug ("  expired '%s'.%d (%lus after creation)\n",
@@ -242,30 +470,18 @@ housekeeping (void)
           r->pw = NULL;
           r->accessed = current;
         }
-    }
 
-  /* Third, make sure that we don't have too many items in the list.
-   * Expire old and unused entries after 30 minutes.  */
-  for (rprev=NULL, r=thecache; r; )
-    {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      /* Third, make sure that we don't have too many items in the
+       * list.  Expire old and unused entries after 30 minutes.  */
+      if (!r->pw && r->ttl >= 0 && r->accessed + CACHE_SLOT_TIMEOUT < current)
         {
-          ITEM r2 = r->next;
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        r->key, r->restricted, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
+          remove_item (r);
         }
       else
-        {
-          rprev = r;
-          r = r->next;
-        }
+        heap_update (r);
     }
 }
 
@@ -295,6 +511,7 @@ agent_flush_cache (int pincache_only)
 {
   ITEM r;
   int res;
+  unsigned int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
@@ -303,19 +520,21 @@ agent_flush_cache (int pincache_only)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    for (r = cache_table[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            heap_update (r);
+          }
+      }
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -373,7 +592,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  for (r = cache_table[cache_bucket (key)]; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -411,11 +630,13 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      heap_update (r);
     }
   else if (data) /* Insert.  */
     {
-      r = xtrycalloc (1, sizeof *r + strlen (key));
-      if (!r)
+      if ((err = make_room_for_item ()))
+        ;
+      else if (!(r = xtrycalloc (1, sizeof *r + strlen (key))))
         err = gpg_error_from_syserror ();
       else
         {
@@ -424,13 +645,18 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
+          r->heapidx = -1;
           err = new_data (data, &r->pw);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              unsigned int bucket = cache_bucket (key);
+
+              r->next = cache_table[bucket];
+              cache_table[bucket] = r;
+              cache_count++;
+              heap_update (r);
             }
         }
       if (err)
@@ -480,7 +706,7 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                last_stored? " (stored cache key)":"");
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  for (r = cache_table[cache_bucket (key)]; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN)
         yes = (r->pw && !strcmp (r->key, key));
@@ -500,7 +726,10 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
            * below.  Note also that we don't update the accessed time
            * for data items.  */
           if (r->cache_mode != CACHE_MODE_DATA)
-            r->accessed = gnupg_get_time ();
+            {
+              r->accessed = gnupg_get_time ();
+              heap_update (r);
+            }
           if (DBG_CACHE)
             log_debug ("... hit\n");
           if (r->pw->totallen < 32)
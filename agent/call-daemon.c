@@ -49,6 +49,11 @@ static const int daemon_modules[DAEMON_MAX_TYPE] =
     GNUPG_MODULE_NAME_TPM2DAEMON
   };
 
+/* The maximum number of idle secondary connections we keep per
+ * daemon.  Only daemons which implement the RESTART command make use
+ * of this.  */
+#define MAX_IDLE_CONNECTIONS 8
+
 /* Definition of module local data of the CTRL structure.  */
 struct daemon_local_s
 {
@@ -85,6 +90,12 @@ struct daemon_global_s
      to true if the primary context has been reset and is not in use by
      any connection. */
   int primary_ctx_reusable;
+
+  /* Secondary connections which have been reset and are waiting to
+     be reused by a new session.  The most recently used connection
+     is at the end of the array.  */
+  assuan_context_t idle_ctx[MAX_IDLE_CONNECTIONS];
+  int n_idle;
 };
 
 static struct daemon_global_s daemon_global[DAEMON_MAX_TYPE];
@@ -181,6 +192,9 @@ wait_child_thread (void *arg)
       g->primary_ctx = NULL;
       g->primary_ctx_reusable = 0;
 
+      while (g->n_idle)
+        assuan_release (g->idle_ctx[--g->n_idle]);
+
       xfree (g->socket_name);
       g->socket_name = NULL;
 
@@ -330,6 +344,18 @@ daemon_start (enum daemon_type type, ctrl_t ctrl)
       goto leave;
     }
 
+  /* Next try to take a connection from the pool of idle
+     connections.  */
+  if (g->n_idle)
+    {
+      ctx = g->idle_ctx[--g->n_idle];
+      g->idle_ctx[g->n_idle] = NULL;
+      if (opt.verbose)
+        log_info ("new connection to %s daemon established (pooled)\n",
+		  name);
+      goto leave;
+    }
+
   rc = assuan_new (&ctx);
   if (rc)
     {
@@ -566,6 +592,7 @@ agent_daemon_dump_state (void)
 	      g->primary_ctx,
 	      (long)assuan_get_pid (g->primary_ctx),
 	      g->primary_ctx_reusable);
+    log_info ("%s: idle connections=%d\n", __func__, g->n_idle);
     if (g->socket_name)
       log_info ("%s: socket='%s'\n", __func__, g->socket_name);
   }
@@ -631,17 +658,28 @@ agent_reset_daemon (ctrl_t ctrl)
 		   primary connection as a kind of virtual EOF; we don't
 		   have another way to tell it that the next command
 		   should be viewed as if a new connection has been
-		   made.  For the non-primary connections this is not
-		   needed as we simply close the socket.  We don't check
-		   for an error here because the RESTART may fail for
-		   example if the daemon has already been terminated.
-		   Anyway, we need to set the reusable flag to make sure
-		   that the aliveness check can clean it up. */
+		   made.  We don't check for an error here because the
+		   RESTART may fail for example if the daemon has
+		   already been terminated.  Anyway, we need to set the
+		   reusable flag to make sure that the aliveness check
+		   can clean it up. */
 		assuan_transact (g->primary_ctx, "RESTART",
 				 NULL, NULL, NULL, NULL, NULL, NULL);
 		g->primary_ctx_reusable = 1;
 	      }
-	    else /* Secondary connections.  */
+	    else if (i == DAEMON_SCD
+                     && !ctrl->d_local[i]->invalid
+                     && g->n_idle < MAX_IDLE_CONNECTIONS
+                     && !assuan_transact (ctrl->d_local[i]->ctx, "RESTART",
+                                          NULL, NULL, NULL, NULL, NULL, NULL))
+              {
+                /* A secondary connection to the scdaemon has been
+                 * reset and may thus be used by another session.
+                 * This saves the cost of setting up a new connection
+                 * for each session.  */
+                g->idle_ctx[g->n_idle++] = ctrl->d_local[i]->ctx;
+              }
+	    else /* Other secondary connections.  */
 	      assuan_release (ctrl->d_local[i]->ctx);
 	    ctrl->d_local[i]->ctx = NULL;
 	  }
@@ -98,6 +98,9 @@
 /* The name of the control file.  */
 #define SSH_CONTROL_FILE_NAME "sshcontrol"
 
+/* The maximum time in seconds the cached identity list is used.  */
+#define SSH_IDENTITY_CACHE_TTL 5
+
 /* The blurb we put into the header of a newly created control file.  */
 static const char sshcontrolblurb[] =
 "# List of allowed ssh keys.  Only keys present in this file are used\n"
@@ -247,6 +250,36 @@ struct key_collection_s
 };
 
 
+/* The state of the files used to build the identity list.  */
+struct identity_stamp_s
+{
+  unsigned int eventtick;  /* Value of get_eventcounter_tick.  */
+  int have_control;        /* The sshcontrol file exists.  */
+  dev_t control_dev;
+  ino_t control_ino;
+  off_t control_size;
+  time_t control_mtime;
+  dev_t keydir_dev;
+  ino_t keydir_ino;
+  time_t keydir_mtime;
+};
+
+
+/* A cache for the serialized identity list as returned by
+ * SSH_REQUEST_REQUEST_IDENTITIES.  It is used as long as the
+ * sshcontrol file, the private key directory and the event counters
+ * did not change.  Because not all setups signal the insertion of a
+ * card, it is also limited to SSH_IDENTITY_CACHE_TTL seconds.  */
+static struct
+{
+  char *blobs;      /* The key blobs or NULL if the cache is empty.  */
+  size_t bloblen;   /* The length of BLOBS.  */
+  u32 count;        /* The number of keys in BLOBS.  */
+  time_t created;   /* The time the cache was filled.  */
+  struct identity_stamp_s stamp;
+} identity_cache;
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -2777,6 +2810,97 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
 }
 
 
+/* Store information to detect changes of the sshcontrol file and the
+ * private key directory at STAMP.  */
+static gpg_error_t
+get_identity_stamp (struct identity_stamp_s *stamp)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  stamp->eventtick = get_eventcounter_tick ();
+
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  if (!gnupg_stat (fname, &st))
+    {
+      stamp->have_control = 1;
+      stamp->control_dev = st.st_dev;
+      stamp->control_ino = st.st_ino;
+      stamp->control_size = st.st_size;
+      stamp->control_mtime = st.st_mtime;
+    }
+  xfree (fname);
+
+  fname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  if (gnupg_stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      stamp->keydir_dev = st.st_dev;
+      stamp->keydir_ino = st.st_ino;
+      stamp->keydir_mtime = st.st_mtime;
+    }
+  xfree (fname);
+
+  return err;
+}
+
+
+/* Return true if the cached identity list can be used for a request
+ * with the file state STAMP.  */
+static int
+identity_cache_valid (const struct identity_stamp_s *stamp)
+{
+  time_t now = gnupg_get_time ();
+
+  return (identity_cache.blobs
+          && now >= identity_cache.created
+          && now - identity_cache.created < SSH_IDENTITY_CACHE_TTL
+          && !memcmp (stamp, &identity_cache.stamp, sizeof *stamp));
+}
+
+
+/* Store the COUNT keys serialized in the memory stream KEY_BLOBS in
+ * the identity cache.  STAMP describes the file state before the list
+ * was built.  Errors are ignored because the cache is not required.  */
+static void
+put_cached_identities (const struct identity_stamp_s *stamp,
+                       estream_t key_blobs, u32 count)
+{
+  char *blobs;
+  size_t nread;
+  off_t len;
+
+  len = es_ftello (key_blobs);
+  if (len < 0)
+    return;
+
+  blobs = xtrymalloc (len? len : 1);
+  if (!blobs)
+    return;
+  if (es_fseek (key_blobs, 0, SEEK_SET)
+      || es_read (key_blobs, blobs, len, &nread)
+      || nread != len)
+    {
+      xfree (blobs);
+      return;
+    }
+
+  xfree (identity_cache.blobs);
+  identity_cache.blobs = blobs;
+  identity_cache.bloblen = len;
+  identity_cache.count = count;
+  identity_cache.created = gnupg_get_time ();
+  memcpy (&identity_cache.stamp, stamp, sizeof *stamp);
+}
+
+
 /*
 
   Request handler.  Each handler is provided with a CTRL context, a
@@ -2796,6 +2920,8 @@ ssh_handler_request_identities (ctrl_t ctrl,
   gpg_error_t err;
   int ret;
   gpg_error_t ret_err;
+  struct identity_stamp_s stamp;
+  int cacheable;
 
   (void)request;
 
@@ -2810,7 +2936,23 @@ ssh_handler_request_identities (ctrl_t ctrl,
       goto out;
     }
 
-  err = ssh_send_available_keys (ctrl, key_blobs, &key_counter);
+  /* Note that the stamp is taken before the list is built so that
+   * changes done meanwhile are detected with the next request.  */
+  cacheable = !get_identity_stamp (&stamp);
+  if (cacheable && identity_cache_valid (&stamp))
+    {
+      if (es_write (key_blobs, identity_cache.blobs, identity_cache.bloblen,
+                    NULL))
+        err = gpg_error_from_syserror ();
+      else
+        key_counter = identity_cache.count;
+    }
+  else
+    {
+      err = ssh_send_available_keys (ctrl, key_blobs, &key_counter);
+      if (!err && cacheable)
+        put_cached_identities (&stamp, key_blobs, key_counter);
+    }
   if (!err)
     {
       ret = es_fseek (key_blobs, 0, SEEK_SET);
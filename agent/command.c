@@ -41,16 +41,23 @@
 #include "../common/ssh-utils.h"
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
+#include "../common/cmdstats.h"
 
 
 /* Maximum allowed size of the inquired ciphertext.  */
 #define MAXLEN_CIPHERTEXT 4096
+/* Maximum allowed size of the inquired ciphertext list.  */
+#define MAXLEN_CIPHERTEXTLIST (MAX_PKDECRYPT_ITEMS * MAXLEN_CIPHERTEXT)
 /* Maximum allowed size of the key parameters.  */
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 8192
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
+/* Maximum number of hashes for PKSIGN --multi.  */
+#define MAX_PKSIGN_HASHES 1024
+/* Maximum allowed size of the inquired hash list.  */
+#define MAXLEN_HASHLIST (MAX_PKSIGN_HASHES * (5 + 2 * MAX_DIGEST_LEN))
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -71,6 +78,12 @@ struct server_local_s
   /* Our Assuan context.  */
   assuan_context_t assuan_ctx;
 
+  /* The start time of the current command for the statistics.  */
+  struct timespec cmd_start;
+
+  /* Set if an ERR line has been sent for the current command.  */
+  unsigned int cmd_failed : 1;
+
   /* If this flag is true, the passphrase cache is used for signing
      operations.  It defaults to true but may be set on a per
      connection base.  The global option opt.ignore_cache_for_signing
@@ -526,6 +539,16 @@ bump_card_eventcounter (void)
 }
 
 
+/* Return a value which changes whenever one of the event counters,
+   including the internal one for possible key changes, changes.  This
+   is used to check the freshness of cached data.  */
+unsigned int
+get_eventcounter_tick (void)
+{
+  return eventcounter.any + eventcounter.maybe_key_change;
+}
+
+
 
 
 static const char hlp_istrusted[] =
@@ -965,11 +988,94 @@ cmd_sethash (assuan_context_t ctx, char *line)
 }
 
 
+/* Inquire the list of hashes for PKSIGN --multi.  Each line of the
+ * list has the algorithm number and the hex encoded hash value.  On
+ * success a malloced array is stored at R_HASHES and the number of
+ * items at R_NHASHES.  */
+static gpg_error_t
+inquire_hashlist (assuan_context_t ctx,
+                  struct pksign_hash_s **r_hashes, int *r_nhashes)
+{
+  gpg_error_t err;
+  unsigned char *buf;
+  size_t buflen;
+  const char *s, *end, *eol;
+  struct pksign_hash_s *hashes = NULL;
+  int nhashes = 0;
+  char *endp;
+  int n;
+
+  *r_hashes = NULL;
+  *r_nhashes = 0;
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_HASHLIST);
+  if (!err)
+    err = assuan_inquire (ctx, "HASHLIST", &buf, &buflen, MAXLEN_HASHLIST);
+  if (err)
+    return err;
+
+  hashes = xtrycalloc (MAX_PKSIGN_HASHES, sizeof *hashes);
+  if (!hashes)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  end = (const char *)buf + buflen;
+  for (s = (const char *)buf; s < end; s = eol + 1)
+    {
+      for (eol = s; eol < end && *eol != '\n'; eol++)
+        ;
+      if (eol == s)
+        continue;  /* Skip empty lines.  */
+      if (nhashes >= MAX_PKSIGN_HASHES)
+        {
+          err = set_error (GPG_ERR_TOO_LARGE, "too many hashes");
+          goto leave;
+        }
+      hashes[nhashes].algo = (int)strtoul (s, &endp, 10);
+      if (!hashes[nhashes].algo || gcry_md_test_algo (hashes[nhashes].algo))
+        {
+          err = set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
+          goto leave;
+        }
+      for (s = endp; s < eol && (*s == ' ' || *s == '\t'); s++)
+        ;
+      for (n=0; s + 1 < eol && hexdigitp (s) && hexdigitp (s+1)
+             && n < MAX_DIGEST_LEN; s += 2, n++)
+        hashes[nhashes].value[n] = xtoi_2 (s);
+      if (s != eol
+          || n != gcry_md_get_algo_dlen (hashes[nhashes].algo))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid hash value");
+          goto leave;
+        }
+      hashes[nhashes].valuelen = n;
+      nhashes++;
+    }
+
+  *r_hashes = hashes;
+  *r_nhashes = nhashes;
+  hashes = NULL;
+
+ leave:
+  xfree (hashes);
+  xfree (buf);
+  return err;
+}
+
+
 static const char hlp_pksign[] =
-  "PKSIGN [<options>] [<cache_nonce>]\n"
+  "PKSIGN [--multi] [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --multi the hashes to sign are not taken from SETHASH but\n"
+  "inquired using the keyword HASHLIST.  Each line of the list has\n"
+  "the hash algorithm number and the hex encoded hash value.  The\n"
+  "signatures are returned as a sequence of canonical S-expressions\n"
+  "in the same order.  The key is read and unprotected only once.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -979,7 +1085,11 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_multi;
+  struct pksign_hash_s *hashes = NULL;
+  int nhashes = 0;
 
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -993,15 +1103,28 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
+  if (opt_multi)
+    {
+      err = inquire_hashlist (ctx, &hashes, &nhashes);
+      if (err)
+        goto leave;
+    }
+
   init_membuf (&outbuf, 512);
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+  if (opt_multi)
+    err = agent_pksign_multi (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                              hashes, nhashes, &outbuf, cache_mode);
+  else
+    err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                        &outbuf, cache_mode);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (hashes);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -1010,10 +1133,17 @@ cmd_pksign (assuan_context_t ctx, char *line)
 
 
 static const char hlp_pkdecrypt[] =
-  "PKDECRYPT [<options>]\n"
+  "PKDECRYPT [--multi]\n"
   "\n"
   "Perform the actual decrypt operation.  Input is not\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --multi the inquired CIPHERTEXT may consist of up to 256\n"
+  "canonical S-expressions, one after the other.  For each of them\n"
+  "a canonical S-expression is returned in the same order: the\n"
+  "plaintext value, optionally preceded by a \"padding\" list, or an\n"
+  "\"error\" list with the error code.  The key is read and\n"
+  "unprotected only once.";
 static gpg_error_t
 cmd_pkdecrypt (assuan_context_t ctx, char *line)
 {
@@ -1023,21 +1153,31 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   size_t valuelen;
   membuf_t outbuf;
   int padding;
+  int opt_multi;
+  size_t maxlen;
 
-  (void)line;
+  opt_multi = has_option (line, "--multi");
+  maxlen = opt_multi? MAXLEN_CIPHERTEXTLIST : MAXLEN_CIPHERTEXT;
 
   /* First inquire the data to decrypt */
-  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_CIPHERTEXT);
+  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", (unsigned int)maxlen);
   if (!rc)
     rc = assuan_inquire (ctx, "CIPHERTEXT",
-			&value, &valuelen, MAXLEN_CIPHERTEXT);
+			&value, &valuelen, maxlen);
   if (rc)
     return rc;
 
   init_membuf (&outbuf, 512);
 
-  rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
-                        value, valuelen, &outbuf, &padding);
+  if (opt_multi)
+    {
+      padding = -1;
+      rc = agent_pkdecrypt_multi (ctrl, ctrl->server_local->keydesc,
+                                  value, valuelen, &outbuf);
+    }
+  else
+    rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
+                          value, valuelen, &outbuf, &padding);
   xfree (value);
   if (rc)
     clear_outbuf (&outbuf);
@@ -3836,6 +3976,7 @@ static const char hlp_getinfo[] =
   "  connections     - Return number of active connections.\n"
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
+  "  stats [--reset] - Return per command statistics.\n"
   "  cmd_has_option CMD OPT\n"
   "                  - Returns OK if command CMD has option OPT.\n";
 static gpg_error_t
@@ -3897,6 +4038,12 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       rc = gpg_error (GPG_ERR_FORBIDDEN);
     }
   /* All sub-commands below are not allowed in restricted mode.  */
+  else if (!strcmp (line, "stats") || !strcmp (line, "stats --reset"))
+    {
+      rc = cmdstats_send (ctx);
+      if (!rc && line[5])
+        cmdstats_reset ();
+    }
   else if (!strcmp (line, "pid"))
     {
       char numbuf[50];
@@ -4147,6 +4294,20 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  cmdstats_start (&ctrl->server_local->cmd_start);
+  ctrl->server_local->cmd_failed = 0;
+  return 0;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
    last assuan operation and not the one returned from the command. */
 static void
@@ -4156,6 +4317,10 @@ post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 
   (void)err;
 
+  cmdstats_record (assuan_get_command_name (ctx),
+                   &ctrl->server_local->cmd_start,
+                   ctrl->server_local->cmd_failed);
+
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
 }
@@ -4173,6 +4338,9 @@ io_monitor (assuan_context_t ctx, void *hook, int direction,
 
   (void) hook;
 
+  if (ctx && cmdstats_err_line_p (direction, line, linelen))
+    ctrl->server_local->cmd_failed = 1;
+
   /* We want to suppress all Assuan log messages for connections from
    * self.  However, assuan_get_pid works only after
    * assuan_accept. Now, assuan_accept already logs a line ending with
@@ -4227,6 +4395,16 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "mode1003"))
         return 1;
     }
+  else if (!strcmp (cmd, "PKSIGN"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
+  else if (!strcmp (cmd, "PKDECRYPT"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
 
   return 0;
 }
@@ -4291,6 +4469,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
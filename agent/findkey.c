@@ -43,6 +43,38 @@
 static gpg_error_t read_key_file (const unsigned char *grip,
                                   gcry_sexp_t *result, nvc_t *r_keymeta);
 static gpg_error_t is_shadowed_key (gcry_sexp_t s_skey);
+static void flush_key_file_cache_item (const unsigned char *grip);
+
+
+/* The maximum number of entries in the key file cache.  */
+#define KEY_FILE_CACHE_MAX 128
+
+/* The number of hash buckets of the key file cache.  Must be a power
+ * of 2.  */
+#define KEY_FILE_CACHE_BUCKETS 64
+
+/* An entry in the cache of parsed key files.  The entry is valid as
+ * long as the file's inode, size and modification time do not
+ * change.  Only protected and shadowed keys are cached so that
+ * unprotected key material is never kept here.  */
+struct key_file_cache_s
+{
+  struct key_file_cache_s *next;
+  unsigned char grip[KEYGRIP_LEN];
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  unsigned long lastuse;  /* Value of key_file_cache_tick at last use.  */
+  unsigned char *key;     /* The key in canonical format.  */
+  size_t keylen;
+  nvc_t keymeta;          /* The meta data or NULL for the old format.  */
+};
+typedef struct key_file_cache_s *key_file_cache_t;
+
+static key_file_cache_t key_file_cache[KEY_FILE_CACHE_BUCKETS];
+static unsigned int key_file_cache_count;
+static unsigned long key_file_cache_tick;
 
 
 /* Helper to pass data to the check callback of the unprotect function. */
@@ -305,6 +337,7 @@ agent_write_private_key (const unsigned char *grip,
   bump_key_eventcounter ();
 
  leave:
+  flush_key_file_cache_item (grip);
   if (blocksigs)
     gnupg_unblock_all_signals ();
   es_fclose (fp);
@@ -375,6 +408,7 @@ agent_update_private_key (const unsigned char *grip, nvc_t pk)
 
 
  leave:
+  flush_key_file_cache_item (grip);
   if (blocksigs)
     gnupg_unblock_all_signals ();
   es_fclose (fp);
@@ -852,23 +886,174 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 }
 
 
+static void
+release_key_file_cache_item (key_file_cache_t item)
+{
+  xfree (item->key);
+  nvc_release (item->keymeta);
+  xfree (item);
+}
+
+
+/* Remove the cache entry for GRIP.  This needs to be called whenever
+ * we change the key file.  */
+static void
+flush_key_file_cache_item (const unsigned char *grip)
+{
+  key_file_cache_t item, prev;
+  int bucket = grip[0] & (KEY_FILE_CACHE_BUCKETS - 1);
+
+  for (prev = NULL, item = key_file_cache[bucket]; item;
+       prev = item, item = item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      {
+        if (prev)
+          prev->next = item->next;
+        else
+          key_file_cache[bucket] = item->next;
+        release_key_file_cache_item (item);
+        key_file_cache_count--;
+        return;
+      }
+}
+
+
+/* Flush the entire key file cache.  */
+void
+agent_flush_key_file_cache (void)
+{
+  key_file_cache_t item, next;
+  int i;
+
+  for (i=0; i < KEY_FILE_CACHE_BUCKETS; i++)
+    {
+      for (item = key_file_cache[i]; item; item = next)
+        {
+          next = item->next;
+          release_key_file_cache_item (item);
+        }
+      key_file_cache[i] = NULL;
+    }
+  key_file_cache_count = 0;
+}
+
+
+/* Return the key for GRIP from the key file cache if the entry is
+ * still valid for a file with the stat info ST.  On success true is
+ * returned and the key and a copy of the meta data are stored at
+ * RESULT and R_KEYMETA.  */
+static int
+get_key_file_cache_item (const unsigned char *grip, const struct stat *st,
+                         gcry_sexp_t *result, nvc_t *r_keymeta)
+{
+  key_file_cache_t item;
+  int bucket = grip[0] & (KEY_FILE_CACHE_BUCKETS - 1);
+
+  for (item = key_file_cache[bucket]; item; item = item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      break;
+  if (!item)
+    return 0;
+
+  if (item->dev != st->st_dev || item->ino != st->st_ino
+      || item->size != st->st_size || item->mtime != st->st_mtime)
+    {
+      flush_key_file_cache_item (grip);
+      return 0;
+    }
+
+  if (gcry_sexp_sscan (result, NULL, (char*)item->key, item->keylen))
+    return 0;
+  if (r_keymeta && item->keymeta)
+    {
+      *r_keymeta = nvc_clone (item->keymeta);
+      if (!*r_keymeta)
+        {
+          gcry_sexp_release (*result);
+          *result = NULL;
+          return 0;
+        }
+    }
+
+  item->lastuse = ++key_file_cache_tick;
+  return 1;
+}
+
+
+/* Put the key S_SKEY with the meta data KEYMETA read from the file
+ * with the stat info ST into the key file cache.  Keys which are not
+ * protected are not cached.  */
+static void
+put_key_file_cache_item (const unsigned char *grip, const struct stat *st,
+                         gcry_sexp_t s_skey, nvc_t keymeta)
+{
+  key_file_cache_t item, oldest;
+  const char *name;
+  size_t n;
+  int i, bucket;
+
+  name = gcry_sexp_nth_data (s_skey, 0, &n);
+  if (!name
+      || !((n == 21 && !memcmp (name, "protected-private-key", 21))
+           || (n == 20 && !memcmp (name, "shadowed-private-key", 20))))
+    return;
+
+  flush_key_file_cache_item (grip);
+
+  if (key_file_cache_count >= KEY_FILE_CACHE_MAX)
+    {
+      /* Evict the least recently used entry.  */
+      oldest = NULL;
+      for (i=0; i < KEY_FILE_CACHE_BUCKETS; i++)
+        for (item = key_file_cache[i]; item; item = item->next)
+          if (!oldest || item->lastuse < oldest->lastuse)
+            oldest = item;
+      if (oldest)
+        flush_key_file_cache_item (oldest->grip);
+    }
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;
+  if (make_canon_sexp (s_skey, &item->key, &item->keylen)
+      || (keymeta && !(item->keymeta = nvc_clone (keymeta))))
+    {
+      release_key_file_cache_item (item);
+      return;
+    }
+  memcpy (item->grip, grip, KEYGRIP_LEN);
+  item->dev = st->st_dev;
+  item->ino = st->st_ino;
+  item->size = st->st_size;
+  item->mtime = st->st_mtime;
+  item->lastuse = ++key_file_cache_tick;
+
+  bucket = grip[0] & (KEY_FILE_CACHE_BUCKETS - 1);
+  item->next = key_file_cache[bucket];
+  key_file_cache[bucket] = item;
+  key_file_cache_count++;
+}
+
+
 /* Read the key identified by GRIP from the private key directory and
  * return it as an gcrypt S-expression object in RESULT.  If R_KEYMETA
  * is not NULL and the extended key format is used, the meta data
  * items are stored there.  However the "Key:" item is removed from
  * it.  On failure returns an error code and stores NULL at RESULT and
- * R_KEYMETA. */
+ * R_KEYMETA.  Protected keys are taken from the key file cache if the
+ * file has not changed.  */
 static gpg_error_t
 read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
 {
   gpg_error_t err;
   char *fname;
   estream_t fp;
-  struct stat st;
+  struct stat st, cachest;
   unsigned char *buf;
   size_t buflen, erroff;
   gcry_sexp_t s_skey;
   char first;
+  int cacheable;
 
   *result = NULL;
   if (r_keymeta)
@@ -879,6 +1064,17 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
     {
       return gpg_error_from_syserror ();
     }
+
+  /* Check whether we can use a cached version of the file.  */
+  cacheable = !gnupg_stat (fname, &cachest);
+  if (!cacheable)
+    flush_key_file_cache_item (grip);
+  else if (get_key_file_cache_item (grip, &cachest, result, r_keymeta))
+    {
+      xfree (fname);
+      return 0;
+    }
+
   fp = es_fopen (fname, "rb");
   if (!fp)
     {
@@ -927,7 +1123,11 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
             log_error ("error getting private key from '%s': %s\n",
                        fname, gpg_strerror (err));
           else
-            nvc_delete_named (pk, "Key:");
+            {
+              nvc_delete_named (pk, "Key:");
+              if (cacheable)
+                put_key_file_cache_item (grip, &cachest, *result, pk);
+            }
         }
 
       if (!err && r_keymeta)
@@ -983,6 +1183,8 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
                  (unsigned int)erroff, gpg_strerror (err));
       return err;
     }
+  if (cacheable)
+    put_key_file_cache_item (grip, &cachest, s_skey, NULL);
   *result = s_skey;
   return 0;
 }
@@ -1002,6 +1204,7 @@ remove_key_file (const unsigned char *grip)
     }
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
+  flush_key_file_cache_item (grip);
   xfree (fname);
   return err;
 }
@@ -30,6 +30,21 @@
 #include "../common/exechelp.h"
 #include "../common/sysutils.h"
 
+
+/* A pre-generated key of the key generation pool.  */
+struct keygen_pool_item_s
+{
+  struct keygen_pool_item_s *next;
+  char *spec;           /* The --keygen-pool value used.  */
+  gcry_sexp_t s_key;    /* The result of gcry_pk_genkey.  */
+  size_t keyparamlen;
+  char keyparam[1];     /* The key parameters in canonical format.  */
+};
+typedef struct keygen_pool_item_s *keygen_pool_item_t;
+
+/* The pool of pre-generated keys.  Older keys come first.  */
+static keygen_pool_item_t keygen_pool;
+
 static int
 store_key (gcry_sexp_t private, const char *passphrase, int force,
            unsigned long s2k_count, time_t timestamp)
@@ -456,6 +471,203 @@ agent_ask_new_passphrase (ctrl_t ctrl, const char *prompt,
 }
 
 
+/* Return the key parameters for the --keygen-pool value SPEC at
+ * R_KEYPARAM.  Only RSA keys are supported ("rsa" followed by the
+ * number of bits); other keys are generated fast enough.  */
+static gpg_error_t
+keygen_pool_keyparam (const char *spec, gcry_sexp_t *r_keyparam)
+{
+  unsigned long nbits;
+  char *endp;
+
+  *r_keyparam = NULL;
+  if (ascii_strncasecmp (spec, "rsa", 3) || !digitp (spec+3))
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  nbits = strtoul (spec+3, &endp, 10);
+  if (*endp || nbits < 1024 || nbits > 16384 || (nbits % 32))
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  return gcry_sexp_build (r_keyparam, NULL, "(genkey(rsa(nbits %u)))",
+                          (unsigned int)nbits);
+}
+
+
+/* Return the S-expression SEXP in canonical format as a malloced
+ * buffer and store its length at R_LEN.  Returns NULL on error.  */
+static char *
+canon_keyparam (gcry_sexp_t sexp, size_t *r_len)
+{
+  size_t len;
+  char *buf;
+
+  len = gcry_sexp_sprint (sexp, GCRYSEXP_FMT_CANON, NULL, 0);
+  buf = len? xtrymalloc (len) : NULL;
+  if (!buf)
+    return NULL;
+  *r_len = gcry_sexp_sprint (sexp, GCRYSEXP_FMT_CANON, buf, len);
+  return buf;
+}
+
+
+static void
+release_keygen_pool_item (keygen_pool_item_t item)
+{
+  if (!item)
+    return;
+  gcry_sexp_release (item->s_key);
+  xfree (item->spec);
+  xfree (item);
+}
+
+
+/* Check that SPEC is a valid value for --keygen-pool.  */
+gpg_error_t
+agent_keygen_pool_check (const char *spec)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_keyparam;
+
+  err = keygen_pool_keyparam (spec, &s_keyparam);
+  gcry_sexp_release (s_keyparam);
+  return err;
+}
+
+
+/* Return the number of keys for SPEC in the pool.  */
+static unsigned int
+keygen_pool_count (const char *spec)
+{
+  keygen_pool_item_t item;
+  unsigned int count = 0;
+
+  for (item = keygen_pool; item; item = item->next)
+    if (!strcmp (item->spec, spec))
+      count++;
+  return count;
+}
+
+
+/* Add one key to the pool of pre-generated keys if needed.  Keys for
+ * values not anymore given by --keygen-pool are removed.  Returns
+ * true if a key has been generated.  This is called by a background
+ * thread.  */
+int
+agent_keygen_pool_fill (void)
+{
+  gpg_error_t err;
+  keygen_pool_item_t item, *itemp;
+  strlist_t sl;
+  char *spec = NULL;
+  gcry_sexp_t s_keyparam = NULL;
+  gcry_sexp_t s_key = NULL;
+  char *keyparam = NULL;
+  size_t keyparamlen;
+
+  /* Remove keys not anymore configured or exceeding the pool size.  */
+  for (itemp = &keygen_pool; (item = *itemp); )
+    if (!strlist_find (opt.keygen_pool, item->spec)
+        || keygen_pool_count (item->spec) > opt.keygen_pool_size)
+      {
+        *itemp = item->next;
+        release_keygen_pool_item (item);
+      }
+    else
+      itemp = &item->next;
+
+  for (sl = opt.keygen_pool; sl; sl = sl->next)
+    if (keygen_pool_count (sl->d) < opt.keygen_pool_size)
+      break;
+  if (!sl)
+    return 0;  /* The pool is complete.  */
+
+  /* Key generation may release the nPth lock and thus the options
+   * may change in the meantime; we need to make a copy.  */
+  spec = xtrystrdup (sl->d);
+  if (!spec)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = keygen_pool_keyparam (spec, &s_keyparam);
+  if (err)
+    goto leave;
+  keyparam = canon_keyparam (s_keyparam, &keyparamlen);
+  if (!keyparam)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    log_debug ("generating a %s key for the pool\n", spec);
+  err = gcry_pk_genkey (&s_key, s_keyparam);
+  if (err)
+    goto leave;
+
+  item = xtrymalloc (sizeof *item + keyparamlen);
+  if (!item)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  item->next = NULL;
+  item->spec = spec;
+  spec = NULL;
+  item->s_key = s_key;
+  s_key = NULL;
+  item->keyparamlen = keyparamlen;
+  memcpy (item->keyparam, keyparam, keyparamlen);
+  for (itemp = &keygen_pool; *itemp; itemp = &(*itemp)->next)
+    ;
+  *itemp = item;
+
+ leave:
+  if (err)
+    log_error ("generating a %s key for the pool failed: %s\n",
+               spec? spec : "", gpg_strerror (err));
+  xfree (keyparam);
+  gcry_sexp_release (s_key);
+  gcry_sexp_release (s_keyparam);
+  xfree (spec);
+  return !err;
+}
+
+
+/* Take a pre-generated key matching the parameters S_KEYPARAM from
+ * the pool.  The key is removed from the pool so that it is never
+ * handed out twice.  Returns NULL if no such key is available.  */
+static gcry_sexp_t
+take_pooled_key (gcry_sexp_t s_keyparam)
+{
+  keygen_pool_item_t item, *itemp;
+  gcry_sexp_t s_key;
+  char *keyparam;
+  size_t keyparamlen;
+
+  if (!keygen_pool)
+    return NULL;
+  keyparam = canon_keyparam (s_keyparam, &keyparamlen);
+  if (!keyparam)
+    return NULL;
+
+  for (itemp = &keygen_pool; (item = *itemp); itemp = &item->next)
+    if (item->keyparamlen == keyparamlen
+        && !memcmp (item->keyparam, keyparam, keyparamlen))
+      break;
+  xfree (keyparam);
+  if (!item)
+    return NULL;
+
+  *itemp = item->next;
+  s_key = item->s_key;
+  item->s_key = NULL;
+  if (opt.verbose)
+    log_info ("using a pre-generated %s key\n", item->spec);
+  release_keygen_pool_item (item);
+  return s_key;
+}
+
+
 
 /* Generate a new keypair according to the parameters given in
    KEYPARAM.  If CACHE_NONCE is given first try to lookup a passphrase
@@ -510,7 +722,11 @@ agent_genkey (ctrl_t ctrl, const char *cache_nonce, time_t timestamp,
       passphrase = passphrase_buffer;
     }
 
-  rc = gcry_pk_genkey (&s_key, s_keyparam );
+  s_key = take_pooled_key (s_keyparam);
+  if (s_key)
+    rc = 0;
+  else
+    rc = gcry_pk_genkey (&s_key, s_keyparam );
   gcry_sexp_release (s_keyparam);
   if (rc)
     {
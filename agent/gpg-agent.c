@@ -143,6 +143,8 @@ enum cmd_and_opt_values
   oDisableCheckOwnSocket,
   oS2KCount,
   oS2KCalibration,
+  oKeygenPool,
+  oKeygenPoolSize,
   oAutoExpandSecmem,
   oListenBacklog,
   oInactivityTimeout,
@@ -264,6 +266,8 @@ static gpgrt_opt_t opts[] = {
                 /* */                    N_("allow presetting passphrase")),
   ARGPARSE_s_u (oS2KCount, "s2k-count", "@"),
   ARGPARSE_s_u (oS2KCalibration, "s2k-calibration", "@"),
+  ARGPARSE_s_s (oKeygenPool, "keygen-pool", "@"),
+  ARGPARSE_s_u (oKeygenPoolSize, "keygen-pool-size", "@"),
 
   ARGPARSE_header ("Passphrase policy",
                    N_("Options enforcing a passphrase policy")),
@@ -340,6 +344,7 @@ static struct debug_flags_s debug_flags [] =
 #define MIN_PASSPHRASE_LEN    (8)
 #define MIN_PASSPHRASE_NONALPHA (1)
 #define MAX_PASSPHRASE_DAYS   (0)
+#define KEYGEN_POOL_SIZE      (4)
 
 /* The timer tick used for housekeeping stuff.  Note that on Windows
  * we use a SetWaitableTimer seems to signal earlier than about 2
@@ -350,6 +355,14 @@ static struct debug_flags_s debug_flags [] =
 #define TIMERTICK_INTERVAL          (4)
 #define CHECK_OWN_SOCKET_INTERVAL  (60)
 
+/* The number of seconds after startup we re-calibrate the S2K count
+ * in the background.  */
+#define S2K_RECALIBRATION_DELAY    (10)
+
+/* The number of seconds between the generation of two keys for the
+ * pool of pre-generated keys.  */
+#define KEYGEN_POOL_INTERVAL        (2)
+
 
 /* Flag indicating that the ssh-agent subsystem has been enabled.  */
 static int ssh_support;
@@ -894,6 +907,9 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.ssh_fingerprint_digest = GCRY_MD_SHA256;
       opt.s2k_count = 0;
       set_s2k_calibration_time (0);  /* Set to default.  */
+      free_strlist (opt.keygen_pool);
+      opt.keygen_pool = NULL;
+      opt.keygen_pool_size = KEYGEN_POOL_SIZE;
       return 1;
     }
 
@@ -1004,6 +1020,25 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       set_s2k_calibration_time (pargs->r.ret_ulong);
       break;
 
+    case oKeygenPool:
+      {
+        gpg_error_t err = agent_keygen_pool_check (pargs->r.ret_str);
+
+        if (err)
+          log_error ("invalid value '%s' for keygen-pool: %s\n",
+                     pargs->r.ret_str, gpg_strerror (err));
+        else if (!strlist_find (opt.keygen_pool, pargs->r.ret_str))
+          add_to_strlist (&opt.keygen_pool, pargs->r.ret_str);
+      }
+      break;
+
+    case oKeygenPoolSize:
+      if (pargs->r.ret_ulong > 64)
+        log_error ("keygen-pool-size must be in the range from 0 to 64\n");
+      else
+        opt.keygen_pool_size = pargs->r.ret_ulong;
+      break;
+
     case oNoop: break;
 
     default:
@@ -1058,6 +1093,7 @@ initialize_modules (void)
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
   initialize_module_trustlist ();
+  set_s2k_calibration_persistent (1);
 }
 
 
@@ -2483,6 +2519,7 @@ agent_sighup_action (void)
             "re-reading configuration and flushing cache\n");
 
   agent_flush_cache (0);
+  agent_flush_key_file_cache ();
   reread_configuration ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
@@ -2963,6 +3000,58 @@ start_connection_thread_ssh (void *arg)
 }
 
 
+/* This thread re-calibrates the S2K count some time after startup
+ * and updates the stored value.  The stored value is used until
+ * then.  If the calibration measures the thread's own CPU time the
+ * hashing is done without holding the nPth lock so that it does not
+ * delay the other threads; otherwise the time used by those threads
+ * would be accounted to the calibration.  */
+static void *
+s2k_calibration_thread (void *arg)
+{
+  unsigned int milliseconds;
+  unsigned long count;
+
+  (void)arg;
+
+  npth_sleep (S2K_RECALIBRATION_DELAY);
+  if (opt.s2k_count)
+    return NULL;  /* Calibration not used.  */
+
+  milliseconds = get_s2k_calibration_time ();
+  if (s2k_calibration_uses_thread_time ())
+    {
+      npth_unprotect ();
+      count = calibrate_s2k_count (milliseconds);
+      npth_protect ();
+    }
+  else
+    count = calibrate_s2k_count (milliseconds);
+  set_s2k_calibrated_count (milliseconds, count);
+  return NULL;
+}
+
+
+/* This thread fills the pool of pre-generated keys.  Libgcrypt may
+ * itself release the nPth lock using the system call clamp and thus
+ * the key generation can't be done without holding that lock.  To
+ * keep the delay for other threads short, we generate at most one
+ * key every KEYGEN_POOL_INTERVAL seconds.  */
+static void *
+keygen_pool_thread (void *arg)
+{
+  (void)arg;
+
+  while (!shutdown_pending)
+    {
+      npth_sleep (KEYGEN_POOL_INTERVAL);
+      if (!shutdown_pending)
+        agent_keygen_pool_fill ();
+    }
+  return NULL;
+}
+
+
 /* Connection handler loop.  Wait for connection requests and spawn a
    thread after accepting a connection.  */
 static void
@@ -3064,6 +3153,18 @@ handle_connections (gnupg_fd_t listen_fd,
     }
 #endif /*HAVE_W32_SYSTEM*/
 
+  {
+    npth_t thread;
+
+    ret = npth_create (&thread, &tattr, s2k_calibration_thread, NULL);
+    if (ret)
+      log_error ("error spawning S2K calibration thread: %s\n",
+                 strerror (ret));
+    ret = npth_create (&thread, &tattr, keygen_pool_thread, NULL);
+    if (ret)
+      log_error ("error spawning key pool thread: %s\n", strerror (ret));
+  }
+
   /* Set a flag to tell call-scd.c that it may enable event
      notifications.  */
   opt.sigusr2_enabled = 1;
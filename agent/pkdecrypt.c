@@ -29,6 +29,87 @@
 #include "agent.h"
 
 
+/* Decrypt the canonical S-expression CIPHERTEXT of length
+ * CIPHERTEXTLEN using a smartcard or a TPM and store the plaintext at
+ * R_BUF and its length at R_LEN.  S_SKEY and SHADOW_INFO are the
+ * values returned by agent_key_from_file; NO_SHADOW_INFO is set if no
+ * key file exists.  The padding information is stored at R_PADDING
+ * with -1 for not known.  */
+static gpg_error_t
+divert_pkdecrypt_one (ctrl_t ctrl, gcry_sexp_t s_skey,
+                      unsigned char *shadow_info, int no_shadow_info,
+                      const unsigned char *ciphertext, size_t ciphertextlen,
+                      char **r_buf, size_t *r_len, int *r_padding)
+{
+  gpg_error_t err;
+
+  *r_buf = NULL;
+  if (!gcry_sexp_canon_len (ciphertext, ciphertextlen, NULL, NULL))
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  if (s_skey && agent_is_tpm2_key (s_skey))
+    err = divert_tpm2_pkdecrypt (ctrl, ciphertext, shadow_info,
+                                 r_buf, r_len, r_padding);
+  else
+    err = divert_pkdecrypt (ctrl, ctrl->keygrip, ciphertext,
+                            r_buf, r_len, r_padding);
+  if (err)
+    {
+      /* We restore the original error (ie. no seckey) is no card
+       * has been found and we have no shadow key.  This avoids a
+       * surprising "card removed" error code.  */
+      if ((gpg_err_code (err) == GPG_ERR_CARD_REMOVED
+           || gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT)
+          && no_shadow_info)
+        err = gpg_error (GPG_ERR_NO_SECKEY);
+      else
+        log_error ("smartcard decryption failed: %s\n", gpg_strerror (err));
+    }
+  return err;
+}
+
+
+/* Append the plaintext BUF of length LEN as returned by a smartcard
+ * to OUTBUF.  If MULTI is set exactly the S-expression is appended
+ * so that several of them can be concatenated; otherwise a
+ * terminating Nul is also written as PKDECRYPT has always done.  */
+static void
+put_value_membuf (membuf_t *outbuf, const char *buf, size_t len, int multi)
+{
+  put_membuf_printf (outbuf, "(5:value%u:", (unsigned int)len);
+  put_membuf (outbuf, buf, len);
+  put_membuf (outbuf, ")", multi? 1 : 2);
+}
+
+
+/* Append the plaintext S_PLAIN as returned by gcry_pk_decrypt in
+ * canonical format to OUTBUF.  MULTI has the same meaning as for
+ * put_value_membuf.  */
+static void
+put_plain_membuf (membuf_t *outbuf, gcry_sexp_t s_plain, int multi)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xmalloc (len);
+  len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  if (*buf == '(')
+    put_membuf (outbuf, buf, len);
+  else
+    {
+      /* Old style libgcrypt: This is only an S-expression
+         part. Turn it into a complete S-expression. */
+      put_membuf (outbuf, "(5:value", 8);
+      put_membuf (outbuf, buf, len);
+      put_membuf (outbuf, ")", multi? 1 : 2);
+    }
+  xfree (buf);
+}
+
+
 /* DECRYPT the stuff in ciphertext which is expected to be a S-Exp.
    Try to get the key from CTRL and write the decoded stuff back to
    OUTFP.   The padding information is stored at R_PADDING with -1
@@ -80,36 +161,11 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 
   if (shadow_info || no_shadow_info)
     { /* divert operation to the smartcard */
-
-      if (!gcry_sexp_canon_len (ciphertext, ciphertextlen, NULL, NULL))
-        {
-          err = gpg_error (GPG_ERR_INV_SEXP);
-          goto leave;
-        }
-
-      if (s_skey && agent_is_tpm2_key (s_skey))
-	err = divert_tpm2_pkdecrypt (ctrl, ciphertext, shadow_info,
-                                     &buf, &len, r_padding);
-      else
-        err = divert_pkdecrypt (ctrl, ctrl->keygrip, ciphertext,
-                                &buf, &len, r_padding);
-      if (err)
-        {
-          /* We restore the original error (ie. no seckey) is no card
-           * has been found and we have no shadow key.  This avoids a
-           * surprising "card removed" error code.  */
-          if ((gpg_err_code (err) == GPG_ERR_CARD_REMOVED
-               || gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT)
-              && no_shadow_info)
-            err = gpg_error (GPG_ERR_NO_SECKEY);
-          else
-            log_error ("smartcard decryption failed: %s\n", gpg_strerror (err));
-          goto leave;
-        }
-
-      put_membuf_printf (outbuf, "(5:value%u:", (unsigned int)len);
-      put_membuf (outbuf, buf, len);
-      put_membuf (outbuf, ")", 2);
+      err = divert_pkdecrypt_one (ctrl, s_skey, shadow_info, no_shadow_info,
+                                  ciphertext, ciphertextlen,
+                                  &buf, &len, r_padding);
+      if (!err)
+        put_value_membuf (outbuf, buf, len, 0);
     }
   else
     { /* No smartcard, but a private key */
@@ -131,24 +187,9 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
           log_debug ("plain: ");
           gcry_sexp_dump (s_plain);
         }
-      len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, NULL, 0);
-      log_assert (len);
-      buf = xmalloc (len);
-      len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, buf, len);
-      log_assert (len);
-      if (*buf == '(')
-        put_membuf (outbuf, buf, len);
-      else
-        {
-          /* Old style libgcrypt: This is only an S-expression
-             part. Turn it into a complete S-expression. */
-          put_membuf (outbuf, "(5:value", 8);
-          put_membuf (outbuf, buf, len);
-          put_membuf (outbuf, ")", 2);
-        }
+      put_plain_membuf (outbuf, s_plain, 0);
     }
 
-
  leave:
   gcry_sexp_release (s_skey);
   gcry_sexp_release (s_plain);
@@ -157,3 +198,120 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
   xfree (shadow_info);
   return err;
 }
+
+
+/* Append an error item for ERR to OUTBUF.  */
+static void
+put_error_membuf (membuf_t *outbuf, gpg_error_t err)
+{
+  char numbuf[35];
+
+  snprintf (numbuf, sizeof numbuf, "%u", (unsigned int)err);
+  put_membuf_printf (outbuf, "(5:error%u:%s)",
+                     (unsigned int)strlen (numbuf), numbuf);
+}
+
+
+/* Decrypt all ciphertexts from CIPHERTEXTS, which is a sequence of
+ * canonical S-expressions with a total length of CIPHERTEXTSLEN,
+ * using the key selected in CTRL.  For each ciphertext an S-expression
+ * is appended to OUTBUF: either the plaintext as returned by
+ * agent_pkdecrypt or an "error" list with the error code.  If the
+ * padding is known it is given by a "padding" list preceding the
+ * plaintext.  The private key is read and unprotected only once.  */
+gpg_error_t
+agent_pkdecrypt_multi (ctrl_t ctrl, const char *desc_text,
+                       const unsigned char *ciphertexts,
+                       size_t ciphertextslen, membuf_t *outbuf)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_cipher, s_plain;
+  unsigned char *shadow_info = NULL;
+  int no_shadow_info = 0;
+  const unsigned char *s;
+  size_t n, nleft;
+  int nitems = 0;
+  int padding;
+  char *buf;
+  size_t len;
+
+  if (!ctrl->have_keygrip)
+    {
+      log_error ("speculative decryption not yet supported\n");
+      return gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+  /* Count the items.  */
+  for (s = ciphertexts, nleft = ciphertextslen; nleft; s += n, nleft -= n)
+    {
+      n = gcry_sexp_canon_len (s, nleft, NULL, NULL);
+      if (!n)
+        return gpg_error (GPG_ERR_INV_SEXP);
+      if (++nitems > MAX_PKDECRYPT_ITEMS)
+        return gpg_error (GPG_ERR_TOO_LARGE);
+    }
+  if (!nitems)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  err = agent_key_from_file (ctrl, NULL, desc_text,
+                             NULL, &shadow_info,
+                             CACHE_MODE_NORMAL, NULL, &s_skey, NULL, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
+    no_shadow_info = 1;
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  if (shadow_info || no_shadow_info)
+    {
+      /* Divert each item to the smartcard.  */
+      for (s = ciphertexts, nleft = ciphertextslen; nleft; s += n, nleft -= n)
+        {
+          n = gcry_sexp_canon_len (s, nleft, NULL, NULL);
+          err = divert_pkdecrypt_one (ctrl, s_skey, shadow_info,
+                                      no_shadow_info, s, n,
+                                      &buf, &len, &padding);
+          if (err)
+            put_error_membuf (outbuf, err);
+          else
+            {
+              if (padding != -1)
+                put_membuf_printf (outbuf, "(7:padding1:%d)", !!padding);
+              put_value_membuf (outbuf, buf, len, 1);
+            }
+          xfree (buf);
+        }
+      err = 0;
+      goto leave;
+    }
+
+  for (s = ciphertexts, nleft = ciphertextslen; nleft; s += n, nleft -= n)
+    {
+      n = gcry_sexp_canon_len (s, nleft, NULL, NULL);
+      s_plain = NULL;
+      if (gcry_sexp_sscan (&s_cipher, NULL, (const char*)s, n))
+        err = gpg_error (GPG_ERR_INV_DATA);
+      else
+        {
+          err = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+          gcry_sexp_release (s_cipher);
+        }
+      if (err)
+        {
+          log_error ("decryption failed: %s\n", gpg_strerror (err));
+          put_error_membuf (outbuf, err);
+        }
+      else
+        put_plain_membuf (outbuf, s_plain, 1);
+      gcry_sexp_release (s_plain);
+    }
+  err = 0;
+
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return err;
+}
@@ -268,6 +268,68 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
+/* Sign DATA of length DATALEN using the private key S_SKEY with the
+ * public key algorithm ALGO.  The digest algorithm and flags are
+ * taken from CTRL.  On success the signature is stored at R_SIG.  */
+static gpg_error_t
+do_sign_with_skey (ctrl_t ctrl, gcry_sexp_t s_skey, int algo,
+                   const unsigned char *data, int datalen,
+                   gcry_sexp_t *r_sig)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_hash = NULL;
+
+  *r_sig = NULL;
+
+  /* Put the hash into a sexp */
+  if (algo == GCRY_PK_EDDSA)
+    err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
+                           &s_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               &s_hash);
+  else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
+    err = do_encode_dsa (data, datalen,
+                         algo, s_skey,
+                         &s_hash);
+  else if (ctrl->digest.is_pss)
+    {
+      log_info ("signing with rsaPSS is currently only supported"
+                " for (some) smartcards\n");
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        &s_hash,
+                        ctrl->digest.raw_value);
+  if (err)
+    goto leave;
+
+  if (DBG_CRYPTO)
+    {
+      gcry_log_debugsxp ("skey", s_skey);
+      gcry_log_debugsxp ("hash", s_hash);
+    }
+
+  /* sign */
+  err = gcry_pk_sign (r_sig, s_hash, s_skey);
+  if (err)
+    {
+      log_error ("signing failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    gcry_log_debugsxp ("rslt", *r_sig);
+
+ leave:
+  gcry_sexp_release (s_hash);
+  return err;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and return
  * the signature S-expression.  LOOKUP is an optional function to
  * provide a way for lower layers to ask for the caching TTL.  If a
@@ -493,49 +555,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   else
     {
       /* No smartcard, but a private key (in S_SKEY). */
-
-      /* Put the hash into a sexp */
-      if (algo == GCRY_PK_EDDSA)
-        err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
-                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        err = do_encode_raw_pkcs1 (data, datalen,
-                                   gcry_pk_get_nbits (s_skey),
-                                   &s_hash);
-      else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
-        err = do_encode_dsa (data, datalen,
-                             algo, s_skey,
-                             &s_hash);
-      else if (ctrl->digest.is_pss)
-        {
-          log_info ("signing with rsaPSS is currently only supported"
-                    " for (some) smartcards\n");
-          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
-        }
-      else
-        err = do_encode_md (data, datalen,
-                            ctrl->digest.algo,
-                            &s_hash,
-                            ctrl->digest.raw_value);
+      err = do_sign_with_skey (ctrl, s_skey, algo, data, datalen, &s_sig);
       if (err)
         goto leave;
-
-      if (DBG_CRYPTO)
-        {
-          gcry_log_debugsxp ("skey", s_skey);
-          gcry_log_debugsxp ("hash", s_hash);
-        }
-
-      /* sign */
-      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
-      if (err)
-        {
-          log_error ("signing failed: %s\n", gpg_strerror (err));
-          goto leave;
-        }
-
-      if (DBG_CRYPTO)
-        gcry_log_debugsxp ("rslt", s_sig);
     }
 
   /* Check that the signature verification worked and nothing is
@@ -596,6 +618,26 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* Append the signature S_SIG in canonical format to OUTBUF.  */
+static gpg_error_t
+put_sig_membuf (membuf_t *outbuf, gcry_sexp_t s_sig)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  put_membuf (outbuf, buf, len);
+  xfree (buf);
+  return 0;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and write it
  * back to OUTFP.  If a CACHE_NONCE is given that cache item is first
  * tried to get a passphrase.  */
@@ -605,29 +647,87 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 {
   gpg_error_t err;
   gcry_sexp_t s_sig = NULL;
-  char *buf = NULL;
-  size_t len = 0;
 
   err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig, cache_mode,
                          NULL, NULL, 0);
-  if (err)
-    goto leave;
+  if (!err)
+    err = put_sig_membuf (outbuf, s_sig);
 
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
-  log_assert (len);
-  buf = xtrymalloc (len);
-  if (!buf)
+  gcry_sexp_release (s_sig);
+  return err;
+}
+
+
+/* Sign the NHASHES hashes from the array HASHES with the key selected
+ * in CTRL and append the signatures in canonical format to OUTBUF,
+ * one after the other in the order of HASHES.  In contrast to
+ * calling agent_pksign for each hash, the private key is read and
+ * unprotected only once.  Keys on a smartcard or in a TPM are
+ * diverted for each hash as usual.  On success the digest in CTRL
+ * is set to the last hash.  */
+gpg_error_t
+agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const struct pksign_hash_s *hashes, int nhashes,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  int divert = 0;
+  int algo = 0;
+  int i;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, NULL,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY || (!err && shadow_info))
     {
-      err = gpg_error_from_syserror ();
+      /* The key is (possibly) on a card; let agent_pksign_do handle
+       * that for each hash.  */
+      divert = 1;
+      err = 0;
+    }
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
       goto leave;
     }
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
-  log_assert (len);
-  put_membuf (outbuf, buf, len);
+  else
+    algo = get_pk_algo_from_key (s_skey);
 
- leave:
-  gcry_sexp_release (s_sig);
-  xfree (buf);
+  xfree (ctrl->digest.data);
+  ctrl->digest.data = NULL;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.is_pss = 0;
+
+  for (i=0; i < nhashes; i++)
+    {
+      ctrl->digest.algo = hashes[i].algo;
+      ctrl->digest.valuelen = hashes[i].valuelen;
+      memcpy (ctrl->digest.value, hashes[i].value, hashes[i].valuelen);
 
+      if (divert)
+        err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig,
+                               cache_mode, NULL, NULL, 0);
+      else
+        err = do_sign_with_skey (ctrl, s_skey, algo,
+                                 ctrl->digest.value, ctrl->digest.valuelen,
+                                 &s_sig);
+      if (!err)
+        err = put_sig_membuf (outbuf, s_sig);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
   return err;
 }
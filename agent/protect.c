@@ -50,6 +50,10 @@
 #define PROT_CIPHER_STRING "aes"
 #define PROT_CIPHER_KEYLEN (128/8)
 
+/* The name of the file in the home directory used to store the
+   calibrated S2K count.  */
+#define S2K_CALIBRATION_FILE "s2k-calibration"
+
 
 /* A table containing the information needed to create a protected
    private key.  */
@@ -75,6 +79,10 @@ static const struct {
 static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
+/* If set the calibrated count is read from and stored in the home
+ * directory.  */
+static int s2k_calibration_persistent;
+
 
 /* A helper object for time measurement.  */
 struct calibrate_time_s
@@ -182,10 +190,27 @@ calibrate_s2k_count_one (unsigned long count)
 }
 
 
+/* Return true if the calibration measures the CPU time of the
+ * calling thread.  Only then is the result not skewed by other
+ * threads running while calibrate_s2k_count is called without holding
+ * the nPth lock.  */
+int
+s2k_calibration_uses_thread_time (void)
+{
+#if defined (USE_CLOCK_GETTIME) && !defined (HAVE_W32_SYSTEM)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
 /* Measure the time we need to do the hash operations and deduce an
-   S2K count which requires roughly some targeted amount of time.  */
-static unsigned long
-calibrate_s2k_count (void)
+ * S2K count which requires roughly MILLISECONDS.  This function does
+ * not change any global state and may thus be called without holding
+ * the nPth lock if s2k_calibration_uses_thread_time returns true.  */
+unsigned long
+calibrate_s2k_count (unsigned int milliseconds)
 {
   unsigned long count;
   unsigned long ms;
@@ -195,11 +220,11 @@ calibrate_s2k_count (void)
       ms = calibrate_s2k_count_one (count);
       if (opt.verbose > 1)
         log_info ("S2K calibration: %lu -> %lums\n", count, ms);
-      if (ms > s2k_calibration_time)
+      if (ms > milliseconds)
         break;
     }
 
-  count = (unsigned long)(((double)count / ms) * s2k_calibration_time);
+  count = (unsigned long)(((double)count / ms) * milliseconds);
   count /= 1024;
   count *= 1024;
   if (count < 65536)
@@ -215,6 +240,189 @@ calibrate_s2k_count (void)
 }
 
 
+/* Return a malloced string describing the CPU model.  This is used
+ * to detect whether a stored calibration still applies.  Returns
+ * NULL on memory failure.  */
+static char *
+get_cpu_model (void)
+{
+#ifdef __linux__
+  estream_t fp;
+  char line[256];
+  char *p;
+  char *result = NULL;
+
+  fp = es_fopen ("/proc/cpuinfo", "r");
+  if (fp)
+    {
+      while (!result && es_fgets (line, sizeof line, fp))
+        if (!strncmp (line, "model name", 10) && (p = strchr (line, ':')))
+          result = xtrystrdup (trim_spaces (p+1));
+      es_fclose (fp);
+      if (result)
+        return result;
+    }
+#endif /*__linux__*/
+  return xtrystrdup ("unknown");
+}
+
+
+/* Read the S2K count calibrated for MILLISECONDS from the home
+ * directory.  Returns 0 if no count has been stored for this CPU,
+ * this Libgcrypt version, and this calibration time.  */
+static unsigned long
+read_s2k_calibration (unsigned int milliseconds)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  nvc_t nvc = NULL;
+  char *cpu = NULL;
+  const char *s;
+  unsigned long count = 0;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (!fname)
+    return 0;
+
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
+        log_info ("can't open '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+  err = nvc_parse (&nvc, NULL, fp);
+  es_fclose (fp);
+  if (err)
+    {
+      log_info ("error parsing '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+
+  cpu = get_cpu_model ();
+  if (!cpu
+      || !(s = nvc_get_string (nvc, "Cpu:")) || strcmp (s, cpu)
+      || !(s = nvc_get_string (nvc, "Libgcrypt:"))
+      || strcmp (s, gcry_check_version (NULL))
+      || !(s = nvc_get_string (nvc, "Time:"))
+      || strtoul (s, NULL, 10) != milliseconds
+      || !(s = nvc_get_string (nvc, "Count:")))
+    goto leave;
+
+  count = strtoul (s, NULL, 10);
+  if (count < 65536)
+    count = 0;
+  else if (opt.verbose)
+    log_info ("S2K calibration: using stored count %lu\n", count);
+
+ leave:
+  xfree (cpu);
+  nvc_release (nvc);
+  xfree (fname);
+  return count;
+}
+
+
+/* Store COUNT as the S2K count calibrated for MILLISECONDS in the
+ * home directory.  Errors are logged but otherwise ignored.  */
+static void
+write_s2k_calibration (unsigned int milliseconds, unsigned long count)
+{
+  gpg_error_t err;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  char *cpu = NULL;
+  nvc_t nvc = NULL;
+  estream_t fp;
+  char numbuf[35];
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (fname)
+    tmpfname = strconcat (fname, ".tmp", NULL);
+  if (tmpfname)
+    cpu = get_cpu_model ();
+  if (cpu)
+    nvc = nvc_new ();
+  if (!nvc)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = nvc_set (nvc, "Cpu:", cpu);
+  if (!err)
+    err = nvc_set (nvc, "Libgcrypt:", gcry_check_version (NULL));
+  if (!err)
+    {
+      snprintf (numbuf, sizeof numbuf, "%u", milliseconds);
+      err = nvc_set (nvc, "Time:", numbuf);
+    }
+  if (!err)
+    {
+      snprintf (numbuf, sizeof numbuf, "%lu", count);
+      err = nvc_set (nvc, "Count:", numbuf);
+    }
+  if (err)
+    goto leave;
+
+  fp = es_fopen (tmpfname, "w,mode=-rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = nvc_write (nvc, fp);
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  if (err)
+    log_info ("error storing the S2K calibration: %s\n", gpg_strerror (err));
+  nvc_release (nvc);
+  xfree (cpu);
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Enable or disable the use of the home directory to store the
+ * calibrated S2K count.  This avoids the calibration on the first
+ * use of the S2K function after a restart.  */
+void
+set_s2k_calibration_persistent (int yes)
+{
+  s2k_calibration_persistent = yes;
+}
+
+
+/* Return the current calibration time in milliseconds.  */
+unsigned int
+get_s2k_calibration_time (void)
+{
+  return s2k_calibration_time;
+}
+
+
+/* Set the S2K count as calibrated for MILLISECONDS to COUNT.  The
+ * value is ignored if the calibration time has been changed in the
+ * meantime.  */
+void
+set_s2k_calibrated_count (unsigned int milliseconds, unsigned long count)
+{
+  if (milliseconds != s2k_calibration_time)
+    return;
+  s2k_calibrated_count = count;
+  if (s2k_calibration_persistent)
+    write_s2k_calibration (milliseconds, count);
+}
+
+
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
 void
@@ -234,8 +442,11 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
+  if (!s2k_calibrated_count && s2k_calibration_persistent)
+    s2k_calibrated_count = read_s2k_calibration (s2k_calibration_time);
   if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+    set_s2k_calibrated_count (s2k_calibration_time,
+                              calibrate_s2k_count (s2k_calibration_time));
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
@@ -0,0 +1,247 @@
+/* t-pkdecrypt.c - Module tests for pkdecrypt.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "agent.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+
+/* The results returned by the divert_pkdecrypt stub; one item per
+ * call.  */
+static struct
+{
+  const char *plain;
+  int padding;
+  gpg_err_code_t ec;
+} card_results[] =
+  {
+    { "\x01\x02\x03", -1 },
+    { "hello", 1 },
+    { NULL, -1, GPG_ERR_BAD_PIN },
+    { "xyz", 0 }
+  };
+static int card_calls;
+
+#define CIPHERTEXT "(7:enc-val(3:rsa(1:a3:foo)))"
+
+
+/* Run agent_pkdecrypt_multi with a key diverted to a card and check
+ * that the output is a sequence of canonical S-expressions without
+ * any extra bytes.  */
+static void
+test_agent_pkdecrypt_multi_divert (void)
+{
+  struct server_control_s ctrl;
+  membuf_t ciphertexts, outbuf, expected;
+  char *cbuf, *buf, *ebuf;
+  size_t clen, len, elen, off, n;
+  char numbuf[35];
+  int i, nitems;
+
+  memset (&ctrl, 0, sizeof ctrl);
+  ctrl.have_keygrip = 1;
+
+  init_membuf (&ciphertexts, 256);
+  for (i=0; i < DIM (card_results); i++)
+    put_membuf_str (&ciphertexts, CIPHERTEXT);
+  cbuf = get_membuf (&ciphertexts, &clen);
+  if (!cbuf)
+    fail ();
+
+  card_calls = 0;
+  init_membuf (&outbuf, 256);
+  if (agent_pkdecrypt_multi (&ctrl, NULL, (unsigned char *)cbuf, clen,
+                             &outbuf))
+    fail ();
+  buf = get_membuf (&outbuf, &len);
+  if (!buf)
+    fail ();
+  if (card_calls != DIM (card_results))
+    fail ();
+
+  /* Split the stream the same way gpg does.  */
+  nitems = 0;
+  for (off=0; off < len; off += n)
+    {
+      n = gcry_sexp_canon_len ((unsigned char *)buf + off, len - off,
+                               NULL, NULL);
+      if (!n)
+        fail ();
+      if (n < 10 || memcmp (buf + off, "(7:padding", 10))
+        nitems++;
+    }
+  if (off != len || nitems != DIM (card_results))
+    fail ();
+
+  init_membuf (&expected, 256);
+  put_membuf_str (&expected, "(5:value3:\x01\x02\x03)");
+  put_membuf_str (&expected, "(7:padding1:1)(5:value5:hello)");
+  snprintf (numbuf, sizeof numbuf, "%u",
+            (unsigned int)gpg_error (GPG_ERR_BAD_PIN));
+  put_membuf_printf (&expected, "(5:error%u:%s)",
+                     (unsigned int)strlen (numbuf), numbuf);
+  put_membuf_str (&expected, "(7:padding1:0)(5:value3:xyz)");
+  ebuf = get_membuf (&expected, &elen);
+  if (!ebuf)
+    fail ();
+  if (len != elen || memcmp (buf, ebuf, len))
+    fail ();
+
+  xfree (ebuf);
+  xfree (buf);
+  xfree (cbuf);
+}
+
+
+/* The single item PKDECRYPT still appends a Nul after the value.  */
+static void
+test_agent_pkdecrypt_divert (void)
+{
+  struct server_control_s ctrl;
+  membuf_t outbuf;
+  char *buf;
+  size_t len;
+  int padding;
+  static const char expected[] = "(5:value3:\x01\x02\x03)";
+
+  memset (&ctrl, 0, sizeof ctrl);
+  ctrl.have_keygrip = 1;
+
+  card_calls = 0;
+  init_membuf (&outbuf, 256);
+  if (agent_pkdecrypt (&ctrl, NULL, (const unsigned char *)CIPHERTEXT,
+                       strlen (CIPHERTEXT), &outbuf, &padding))
+    fail ();
+  buf = get_membuf (&outbuf, &len);
+  if (!buf)
+    fail ();
+  if (padding != -1)
+    fail ();
+  if (len != sizeof expected || memcmp (buf, expected, sizeof expected))
+    fail ();
+  xfree (buf);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argv;
+
+  opt.verbose = argc - 1;       /* We can do "./t-pkdecrypt -v -v" */
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+
+  test_agent_pkdecrypt_multi_divert ();
+  test_agent_pkdecrypt_divert ();
+
+  return 0;
+}
+
+
+/* Stub functions.  */
+
+/* Return a shadowed key without an S-expression so that all
+ * decryptions are diverted to the card.  */
+gpg_error_t
+agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
+                     const char *desc_text,
+                     const unsigned char *grip,
+                     unsigned char **shadow_info,
+                     cache_mode_t cache_mode,
+                     lookup_ttl_t lookup_ttl,
+                     gcry_sexp_t *result,
+                     char **r_passphrase, time_t *r_timestamp)
+{
+  (void)ctrl;
+  (void)cache_nonce;
+  (void)desc_text;
+  (void)grip;
+  (void)cache_mode;
+  (void)lookup_ttl;
+  (void)r_passphrase;
+  (void)r_timestamp;
+
+  *result = NULL;
+  *shadow_info = (unsigned char *)xstrdup ("(8:serialno4:D276)");
+  return 0;
+}
+
+
+int
+agent_is_tpm2_key (gcry_sexp_t s_key)
+{
+  (void)s_key;
+  return 0;
+}
+
+
+int
+divert_pkdecrypt (ctrl_t ctrl,
+                  const unsigned char *grip,
+                  const unsigned char *cipher,
+                  char **r_buf, size_t *r_len, int *r_padding)
+{
+  int i = card_calls++;
+
+  (void)ctrl;
+  (void)grip;
+
+  if (i >= DIM (card_results))
+    fail ();
+  if (!gcry_sexp_canon_len (cipher, 0, NULL, NULL))
+    fail ();
+  if (card_results[i].ec)
+    return gpg_error (card_results[i].ec);
+  *r_len = strlen (card_results[i].plain);
+  *r_buf = xmalloc (*r_len);
+  memcpy (*r_buf, card_results[i].plain, *r_len);
+  *r_padding = card_results[i].padding;
+  return 0;
+}
+
+
+#ifdef HAVE_LIBTSS
+int
+divert_tpm2_pkdecrypt (ctrl_t ctrl,
+                       const unsigned char *cipher,
+                       const unsigned char *shadow_info,
+                       char **r_buf, size_t *r_len, int *r_padding)
+{
+  (void)ctrl;
+  (void)cipher;
+  (void)shadow_info;
+  (void)r_buf;
+  (void)r_len;
+  (void)r_padding;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+#endif /*HAVE_LIBTSS*/
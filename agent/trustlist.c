@@ -51,11 +51,25 @@ struct trustitem_s
 };
 typedef struct trustitem_s trustitem_t;
 
-/* Malloced table and its allocated size with all trust items. */
-static trustitem_t *trusttable;
-static size_t trusttablesize;
-/* A mutex used to protect the table. */
-static npth_mutex_t trusttable_lock;
+/* A table with all trust items and a hash index over their
+ * fingerprints.  */
+struct trusttable_s
+{
+  trustitem_t *items;     /* Array with all trust items.  */
+  size_t nitems;          /* Number of items in ITEMS.  */
+  unsigned int *index;    /* Open addressing hash table with the index
+                           * into ITEMS plus one; 0 marks a free slot. */
+  unsigned int indexsize; /* Number of slots in INDEX (a power of 2).  */
+};
+typedef struct trusttable_s *trusttable_t;
+
+/* The current table or NULL if it needs to be read.  A new table is
+ * built without holding a lock and then swapped in.  */
+static trusttable_t trusttable;
+/* A read-write lock used to protect the table. */
+static npth_rwlock_t trusttable_lock;
+/* A mutex to serialize reading and updating the trust files.  */
+static npth_mutex_t trustfile_lock;
 
 
 static const char headerblurb[] =
@@ -86,7 +100,11 @@ initialize_module_trustlist (void)
 
   if (!initialized)
     {
-      err = npth_mutex_init (&trusttable_lock, NULL);
+      err = npth_rwlock_init (&trusttable_lock, NULL);
+      if (err)
+        log_fatal ("failed to init rwlock in %s: %s\n",
+                   __FILE__, strerror (err));
+      err = npth_mutex_init (&trustfile_lock, NULL);
       if (err)
         log_fatal ("failed to init mutex in %s: %s\n", __FILE__,strerror (err));
       initialized = 1;
@@ -97,13 +115,26 @@ initialize_module_trustlist (void)
 
 
 static void
-lock_trusttable (void)
+lock_trusttable_read (void)
 {
   int err;
 
-  err = npth_mutex_lock (&trusttable_lock);
+  err = npth_rwlock_rdlock (&trusttable_lock);
   if (err)
-    log_fatal ("failed to acquire mutex in %s: %s\n", __FILE__, strerror (err));
+    log_fatal ("failed to acquire rwlock in %s: %s\n",
+               __FILE__, strerror (err));
+}
+
+
+static void
+lock_trusttable_write (void)
+{
+  int err;
+
+  err = npth_rwlock_wrlock (&trusttable_lock);
+  if (err)
+    log_fatal ("failed to acquire rwlock in %s: %s\n",
+               __FILE__, strerror (err));
 }
 
 
@@ -112,20 +143,120 @@ unlock_trusttable (void)
 {
   int err;
 
-  err = npth_mutex_unlock (&trusttable_lock);
+  err = npth_rwlock_unlock (&trusttable_lock);
+  if (err)
+    log_fatal ("failed to release rwlock in %s: %s\n",
+               __FILE__, strerror (err));
+}
+
+
+static void
+lock_trustfile (void)
+{
+  int err;
+
+  err = npth_mutex_lock (&trustfile_lock);
+  if (err)
+    log_fatal ("failed to acquire mutex in %s: %s\n", __FILE__, strerror (err));
+}
+
+
+static void
+unlock_trustfile (void)
+{
+  int err;
+
+  err = npth_mutex_unlock (&trustfile_lock);
   if (err)
     log_fatal ("failed to release mutex in %s: %s\n", __FILE__, strerror (err));
 }
 
 
-/* Clear the trusttable.  The caller needs to make sure that the
-   trusttable is locked.  */
-static inline void
-clear_trusttable (void)
+static void
+release_trusttable (trusttable_t table)
 {
-  xfree (trusttable);
-  trusttable = NULL;
-  trusttablesize = 0;
+  if (!table)
+    return;
+  xfree (table->items);
+  xfree (table->index);
+  xfree (table);
+}
+
+
+/* Return the start slot for the fingerprint FPR in an index of size
+ * INDEXSIZE.  The fingerprint is a hash value and thus we can
+ * directly use its first bytes.  */
+static inline unsigned int
+trustindex_slot (const unsigned char *fpr, unsigned int indexsize)
+{
+  return (((unsigned int)fpr[0] << 24 | fpr[1] << 16 | fpr[2] << 8 | fpr[3])
+          & (indexsize - 1));
+}
+
+
+/* Build the hash index for TABLE.  If a fingerprint is listed more
+ * than once, the first item is used as done by a linear search.  */
+static gpg_error_t
+build_trustindex (trusttable_t table)
+{
+  unsigned int size, slot;
+  size_t idx;
+
+  for (size = 16; size < 2 * table->nitems; size <<= 1)
+    ;
+  table->index = xtrycalloc (size, sizeof *table->index);
+  if (!table->index)
+    return gpg_error_from_syserror ();
+  table->indexsize = size;
+
+  for (idx = 0; idx < table->nitems; idx++)
+    {
+      for (slot = trustindex_slot (table->items[idx].fpr, size);
+           table->index[slot];
+           slot = (slot + 1) & (size - 1))
+        if (!memcmp (table->items[table->index[slot]-1].fpr,
+                     table->items[idx].fpr, 20))
+          break;
+      if (!table->index[slot])
+        table->index[slot] = idx + 1;
+    }
+
+  return 0;
+}
+
+
+/* Return the item for the fingerprint FPR from TABLE or NULL.  */
+static trustitem_t *
+lookup_trustitem (trusttable_t table, const unsigned char *fpr)
+{
+  unsigned int slot;
+  trustitem_t *ti;
+
+  for (slot = trustindex_slot (fpr, table->indexsize);
+       table->index[slot];
+       slot = (slot + 1) & (table->indexsize - 1))
+    {
+      ti = table->items + table->index[slot] - 1;
+      if (!memcmp (ti->fpr, fpr, 20))
+        return ti;
+    }
+  return NULL;
+}
+
+
+/* Replace the current trusttable by TABLE which may be NULL to force
+ * a re-read at the next access.  Readers are only blocked for the
+ * swap itself.  */
+static void
+install_trusttable (trusttable_t table)
+{
+  trusttable_t old;
+
+  lock_trusttable_write ();
+  old = trusttable;
+  trusttable = table;
+  unlock_trusttable ();
+  release_trusttable (old);
 }
 
 
@@ -350,10 +481,10 @@ read_one_trustfile (const char *fname, int systrust,
 }
 
 
-/* Read the trust files and update the global table on success.  The
-   trusttable is assumed to be locked. */
+/* Read the trust files and return a new table at R_TABLE.  A missing
+   trustlist is taken as an empty one.  */
 static gpg_error_t
-read_trustfiles (void)
+read_trustfiles (trusttable_t *r_table)
 {
   gpg_error_t err;
   trustitem_t *table, *ti;
@@ -362,6 +493,9 @@ read_trustfiles (void)
   char *fname;
   int systrust = 0;
   gpg_err_code_t ec;
+  trusttable_t newtable;
+
+  *r_table = NULL;
 
   tablesize = 20;
   table = xtrycalloc (tablesize, sizeof *table);
@@ -402,17 +536,16 @@ read_trustfiles (void)
 
   if (err)
     {
-      xfree (table);
-      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
         {
-          /* Take a missing trustlist as an empty one.  */
-          clear_trusttable ();
-          err = 0;
+          xfree (table);
+          return err;
         }
-      return err;
+      /* Take a missing trustlist as an empty one.  */
+      tableidx = 0;
+      err = 0;
     }
 
-  /* Fixme: we should drop duplicates and sort the table. */
   ti = xtryrealloc (table, (tableidx?tableidx:1) * sizeof *table);
   if (!ti)
     {
@@ -421,90 +554,127 @@ read_trustfiles (void)
       return err;
     }
 
-  /* Replace the trusttable.  */
-  xfree (trusttable);
-  trusttable = ti;
-  trusttablesize = tableidx;
+  newtable = xtrycalloc (1, sizeof *newtable);
+  if (!newtable)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (ti);
+      return err;
+    }
+  newtable->items = ti;
+  newtable->nitems = tableidx;
+  err = build_trustindex (newtable);
+  if (err)
+    {
+      release_trusttable (newtable);
+      return err;
+    }
+
+  *r_table = newtable;
   return 0;
 }
 
 
+/* Read the trust files again and install the new table.  On error
+   the table is cleared so that the next access tries again.  The
+   caller must hold the trustfile lock.  */
+static gpg_error_t
+reload_trusttable (void)
+{
+  gpg_error_t err;
+  trusttable_t table;
+
+  err = read_trustfiles (&table);
+  if (err)
+    log_error (_("error reading list of trusted root certificates\n"));
+  install_trusttable (table);
+  return err;
+}
+
+
+/* Take a read lock on the trusttable and make sure that it has been
+   read.  If HAVE_FILELOCK is true the caller already holds the
+   trustfile lock.  On success the caller must release the lock using
+   unlock_trusttable.  */
+static gpg_error_t
+lock_loaded_trusttable (int have_filelock)
+{
+  gpg_error_t err;
+
+  for (;;)
+    {
+      lock_trusttable_read ();
+      if (trusttable)
+        return 0;
+      unlock_trusttable ();
+
+      if (!have_filelock)
+        lock_trustfile ();
+      err = trusttable? 0 : reload_trusttable ();
+      if (!have_filelock)
+        unlock_trustfile ();
+      if (err)
+        return err;
+    }
+}
+
+
 /* Check whether the given fpr is in our trustdb.  We expect FPR to be
    an all uppercase hexstring of 40 characters.  If ALREADY_LOCKED is
-   true the function assumes that the trusttable is already locked. */
+   true the function assumes that the trustfile lock is already held
+   and no status lines are emitted.  */
 static gpg_error_t
 istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
                     int already_locked)
 {
   gpg_error_t err = 0;
-  int locked = already_locked;
   trustitem_t *ti;
-  size_t len;
   unsigned char fprbin[20];
+  int found, disabled, relax, cm, qual, de_vs;
 
   if (r_disabled)
     *r_disabled = 0;
 
   if ( hexcolon2bin (fpr, fprbin, 20) < 0 )
-    {
-      err = gpg_error (GPG_ERR_INV_VALUE);
-      goto leave;
-    }
+    return gpg_error (GPG_ERR_INV_VALUE);
 
-  if (!already_locked)
-    {
-      lock_trusttable ();
-      locked = 1;
-    }
+  err = lock_loaded_trusttable (already_locked);
+  if (err)
+    return err;
+
+  /* Copy the flags so that we can release the lock before writing
+   * the status lines.  */
+  ti = lookup_trustitem (trusttable, fprbin);
+  found = !!ti;
+  disabled = found && ti->flags.disabled;
+  relax = found && ti->flags.relax;
+  cm = found && ti->flags.cm;
+  qual = found && ti->flags.qual;
+  de_vs = found && ti->flags.de_vs;
+  unlock_trusttable ();
 
-  if (!trusttable)
-    {
-      err = read_trustfiles ();
-      if (err)
-        {
-          log_error (_("error reading list of trusted root certificates\n"));
-          goto leave;
-        }
-    }
+  if (!found)
+    return gpg_error (GPG_ERR_NOT_TRUSTED);
 
-  if (trusttable)
+  if (disabled && r_disabled)
+    *r_disabled = 1;
+
+  /* Print status messages only if we have not been called in a
+     locked state.  */
+  if (!already_locked)
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        if (!memcmp (ti->fpr, fprbin, 20))
-          {
-            if (ti->flags.disabled && r_disabled)
-              *r_disabled = 1;
-
-            /* Print status messages only if we have not been called
-               in a locked state.  */
-            if (already_locked)
-              ;
-            else if (ti->flags.relax || ti->flags.cm || ti->flags.qual
-                     || ti->flags.de_vs)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = 0;
-                if (ti->flags.relax)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "relax",NULL);
-                if (!err && ti->flags.cm)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "cm", NULL);
-                if (!err && ti->flags.qual)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "qual",NULL);
-                if (!err && ti->flags.de_vs)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "de-vs",NULL);
-              }
-
-            if (!err)
-              err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
-            goto leave;
-          }
+      if (relax)
+        err = agent_write_status (ctrl, "TRUSTLISTFLAG", "relax", NULL);
+      if (!err && cm)
+        err = agent_write_status (ctrl, "TRUSTLISTFLAG", "cm", NULL);
+      if (!err && qual)
+        err = agent_write_status (ctrl, "TRUSTLISTFLAG", "qual", NULL);
+      if (!err && de_vs)
+        err = agent_write_status (ctrl, "TRUSTLISTFLAG", "de-vs", NULL);
     }
-  err = gpg_error (GPG_ERR_NOT_TRUSTED);
 
- leave:
-  if (locked && !already_locked)
-    unlock_trusttable ();
+  if (!err)
+    err = disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
   return err;
 }
 
@@ -527,32 +697,21 @@ agent_listtrusted (void *assuan_context)
   gpg_error_t err;
   size_t len;
 
-  lock_trusttable ();
-  if (!trusttable)
-    {
-      err = read_trustfiles ();
-      if (err)
-        {
-          unlock_trusttable ();
-          log_error (_("error reading list of trusted root certificates\n"));
-          return err;
-        }
-    }
+  err = lock_loaded_trusttable (0);
+  if (err)
+    return err;
 
-  if (trusttable)
+  for (ti=trusttable->items, len = trusttable->nitems; len; ti++, len--)
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        {
-          if (ti->flags.disabled)
-            continue;
-          bin2hex (ti->fpr, 20, key);
-          key[40] = ' ';
-          key[41] = ((ti->flags.for_smime && ti->flags.for_pgp)? '*'
-                     : ti->flags.for_smime? 'S': ti->flags.for_pgp? 'P':' ');
-          key[42] = '\n';
-          assuan_send_data (assuan_context, key, 43);
-          assuan_send_data (assuan_context, NULL, 0); /* flush */
-        }
+      if (ti->flags.disabled)
+        continue;
+      bin2hex (ti->fpr, 20, key);
+      key[40] = ' ';
+      key[41] = ((ti->flags.for_smime && ti->flags.for_pgp)? '*'
+                 : ti->flags.for_smime? 'S': ti->flags.for_pgp? 'P':' ');
+      key[42] = '\n';
+      assuan_send_data (assuan_context, key, 43);
+      assuan_send_data (assuan_context, NULL, 0); /* flush */
     }
 
   unlock_trusttable ();
@@ -768,11 +927,11 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
 
   /* Now check again to avoid duplicates.  We take the lock to make
      sure that nobody else plays with our file and force a reread.  */
-  lock_trusttable ();
-  clear_trusttable ();
+  lock_trustfile ();
+  reload_trusttable ();
   if (!istrusted_internal (ctrl, fpr, &is_disabled, 1) || is_disabled)
     {
-      unlock_trusttable ();
+      unlock_trustfile ();
       xfree (fprformatted);
       xfree (nameformatted);
       return is_disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
@@ -782,7 +941,7 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
   if (!fname)
     {
       err = gpg_error_from_syserror ();
-      unlock_trusttable ();
+      unlock_trustfile ();
       xfree (fprformatted);
       xfree (nameformatted);
       return err;
@@ -795,7 +954,7 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
           err = gpg_error (ec);
           log_error ("can't create '%s': %s\n", fname, gpg_strerror (err));
           xfree (fname);
-          unlock_trusttable ();
+          unlock_trustfile ();
           xfree (fprformatted);
           xfree (nameformatted);
           return err;
@@ -809,7 +968,7 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
       err = gpg_error_from_syserror ();
       log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
       xfree (fname);
-      unlock_trusttable ();
+      unlock_trustfile ();
       xfree (fprformatted);
       xfree (nameformatted);
       return err;
@@ -835,9 +994,9 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
   if (es_fclose (fp))
     err = gpg_error_from_syserror ();
 
-  clear_trusttable ();
+  reload_trusttable ();
   xfree (fname);
-  unlock_trusttable ();
+  unlock_trustfile ();
   xfree (fprformatted);
   xfree (nameformatted);
   if (!err)
@@ -851,10 +1010,12 @@ agent_marktrusted (ctrl_t ctrl, const char *name, const char *fpr, int flag)
 void
 agent_reload_trustlist (void)
 {
-  /* All we need to do is to delete the trusttable.  At the next
-     access it will get re-read. */
-  lock_trusttable ();
-  clear_trusttable ();
-  unlock_trusttable ();
+  /* If the table has already been read, we read it again right away
+     and swap it in so that readers are not blocked; otherwise it
+     will be read at the next access.  */
+  lock_trustfile ();
+  if (trusttable)
+    reload_trusttable ();
+  unlock_trustfile ();
   bump_key_eventcounter ();
 }
@@ -0,0 +1,228 @@
+/* cmdstats.c - Per command statistics for Assuan servers
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This module keeps a count and a latency histogram for each Assuan
+ * command of a server.  The servers call cmdstats_start from their
+ * pre command hook and cmdstats_record from their post command hook.
+ * The error passed to the post command hook is the one from writing
+ * the response and thus the servers use cmdstats_err_line_p in their
+ * I/O monitor to detect failed commands.  All our servers use nPth
+ * and the functions here do not yield; thus no locking is
+ * required.  */
+
+#include <config.h>
+
+#include <assuan.h>
+#include <npth.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "membuf.h"
+#include "cmdstats.h"
+
+
+/* The number of histogram buckets.  Bucket N holds durations in the
+ * range [2^N, 2^(N+1)) microseconds; bucket 0 also holds durations
+ * below one microsecond.  The last bucket takes all longer ones.  */
+#define CMDSTATS_BUCKETS 36
+
+/* The number of slots in the hash table of commands.  */
+#define CMDSTATS_TABLESIZE 64
+
+
+/* The statistics for one command.  */
+struct cmdstats_item_s
+{
+  struct cmdstats_item_s *next;
+  unsigned long count;        /* Number of calls.  */
+  unsigned long errors;       /* Number of calls returning an error.  */
+  unsigned long long maxtime; /* Longest duration in microseconds.  */
+  unsigned long hist[CMDSTATS_BUCKETS];
+  char name[1];
+};
+typedef struct cmdstats_item_s *cmdstats_item_t;
+
+static cmdstats_item_t cmdstats_table[CMDSTATS_TABLESIZE];
+
+
+
+static unsigned int
+hash_name (const char *name)
+{
+  const unsigned char *s = (const unsigned char *)name;
+  unsigned int hash = 5381;
+
+  for (; *s; s++)
+    hash = ((hash << 5) + hash) + *s;
+  return hash % CMDSTATS_TABLESIZE;
+}
+
+
+/* Return the item for NAME; create it if needed.  Returns NULL on
+ * memory failure.  */
+static cmdstats_item_t
+get_item (const char *name)
+{
+  cmdstats_item_t item;
+  unsigned int hash = hash_name (name);
+
+  for (item = cmdstats_table[hash]; item; item = item->next)
+    if (!strcmp (item->name, name))
+      return item;
+
+  item = xtrycalloc (1, sizeof *item + strlen (name));
+  if (!item)
+    return NULL;
+  strcpy (item->name, name);
+  item->next = cmdstats_table[hash];
+  cmdstats_table[hash] = item;
+  return item;
+}
+
+
+void
+cmdstats_start (struct timespec *r_start)
+{
+  npth_clock_gettime (r_start);
+}
+
+
+void
+cmdstats_record (const char *name, const struct timespec *start,
+                 int failed)
+{
+  cmdstats_item_t item;
+  struct timespec now;
+  unsigned long long usec;
+  int bucket;
+
+  if (!name || !*name || !start->tv_sec)
+    return;
+
+  npth_clock_gettime (&now);
+  if (now.tv_sec < start->tv_sec
+      || (now.tv_sec == start->tv_sec && now.tv_nsec < start->tv_nsec))
+    usec = 0;  /* The clock has been set back.  */
+  else
+    usec = ((unsigned long long)(now.tv_sec - start->tv_sec) * 1000000
+            + (now.tv_nsec - start->tv_nsec) / 1000);
+
+  item = get_item (name);
+  if (!item)
+    return;
+
+  item->count++;
+  if (failed)
+    item->errors++;
+  if (usec > item->maxtime)
+    item->maxtime = usec;
+  for (bucket = 0; bucket < CMDSTATS_BUCKETS - 1 && (usec >> (bucket+1));
+       bucket++)
+    ;
+  item->hist[bucket]++;
+}
+
+
+int
+cmdstats_err_line_p (int direction, const char *line, size_t linelen)
+{
+  return (direction == ASSUAN_IO_TO_PEER
+          && linelen >= 3 && !memcmp (line, "ERR", 3)
+          && (linelen == 3 || line[3] == ' '));
+}
+
+
+/* Return an estimation for the percentile PCT of ITEM.  We take the
+ * upper bound of the bucket but not more than the maximum.  */
+static unsigned long long
+percentile (cmdstats_item_t item, unsigned int pct)
+{
+  unsigned long long want, sum;
+  unsigned long long value;
+  int bucket;
+
+  if (!item->count)
+    return 0;
+
+  want = ((unsigned long long)item->count * pct + 99) / 100;
+  for (sum = 0, bucket = 0; bucket < CMDSTATS_BUCKETS - 1; bucket++)
+    {
+      sum += item->hist[bucket];
+      if (sum >= want)
+        break;
+    }
+
+  value = (2ULL << bucket) - 1;
+  return value > item->maxtime? item->maxtime : value;
+}
+
+
+/* Send one data line per command.  The line consists of the command
+ * name, the number of calls, the number of calls returning an error,
+ * the estimated median, the estimated 99th percentile and the
+ * maximum of the duration; all durations are given in microseconds.
+ * The lines are first collected because sending may switch threads
+ * and another thread may then reset the table.  */
+gpg_error_t
+cmdstats_send (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  cmdstats_item_t item;
+  membuf_t mb;
+  char *buffer;
+  size_t buflen;
+  int i;
+
+  init_membuf (&mb, 1024);
+  for (i=0; i < CMDSTATS_TABLESIZE; i++)
+    for (item = cmdstats_table[i]; item; item = item->next)
+      put_membuf_printf (&mb, "%s %lu %lu %llu %llu %llu\n",
+                         item->name, item->count, item->errors,
+                         percentile (item, 50), percentile (item, 99),
+                         item->maxtime);
+  buffer = get_membuf (&mb, &buflen);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  err = assuan_send_data (ctx, buffer, buflen);
+  xfree (buffer);
+  return err;
+}
+
+
+void
+cmdstats_reset (void)
+{
+  cmdstats_item_t item, next;
+  int i;
+
+  for (i=0; i < CMDSTATS_TABLESIZE; i++)
+    {
+      for (item = cmdstats_table[i]; item; item = next)
+        {
+          next = item->next;
+          xfree (item);
+        }
+      cmdstats_table[i] = NULL;
+    }
+}
@@ -0,0 +1,46 @@
+/* cmdstats.h - Definitions for per command statistics
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_CMDSTATS_H
+#define GNUPG_COMMON_CMDSTATS_H
+
+#include <time.h>
+#include <gpg-error.h>
+#include <assuan.h>
+
+/* Store the start time of a command at R_START.  */
+void cmdstats_start (struct timespec *r_start);
+
+/* Account for the command NAME started at START.  FAILED is true if
+ * the command returned an error.  */
+void cmdstats_record (const char *name, const struct timespec *start,
+                      int failed);
+
+/* Return true if LINE is an ERR response sent to the peer.  */
+int cmdstats_err_line_p (int direction, const char *line, size_t linelen);
+
+/* Send the statistics as data lines to the Assuan context CTX.  */
+gpg_error_t cmdstats_send (assuan_context_t ctx);
+
+/* Clear all statistics.  */
+void cmdstats_reset (void);
+
+
+#endif /*GNUPG_COMMON_CMDSTATS_H*/
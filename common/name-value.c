@@ -142,6 +142,59 @@ nvc_release (nvc_t pk)
   xfree (pk);
 }
 
+
+/* Return a deep copy of the container PK including comments and the
+ * raw values so that writing the copy yields the same output.
+ * Returns NULL and sets ERRNO on error.  */
+nvc_t
+nvc_clone (nvc_t pk)
+{
+  nvc_t clone;
+  nve_t e, ce;
+  strlist_t sl, csl, *tail;
+
+  clone = nvc_new ();
+  if (!clone)
+    return NULL;
+  clone->private_key_mode = pk->private_key_mode;
+
+  for (e = pk->first; e; e = e->next)
+    {
+      ce = xtrycalloc (1, sizeof *ce);
+      if (!ce)
+        goto fail;
+      ce->prev = clone->last;
+      if (clone->last)
+        clone->last->next = ce;
+      else
+        clone->first = ce;
+      clone->last = ce;
+
+      if (e->name && !(ce->name = xtrystrdup (e->name)))
+        goto fail;
+      if (e->value && !(ce->value = xtrystrdup (e->value)))
+        goto fail;
+      tail = &ce->raw_value;
+      for (sl = e->raw_value; sl; sl = sl->next)
+        {
+          csl = xtrymalloc (sizeof *csl + strlen (sl->d));
+          if (!csl)
+            goto fail;
+          csl->next = NULL;
+          csl->flags = sl->flags;
+          strcpy (csl->d, sl->d);
+          *tail = csl;
+          tail = &csl->next;
+        }
+    }
+
+  return clone;
+
+ fail:
+  nvc_release (clone);
+  return NULL;
+}
+
 
 
 /* Dealing with names and values.  */
@@ -50,6 +50,9 @@ nvc_t nvc_new_private_key (void);
 /* Release a name value container structure.  */
 void nvc_release (nvc_t pk);
 
+/* Return a deep copy of a name value container structure.  */
+nvc_t nvc_clone (nvc_t pk);
+
 /* Get the name.  */
 char *nve_name (nve_t pke);
 
@@ -246,7 +246,7 @@ void
 run_tests (void)
 {
   gpg_error_t err;
-  nvc_t pk;
+  nvc_t pk, clone;
 
   int i;
   for (i = 0; i < DIM (tests); i++)
@@ -275,6 +275,14 @@ run_tests (void)
 
       buf = nvc_to_string (pk);
       assert (memcmp (tests[i].value, buf, len) == 0);
+      xfree (buf);
+
+      /* A clone must give the same output.  */
+      clone = nvc_clone (pk);
+      assert (clone);
+      buf = nvc_to_string (clone);
+      assert (memcmp (tests[i].value, buf, len) == 0);
+      nvc_release (clone);
 
       es_fclose (source);
       xfree (buf);
@@ -64,6 +64,7 @@
 #include "../common/mbox-util.h"
 #include "../common/zb32.h"
 #include "../common/server-help.h"
+#include "../common/cmdstats.h"
 
 /* To avoid DoS attacks we limit the size of a certificate to
    something reasonable.  The DoS was actually only an issue back when
@@ -120,6 +121,12 @@ struct server_local_s
   size_t inhibit_data_logging_count;
   unsigned int inhibit_data_logging : 1;
   unsigned int inhibit_data_logging_now : 1;
+
+  /* Set if an ERR line has been sent for the current command.  */
+  unsigned int cmd_failed : 1;
+
+  /* The start time of the current command for the statistics.  */
+  struct timespec cmd_start;
 };
 
 
@@ -2847,7 +2854,8 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket\n"
   "session_id  - Return the current session_id\n"
   "workqueue   - Inspect the work queue\n"
-  "stats       - Print stats\n"
+  "stats       - Print stats and per command statistics\n"
+  "stats --reset - Print stats and reset the command statistics\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -2916,11 +2924,13 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       workqueue_dump_queue (ctrl);
       err = 0;
     }
-  else if (!strcmp (line, "stats"))
+  else if (!strcmp (line, "stats") || !strcmp (line, "stats --reset"))
     {
       cert_cache_print_stats (ctrl);
       domaininfo_print_stats (ctrl);
-      err = 0;
+      err = cmdstats_send (ctx);
+      if (!err && line[5])
+        cmdstats_reset ();
     }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
@@ -3067,6 +3077,52 @@ register_commands (assuan_context_t ctx)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  cmdstats_start (&ctrl->server_local->cmd_start);
+  ctrl->server_local->cmd_failed = 0;
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  ERR is the error from
+   writing the response; thus we use the flag set by io_monitor.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  cmdstats_record (assuan_get_command_name (ctx),
+                   &ctrl->server_local->cmd_start,
+                   ctrl->server_local->cmd_failed);
+}
+
+
+/* Called by libassuan for all I/O.  We use it to detect failed
+   commands for the statistics.  */
+static unsigned int
+io_monitor (assuan_context_t ctx, void *hook, int direction,
+            const char *line, size_t linelen)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)hook;
+
+  if (ctrl && ctrl->server_local
+      && cmdstats_err_line_p (direction, line, linelen))
+    ctrl->server_local->cmd_failed = 1;
+  return 0;
+}
+
+
 /* Note that we do not reset the list of configured keyservers.  */
 static gpg_error_t
 reset_notify (assuan_context_t ctx, char *line)
@@ -3186,6 +3242,9 @@ start_command_handler (assuan_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
+  assuan_set_io_monitor (ctx, io_monitor, NULL);
 
   ctrl->server_local->session_id = session_id;
 
@@ -252,6 +252,10 @@ build_packet_and_meta (iobuf_t out, PACKET *pkt)
           rt.sigcache = 1;
           if (sig->flags.valid)
             rt.sigcache |= 2;
+          /* Also store the status of the back signature so that it
+           * needs not to be verified again on each lookup.  */
+          if (sig->flags.valid && sig->flags.backsig)
+            rt.sigcache |= sig->flags.backsig == 2? 12 : 4;
         }
       err = do_ring_trust (out, &rt);
     }
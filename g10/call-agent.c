@@ -77,6 +77,13 @@ struct cipher_parm_s
   size_t ciphertextlen;
 };
 
+struct hashlist_parm_s
+{
+  struct default_inq_parm_s *dflt;
+  const char *hashlist;
+  size_t hashlistlen;
+};
+
 struct writecert_parm_s
 {
   struct default_inq_parm_s *dflt;
@@ -2724,6 +2731,160 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+
+/* Handle a HASHLIST inquiry.  */
+static gpg_error_t
+inq_hashlist_cb (void *opaque, const char *line)
+{
+  struct hashlist_parm_s *parm = opaque;
+  gpg_error_t err;
+
+  if (has_leading_keyword (line, "HASHLIST"))
+    err = assuan_send_data (parm->dflt->ctx,
+                            parm->hashlist, parm->hashlistlen);
+  else
+    err = default_inq_cb (parm->dflt, line);
+
+  return err;
+}
+
+
+/* Call the agent to sign several hashes using the key identified by
+ * the hex string KEYGRIP.  This is similar to agent_pksign but all
+ * NDIGESTS digests from the array DIGESTS are signed in one go so
+ * that the agent needs to unprotect the key only once.  All digests
+ * have been computed with DIGESTALGO.  On success the signatures are
+ * stored at the array R_SIGVALS which must have space for NDIGESTS
+ * items.  GPG_ERR_NOT_SUPPORTED is returned if the agent does not
+ * support this feature; the caller should then fall back to
+ * agent_pksign.  */
+gpg_error_t
+agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                    const char *keygrip, const char *desc,
+                    u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                    unsigned char **digests, int ndigests, int digestalgo,
+                    gcry_sexp_t *r_sigvals)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data, hashlist;
+  struct default_inq_parm_s dfltparm;
+  struct hashlist_parm_s parm;
+  size_t digestlen, len, off, n;
+  char *hashlistbuf = NULL;
+  unsigned char *buf = NULL;
+  int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+
+  for (i=0; i < ndigests; i++)
+    r_sigvals[i] = NULL;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  /* Check that the gpg-agent supports the --multi option.  */
+  if (assuan_transact (agent_ctx, "GETINFO cmd_has_option PKSIGN multi",
+                       NULL, NULL, NULL, NULL, NULL, NULL))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  digestlen = gcry_md_get_algo_dlen (digestalgo);
+  if (!digestlen || digestlen*2 + 20 > DIM(line))
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
+
+  init_membuf (&hashlist, 4096);
+  for (i=0; i < ndigests; i++)
+    {
+      snprintf (line, sizeof line, "%d ", digestalgo);
+      bin2hex (digests[i], digestlen, line + strlen (line));
+      strcat (line, "\n");
+      put_membuf_str (&hashlist, line);
+    }
+  hashlistbuf = get_membuf (&hashlist, &parm.hashlistlen);
+  if (!hashlistbuf)
+    return gpg_error_from_syserror ();
+  parm.dflt = &dfltparm;
+  parm.hashlist = hashlistbuf;
+
+  err = assuan_transact (agent_ctx, "RESET",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    goto leave;
+
+  snprintf (line, DIM(line), "SIGKEY %s", keygrip);
+  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    goto leave;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line), "SETKEYDESC %s", desc);
+      err = assuan_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        goto leave;
+    }
+
+  init_membuf (&data, 1024);
+
+  snprintf (line, sizeof line, "PKSIGN --multi%s%s",
+            cache_nonce? " -- ":"",
+            cache_nonce? cache_nonce:"");
+
+  if (DBG_CLOCK)
+    log_clock ("enter signing");
+  err = assuan_transact (agent_ctx, line,
+                         put_membuf_cb, &data,
+                         inq_hashlist_cb, &parm,
+                         NULL, NULL);
+  if (DBG_CLOCK)
+    log_clock ("leave signing");
+
+  buf = get_membuf (&data, &len);
+  if (!err && !buf)
+    err = gpg_error_from_syserror ();
+  if (err)
+    goto leave;
+
+  /* Split the returned canonical S-expressions.  */
+  for (i=0, off=0; i < ndigests; i++, off += n)
+    {
+      n = off < len? gcry_sexp_canon_len (buf + off, len - off, NULL, NULL)
+                   : 0;
+      if (!n)
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          goto leave;
+        }
+      err = gcry_sexp_sscan (&r_sigvals[i], NULL, (char*)buf + off, n);
+      if (err)
+        goto leave;
+    }
+  if (off != len)
+    err = gpg_error (GPG_ERR_INV_SEXP);
+
+ leave:
+  if (err)
+    {
+      for (i=0; i < ndigests; i++)
+        {
+          gcry_sexp_release (r_sigvals[i]);
+          r_sigvals[i] = NULL;
+        }
+    }
+  xfree (hashlistbuf);
+  xfree (buf);
+  return err;
+}
+
+
+
 
 /* Handle a CIPHERTEXT inquiry.  Note, we only send the data,
    assuan_transact takes care of flushing and writing the END. */
@@ -2885,6 +3046,196 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
 }
 
 
+/* Parse the number from the canonical S-expression BUF of length LEN
+ * which is expected to be a list with the tag NAME and one decimal
+ * number.  Returns true and stores the number at R_VALUE on
+ * success.  */
+static int
+parse_canon_number_list (const unsigned char *buf, size_t len,
+                         const char *name, unsigned long *r_value)
+{
+  const char *s;
+  char *endp;
+  size_t namelen = strlen (name);
+  unsigned long n;
+
+  s = (const char *)buf;
+  if (len < 4 || *s != '(')
+    return 0;
+  s++;
+  n = strtoul (s, &endp, 10);
+  if (n != namelen || *endp != ':' || memcmp (endp+1, name, namelen))
+    return 0;
+  s = endp + 1 + namelen;
+  n = strtoul (s, &endp, 10);
+  if (!n || *endp != ':' || endp + 1 + n + 1 > (const char *)buf + len
+      || endp[1+n] != ')')
+    return 0;
+  *r_value = strtoul (endp + 1, NULL, 10);
+  return 1;
+}
+
+
+/* Call the agent to decrypt the NCIPHERTEXTS ciphertexts from the
+ * array S_CIPHERTEXTS using the key identified by the hex string
+ * KEYGRIP.  This is similar to agent_pkdecrypt but all ciphertexts
+ * are sent in one go so that the agent needs to read and unprotect
+ * the key only once.  For each ciphertext the result is stored at the
+ * same index of the arrays R_BUFS, R_BUFLENS, R_PADDINGS and R_ERRS;
+ * the caller needs to release the returned buffers.  The function
+ * returns an error only if the request as a whole failed;
+ * GPG_ERR_NOT_SUPPORTED is returned if the agent does not support
+ * this feature.  */
+gpg_error_t
+agent_pkdecrypt_multi (ctrl_t ctrl, const char *keygrip, const char *desc,
+                       u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                       gcry_sexp_t *s_ciphertexts, int nciphertexts,
+                       unsigned char **r_bufs, size_t *r_buflens,
+                       int *r_paddings, gpg_error_t *r_errs)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data, cipherlist;
+  struct default_inq_parm_s dfltparm;
+  struct cipher_parm_s parm;
+  unsigned char *buf = NULL;
+  unsigned char *tmpbuf;
+  size_t len, off, n, tmplen;
+  unsigned long value;
+  const char *s;
+  char *endp;
+  int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+
+  if (!keygrip || strlen(keygrip) != 40 || nciphertexts < 1)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  for (i=0; i < nciphertexts; i++)
+    {
+      r_bufs[i] = NULL;
+      r_buflens[i] = 0;
+      r_paddings[i] = -1;
+      r_errs[i] = gpg_error (GPG_ERR_INV_SEXP);
+    }
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  /* Check that the gpg-agent supports the --multi option.  */
+  if (assuan_transact (agent_ctx, "GETINFO cmd_has_option PKDECRYPT multi",
+                       NULL, NULL, NULL, NULL, NULL, NULL))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  init_membuf (&cipherlist, 4096);
+  for (i=0; i < nciphertexts; i++)
+    {
+      err = make_canon_sexp (s_ciphertexts[i], &tmpbuf, &tmplen);
+      if (err)
+        {
+          xfree (get_membuf (&cipherlist, NULL));
+          return err;
+        }
+      put_membuf (&cipherlist, tmpbuf, tmplen);
+      xfree (tmpbuf);
+    }
+  parm.dflt = &dfltparm;
+  parm.ctx = agent_ctx;
+  parm.ciphertext = get_membuf (&cipherlist, &parm.ciphertextlen);
+  if (!parm.ciphertext)
+    return gpg_error_from_syserror ();
+
+  err = assuan_transact (agent_ctx, "RESET",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    goto leave;
+
+  snprintf (line, sizeof line, "SETKEY %s", keygrip);
+  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    goto leave;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line), "SETKEYDESC %s", desc);
+      err = assuan_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        goto leave;
+    }
+
+  init_membuf_secure (&data, 4096);
+  err = assuan_transact (agent_ctx, "PKDECRYPT --multi",
+                         put_membuf_cb, &data,
+                         inq_ciphertext_cb, &parm,
+                         NULL, NULL);
+  buf = get_membuf (&data, &len);
+  if (!err && !buf)
+    err = gpg_error_from_syserror ();
+  if (err)
+    goto leave;
+
+  /* Split the returned canonical S-expressions.  */
+  for (i=0, off=0; off < len; off += n)
+    {
+      n = i < nciphertexts? gcry_sexp_canon_len (buf + off, len - off,
+                                                 NULL, NULL)
+                          : 0;
+      if (!n)
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          goto leave;
+        }
+      if (parse_canon_number_list (buf + off, n, "padding", &value))
+        r_paddings[i] = (int)value;
+      else if (parse_canon_number_list (buf + off, n, "error", &value))
+        r_errs[i++] = (gpg_error_t)value;
+      else if (n >= 12 && !memcmp (buf + off, "(5:value", 8))
+        {
+          s = (const char *)buf + off + 8;
+          tmplen = strtoul (s, &endp, 10);
+          if (tmplen && *endp == ':'
+              && (unsigned char*)endp + 1 + tmplen + 1 == buf + off + n)
+            {
+              r_bufs[i] = xtrymalloc_secure (tmplen);
+              if (!r_bufs[i])
+                {
+                  err = gpg_error_from_syserror ();
+                  goto leave;
+                }
+              memcpy (r_bufs[i], endp + 1, tmplen);
+              r_buflens[i] = tmplen;
+              r_errs[i] = 0;
+            }
+          i++;
+        }
+      else
+        i++;  /* Unknown item; keep the INV_SEXP error.  */
+    }
+  if (i != nciphertexts)
+    err = gpg_error (GPG_ERR_INV_SEXP);
+
+ leave:
+  if (err)
+    {
+      for (i=0; i < nciphertexts; i++)
+        {
+          xfree (r_bufs[i]);
+          r_bufs[i] = NULL;
+        }
+    }
+  xfree (buf);
+  xfree (parm.ciphertext);
+  return err;
+}
+
+
 
 /* Retrieve a key encryption key from the agent.  With FOREXPORT true
    the key shall be used for export, with false for import.  On success
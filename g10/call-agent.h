@@ -214,6 +214,13 @@ gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           int digestalgo,
                           gcry_sexp_t *r_sigval);
 
+/* Create signatures for several digests with the same key.  */
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *hexkeygrip, const char *desc,
+                                u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                                unsigned char **digests, int ndigests,
+                                int digestalgo, gcry_sexp_t *r_sigvals);
+
 /* Decrypt a ciphertext.  */
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              u32 *keyid, u32 *mainkeyid, int pubkey_algo,
@@ -221,6 +228,15 @@ gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              unsigned char **r_buf, size_t *r_buflen,
                              int *r_padding);
 
+/* Decrypt several ciphertexts with the same key.  */
+gpg_error_t agent_pkdecrypt_multi (ctrl_t ctrl, const char *keygrip,
+                                   const char *desc,
+                                   u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                                   gcry_sexp_t *s_ciphertexts,
+                                   int nciphertexts,
+                                   unsigned char **r_bufs, size_t *r_buflens,
+                                   int *r_paddings, gpg_error_t *r_errs);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key (ctrl_t ctrl, int forexport,
                                void **r_kek, size_t *r_keklen);
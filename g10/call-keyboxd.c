@@ -74,10 +74,54 @@ struct keyboxd_local_s
 };
 
 
+/* A search result returned by the MSEARCH command.  */
+struct keydb_prefetch_result_s
+{
+  unsigned char ubid[UBID_LEN];
+  int uid_no;
+  int pk_no;
+  const char *blob;  /* Points into the DATA of the prefetch object.  */
+  size_t bloblen;
+};
+
+
+/* The results for one search pattern of a prefetch operation.  */
+struct keydb_prefetch_item_s
+{
+  char *pattern;  /* The search pattern as sent to the keyboxd.  */
+  unsigned int nresults;
+  struct keydb_prefetch_result_s *results;
+};
+
+
+/* The object used to keep the results of keydb_prefetch.  Note that
+ * gpg.h defines the type keydb_prefetch_t for this structure.  */
+struct keydb_prefetch_s
+{
+  /* The object is referenced by CTRL and by each database handle
+   * currently returning results from it.  */
+  int refcount;
+
+  /* The raw data as returned by the keyboxd.  */
+  char *data;
+
+  /* The database generation as reported by the keyboxd along with
+   * the result.  */
+  char generation[50];
+
+  /* The items; one for each search pattern.  */
+  unsigned int nitems;
+  struct keydb_prefetch_item_s *items;
+};
+
+
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
 
+static void drop_prefetch (ctrl_t ctrl);
+
+
 
 
 /* Deinitialize all session resources pertaining to the keyboxd.  */
@@ -87,6 +131,8 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
   keyboxd_local_t kbl;
   gpg_error_t err;
 
+  drop_prefetch (ctrl);
+
   while ((kbl = ctrl->keyboxd_local))
     {
       ctrl->keyboxd_local = kbl->next;
@@ -298,6 +344,53 @@ keydb_new (ctrl_t ctrl)
 }
 
 
+/* Release a reference to the prefetch object PF.  */
+static void
+unref_prefetch (keydb_prefetch_t pf)
+{
+  unsigned int n;
+
+  if (!pf)
+    return;
+  if (--pf->refcount > 0)
+    return;
+
+  for (n=0; n < pf->nitems; n++)
+    {
+      xfree (pf->items[n].pattern);
+      xfree (pf->items[n].results);
+    }
+  xfree (pf->items);
+  xfree (pf->data);
+  xfree (pf);
+}
+
+
+/* Stop answering searches on HD from prefetched results.  */
+static void
+clear_handle_prefetch (KEYDB_HANDLE hd)
+{
+  unref_prefetch (hd->pf);
+  hd->pf = NULL;
+  hd->pf_item = NULL;
+  hd->pf_next = 0;
+}
+
+
+/* Drop the prefetched results of CTRL so that they won't be used by
+ * new searches.  Handles currently returning results from them keep
+ * their reference until they are reset or released.  */
+static void
+drop_prefetch (ctrl_t ctrl)
+{
+  if (ctrl)
+    {
+      unref_prefetch (ctrl->keydb_prefetch);
+      ctrl->keydb_prefetch = NULL;
+    }
+}
+
+
 /* Release a keydb handle.  */
 void
 keydb_release (KEYDB_HANDLE hd)
@@ -313,6 +406,7 @@ keydb_release (KEYDB_HANDLE hd)
     internal_keydb_deinit (hd);
   else
     {
+      clear_handle_prefetch (hd);
       kbl = hd->kbl;
       if (DBG_CLOCK)
         log_clock ("close_context (found)");
@@ -449,12 +543,17 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  /* The keyblock may carry keys we recorded as not existing.  */
+  getkey_flush_negative_cache ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_update_keyblock (ctrl, hd, kb);
       goto leave;
     }
 
+  drop_prefetch (hd->ctrl);
+
   if (opt.dry_run)
     {
       err = 0;
@@ -500,12 +599,17 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  /* The keyblock may carry keys we recorded as not existing.  */
+  getkey_flush_negative_cache ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_insert_keyblock (hd, kb);
       goto leave;
     }
 
+  drop_prefetch (hd->ctrl);
+
   if (opt.dry_run)
     {
       err = 0;
@@ -551,6 +655,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       goto leave;
     }
 
+  drop_prefetch (hd->ctrl);
+
   if (opt.dry_run)
     {
       err = 0;
@@ -604,6 +710,7 @@ keydb_search_reset (KEYDB_HANDLE hd)
    * ubid flag so that after a reset a delete can't be performed.  */
   hd->kbl->need_search_reset = 1;
   hd->last_ubid_valid = 0;
+  clear_handle_prefetch (hd);
   err = 0;
 
  leave:
@@ -612,6 +719,97 @@ keydb_search_reset (KEYDB_HANDLE hd)
 
 
 
+/* Format the search description DESC as a keyboxd search pattern
+ * and store it in BUFFER which has a size of BUFSIZE.  */
+static gpg_error_t
+format_search_pattern (KEYDB_SEARCH_DESC *desc, char *buffer, size_t bufsize)
+{
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+      snprintf (buffer, bufsize, "=%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBSTR:
+      snprintf (buffer, bufsize, "*%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      snprintf (buffer, bufsize, "<%s",
+                desc->u.name+(desc->u.name[0] == '<') );
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      snprintf (buffer, bufsize, "@%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
+      snprintf (buffer, bufsize, ".%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_WORDS:
+      snprintf (buffer, bufsize, "+%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      snprintf (buffer, bufsize, "0x%08lX", (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      snprintf (buffer, bufsize, "0x%08lX%08lX",
+                (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      {
+        unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
+        log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+        bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
+        snprintf (buffer, bufsize, "0x%s", hexfpr);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+      snprintf (buffer, bufsize, "#/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+    case KEYDB_SEARCH_MODE_SN:
+      snprintf (buffer, bufsize, "#%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      snprintf (buffer, bufsize, "/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      {
+        unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
+        bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
+        snprintf (buffer, bufsize, "&%s", hexgrip);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      {
+        unsigned char hexubid[UBID_LEN * 2 + 1];
+        bin2hex (desc->u.ubid, UBID_LEN, hexubid);
+        snprintf (buffer, bufsize, "^%s", hexubid);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_FIRST:
+      log_debug ("%s: mode first - we should not get to here!\n", __func__);
+      /*fallthru*/
+    default:
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  return 0;
+}
+
+
+
 /* Status callback for SEARCH and NEXT operaions.  */
 static gpg_error_t
 search_status_cb (void *opaque, const char *line)
@@ -655,11 +853,42 @@ search_status_cb (void *opaque, const char *line)
             }
         }
     }
+  else if ((s = has_leading_keyword (line, "GENERATION")))
+    {
+      /* The database has been changed since we prefetched keys;
+       * thus we can't use them anymore.  */
+      if (hd->ctrl && hd->ctrl->keydb_prefetch
+          && strcmp (hd->ctrl->keydb_prefetch->generation, s))
+        drop_prefetch (hd->ctrl);
+    }
 
   return err;
 }
 
 
+/* Return the next prefetched result for the search on HD.  */
+static gpg_error_t
+next_prefetched_result (KEYDB_HANDLE hd)
+{
+  struct keydb_prefetch_result_s *r;
+
+  hd->last_ubid_valid = 0;
+  if (hd->pf_next >= hd->pf_item->nresults)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  r = hd->pf_item->results + hd->pf_next++;
+  hd->kbl->search_result = iobuf_temp_with_content (r->blob, r->bloblen);
+  memcpy (hd->last_ubid, r->ubid, UBID_LEN);
+  hd->last_uid_no = r->uid_no;
+  hd->last_pk_no = r->pk_no;
+  hd->last_ubid_valid = 1;
+  if (DBG_LOOKUP)
+    log_printhex (hd->last_ubid, 20, "found UBID (%d,%d) (prefetched):",
+                  hd->last_uid_no, hd->last_pk_no);
+  return 0;
+}
+
+
 /* Search the database for keys matching the search description.  If
  * the DB contains any legacy keys, these are silently ignored.
  *
@@ -685,6 +914,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   gpg_error_t err;
   int i;
   char line[ASSUAN_LINELENGTH];
+  char pattern[ASSUAN_LINELENGTH];
   char *buffer;
   size_t len;
 
@@ -721,6 +951,42 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       hd->kbl->search_result = NULL;
     }
 
+  /* Check whether this is a NEXT search on prefetched results.  */
+  if (!hd->kbl->need_search_reset && hd->pf_item)
+    {
+      err = next_prefetched_result (hd);
+      goto leave;
+    }
+
+  /* Check whether the search can be answered from prefetched
+   * results.  */
+  clear_handle_prefetch (hd);
+  if (hd->kbl->need_search_reset && ndesc == 1 && hd->ctrl->keydb_prefetch
+      && desc->mode != KEYDB_SEARCH_MODE_FIRST
+      && desc->mode != KEYDB_SEARCH_MODE_NEXT
+      && !format_search_pattern (desc, pattern, sizeof pattern))
+    {
+      keydb_prefetch_t pf = hd->ctrl->keydb_prefetch;
+      unsigned int n;
+
+      for (n=0; n < pf->nitems; n++)
+        if (!strcmp (pf->items[n].pattern, pattern))
+          break;
+      if (n < pf->nitems)
+        {
+          if (DBG_LOOKUP)
+            log_debug ("%s: using prefetched results for '%s'\n",
+                       __func__, pattern);
+          pf->refcount++;
+          hd->pf = pf;
+          hd->pf_item = pf->items + n;
+          hd->pf_next = 0;
+          hd->kbl->need_search_reset = 0;
+          err = next_prefetched_result (hd);
+          goto leave;
+        }
+    }
+
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
@@ -755,92 +1021,17 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     {
       const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
 
-      switch (desc->mode)
+      if (desc->mode == KEYDB_SEARCH_MODE_NEXT)
         {
-        case KEYDB_SEARCH_MODE_EXACT:
-          snprintf (line, sizeof line, "SEARCH %s -- =%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBSTR:
-          snprintf (line, sizeof line, "SEARCH %s -- *%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAIL:
-          snprintf (line, sizeof line, "SEARCH %s -- <%s",
-                    more, desc->u.name+(desc->u.name[0] == '<') );
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILSUB:
-          snprintf (line, sizeof line, "SEARCH %s -- @%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILEND:
-          snprintf (line, sizeof line, "SEARCH %s -- .%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_WORDS:
-          snprintf (line, sizeof line, "SEARCH %s -- +%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SHORT_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX", more,
-                    (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX%08lX", more,
-                    (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_FPR:
-          {
-            unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
-            log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
-            bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
-            snprintf (line, sizeof line, "SEARCH %s -- 0x%s", more, hexfpr);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER:
-          snprintf (line, sizeof line, "SEARCH %s -- #/%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER_SN:
-        case KEYDB_SEARCH_MODE_SN:
-          snprintf (line, sizeof line, "SEARCH %s -- #%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBJECT:
-          snprintf (line, sizeof line, "SEARCH %s -- /%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_KEYGRIP:
-          {
-            unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
-            bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
-            snprintf (line, sizeof line, "SEARCH %s -- &%s", more, hexgrip);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_UBID:
-          {
-            unsigned char hexubid[UBID_LEN * 2 + 1];
-            bin2hex (desc->u.ubid, UBID_LEN, hexubid);
-            snprintf (line, sizeof line, "SEARCH %s -- ^%s", more, hexubid);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_NEXT:
           log_debug ("%s: mode next - we should not get to here!\n", __func__);
           snprintf (line, sizeof line, "NEXT");
-          break;
-
-        case KEYDB_SEARCH_MODE_FIRST:
-          log_debug ("%s: mode first - we should not get to here!\n", __func__);
-          /*fallthru*/
-        default:
-          err = gpg_error (GPG_ERR_INV_ARG);
-          goto leave;
+        }
+      else
+        {
+          err = format_search_pattern (desc, pattern, sizeof pattern);
+          if (err)
+            goto leave;
+          snprintf (line, sizeof line, "SEARCH %s -- %s", more, pattern);
         }
 
       if (ndesc > 1)
@@ -870,3 +1061,243 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     log_clock ("%s leave (%sfound)", __func__, err? "not ":"");
   return err;
 }
+
+
+
+/* Communication object for MSEARCH commands.  */
+struct msearch_parm_s
+{
+  assuan_context_t ctx;
+  const void *data;   /* The linefeed delimited list of patterns.  */
+  size_t datalen;     /* The length of DATA.  */
+};
+
+
+/* Handle the inquiries from the MSEARCH command.  */
+static gpg_error_t
+msearch_inq_cb (void *opaque, const char *line)
+{
+  struct msearch_parm_s *parm = opaque;
+
+  if (has_leading_keyword (line, "PATTERNS"))
+    return assuan_send_data (parm->ctx, parm->data, parm->datalen);
+
+  return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+}
+
+
+/* Status callback for the MSEARCH command.  */
+static gpg_error_t
+msearch_status_cb (void *opaque, const char *line)
+{
+  keydb_prefetch_t pf = opaque;
+  const char *s;
+
+  if ((s = has_leading_keyword (line, "GENERATION")))
+    {
+      /* Note that the keyboxd emits this only once per command.  */
+      if (strlen (s) < sizeof pf->generation)
+        strcpy (pf->generation, s);
+    }
+
+  return 0;
+}
+
+
+/* Parse the records (DATA,DATALEN) as returned by MSEARCH and store
+ * them in PF.  On success PF takes ownership of DATA.  */
+static gpg_error_t
+parse_msearch_result (keydb_prefetch_t pf, char *data, size_t datalen)
+{
+  const unsigned char *p;
+  size_t n, reclen;
+  unsigned int idx, pass;
+  struct keydb_prefetch_item_s *item;
+  struct keydb_prefetch_result_s *r;
+
+  /* In the first pass we count the results per item and in the
+   * second pass we fill them in.  */
+  for (pass=0; pass < 2; pass++)
+    {
+      for (p = (const unsigned char *)data, n = datalen; n;
+           p += reclen, n -= reclen)
+        {
+          if (n < 4)
+            return gpg_error (GPG_ERR_INV_RESPONSE);
+          reclen = buf32_to_size_t (p);
+          p += 4;
+          n -= 4;
+          if (reclen < 40 || reclen > n)
+            return gpg_error (GPG_ERR_INV_RESPONSE);
+          idx = buf32_to_uint (p);
+          if (idx >= pf->nitems)
+            return gpg_error (GPG_ERR_INV_RESPONSE);
+          if (buf32_to_uint (p+4) != PUBKEY_TYPE_OPGP)
+            continue;  /* Not an OpenPGP key - ignore.  */
+          item = pf->items + idx;
+          if (!pass)
+            {
+              item->nresults++;
+              continue;
+            }
+          r = item->results + item->nresults++;
+          memcpy (r->ubid, p+8, UBID_LEN);
+          r->uid_no = (int)buf32_to_uint (p+32);
+          r->pk_no  = (int)buf32_to_uint (p+36);
+          r->blob = (const char *)p + 40;
+          r->bloblen = reclen - 40;
+        }
+
+      if (!pass)
+        {
+          for (idx=0; idx < pf->nitems; idx++)
+            {
+              item = pf->items + idx;
+              if (!item->nresults)
+                continue;
+              item->results = xtrycalloc (item->nresults,
+                                          sizeof *item->results);
+              if (!item->results)
+                return gpg_error_from_syserror ();
+              item->nresults = 0;
+            }
+        }
+    }
+
+  pf->data = data;
+  return 0;
+}
+
+
+/* Look up all keys matching any of the NDESC search descriptions in
+ * DESC using a single request to the keyboxd.  The results are kept
+ * in CTRL and a later keydb_search with exactly one of these search
+ * descriptions returns them without asking the keyboxd again.  This
+ * is useful to speed up the lookup of a long list of recipients.  The
+ * prefetched results are dropped by keydb_prefetch_release, by any
+ * change to the database done by us, or if the keyboxd reports a new
+ * database generation.  This function does nothing if the keyboxd is
+ * not used.  */
+gpg_error_t
+keydb_prefetch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE hd = NULL;
+  keydb_prefetch_t pf = NULL;
+  struct msearch_parm_s parm = {NULL};
+  char pattern[ASSUAN_LINELENGTH];
+  membuf_t mb;
+  char *patterns = NULL;
+  size_t patternslen;
+  char *buffer = NULL;
+  size_t len;
+  size_t n;
+
+  if (!opt.use_keyboxd || !ndesc)
+    return 0;
+
+  if (DBG_CLOCK)
+    log_clock ("%s enter", __func__);
+
+  drop_prefetch (ctrl);
+
+  pf = xtrycalloc (1, sizeof *pf);
+  if (!pf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  pf->refcount = 1;
+  pf->items = xtrycalloc (ndesc, sizeof *pf->items);
+  if (!pf->items)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Build the list of patterns.  Descriptions which can't be
+   * expressed as a pattern are skipped; they will later be searched
+   * the usual way.  */
+  init_membuf (&mb, 1024);
+  for (n=0; n < ndesc; n++)
+    {
+      if (desc[n].mode == KEYDB_SEARCH_MODE_FIRST
+          || desc[n].mode == KEYDB_SEARCH_MODE_NEXT
+          || format_search_pattern (desc + n, pattern, sizeof pattern)
+          || strchr (pattern, '\n'))
+        continue;
+      pf->items[pf->nitems].pattern = xtrystrdup (pattern);
+      if (!pf->items[pf->nitems].pattern)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (get_membuf (&mb, NULL));
+          goto leave;
+        }
+      pf->nitems++;
+      put_membuf_str (&mb, pattern);
+      put_membuf (&mb, "\n", 1);
+    }
+  patterns = get_membuf (&mb, &patternslen);
+  if (!patterns)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!pf->nitems)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  parm.ctx = hd->kbl->ctx;
+  parm.data = patterns;
+  parm.datalen = patternslen;
+  err = kbx_client_data_inq_cmd (hd->kbl->kcd, "MSEARCH --openpgp",
+                                 msearch_inq_cb, &parm,
+                                 msearch_status_cb, pf);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      /* Nothing found at all.  We keep the empty result so that the
+       * following searches don't need to ask again.  */
+      err = 0;
+    }
+  else if (err || (err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
+    goto leave;
+  else if ((err = parse_msearch_result (pf, buffer, len)))
+    {
+      log_error ("error parsing the MSEARCH result: %s\n",
+                 gpg_strerror (err));
+      goto leave;
+    }
+  else
+    buffer = NULL; /* Now owned by PF.  */
+
+  ctrl->keydb_prefetch = pf;
+  pf = NULL;
+
+ leave:
+  if (err && DBG_LOOKUP)
+    log_debug ("%s: failed: %s\n", __func__, gpg_strerror (err));
+  xfree (buffer);
+  unref_prefetch (pf);
+  keydb_release (hd);
+  xfree (patterns);
+  if (DBG_CLOCK)
+    log_clock ("%s leave", __func__);
+  return err;
+}
+
+
+/* Release the results of a previous keydb_prefetch.  */
+void
+keydb_prefetch_release (ctrl_t ctrl)
+{
+  drop_prefetch (ctrl);
+}
@@ -185,14 +185,87 @@ decrypt_message_fd (ctrl_t ctrl, gnupg_fd_t input_fd,
 }
 
 
+/* The number of messages for which decrypt_messages requests the
+ * session keys from the agent in one go.  The decrypted session keys
+ * are kept in secure memory until used; thus this should not be too
+ * large.  */
+#define DECRYPT_BATCH_SIZE 16
+
+
+/* Decrypt the message in the file FILENAME.  */
+static void
+decrypt_one_message (ctrl_t ctrl, const char *filename,
+                     progress_filter_context_t *pfx)
+{
+  IOBUF fp;
+  char *p, *output = NULL;
+  int rc;
+
+  print_file_status(STATUS_FILE_START, filename, 3);
+  output = make_outfile_name(filename);
+  if (!output)
+    goto next_file;
+  fp = iobuf_open(filename);
+  if (fp)
+    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
+      goto next_file;
+    }
+
+  handle_progress (pfx, fp, filename);
+
+  if (!opt.no_armor)
+    {
+      if (use_armor_filter(fp))
+        {
+          armor_filter_context_t *afx = new_armor_context ();
+          rc = push_armor_filter (afx, fp);
+          if (rc)
+            log_error("failed to push armor filter");
+          release_armor_context (afx);
+        }
+    }
+  rc = proc_packets (ctrl,NULL, fp);
+  iobuf_close(fp);
+  if (rc)
+    log_error("%s: decryption failed: %s\n", print_fname_stdin(filename),
+              gpg_strerror (rc));
+  p = get_last_passphrase();
+  set_next_passphrase(p);
+  xfree (p);
+
+ next_file:
+  /* Note that we emit file_done even after an error. */
+  write_status( STATUS_FILE_DONE );
+  xfree(output);
+  reset_literals_seen();
+}
+
+
+/* Decrypt the NFILES messages in the files FILES.  If NFILES is 0
+ * the file names are read from stdin.  The messages given on the
+ * command line are processed in batches; the session keys of a batch
+ * are requested from the agent before the messages are decrypted.
+ * File names read from stdin are processed one by one because the
+ * caller may wait for the result before sending the next name.  */
 void
 decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 {
-  IOBUF fp;
   progress_filter_context_t *pfx;
-  char *p, *output = NULL;
-  int rc=0,use_stdin=0;
+  int use_stdin=0;
   unsigned int lno=0;
+  char *batch[DECRYPT_BATCH_SIZE];
+  int nbatch = 0;
+  int batchsize;
+  int i;
 
   if (opt.outfile)
     {
@@ -204,6 +277,7 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 
   if(!nfiles)
     use_stdin=1;
+  batchsize = use_stdin? 1 : DECRYPT_BATCH_SIZE;
 
   for(;;)
     {
@@ -234,55 +308,23 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 	    }
 	}
 
-      if(filename==NULL)
-	break;
-
-      print_file_status(STATUS_FILE_START, filename, 3);
-      output = make_outfile_name(filename);
-      if (!output)
-        goto next_file;
-      fp = iobuf_open(filename);
-      if (fp)
-        iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
-      if (fp && is_secured_file (iobuf_get_fd (fp)))
-        {
-          iobuf_close (fp);
-          fp = NULL;
-          gpg_err_set_errno (EPERM);
-        }
-      if (!fp)
-        {
-          log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
-          goto next_file;
-        }
-
-      handle_progress (pfx, fp, filename);
+      if (filename)
+        batch[nbatch++] = xstrdup (filename);
 
-      if (!opt.no_armor)
+      if (nbatch && (!filename || nbatch == batchsize))
         {
-          if (use_armor_filter(fp))
+          prefetch_session_keys (ctrl, batch, nbatch);
+          for (i=0; i < nbatch; i++)
             {
-              armor_filter_context_t *afx = new_armor_context ();
-              rc = push_armor_filter (afx, fp);
-              if (rc)
-                log_error("failed to push armor filter");
-              release_armor_context (afx);
+              decrypt_one_message (ctrl, batch[i], pfx);
+              xfree (batch[i]);
             }
+          release_prefetched_session_keys (ctrl);
+          nbatch = 0;
         }
-      rc = proc_packets (ctrl,NULL, fp);
-      iobuf_close(fp);
-      if (rc)
-        log_error("%s: decryption failed: %s\n", print_fname_stdin(filename),
-                  gpg_strerror (rc));
-      p = get_last_passphrase();
-      set_next_passphrase(p);
-      xfree (p);
-
-    next_file:
-      /* Note that we emit file_done even after an error. */
-      write_status( STATUS_FILE_DONE );
-      xfree(output);
-      reset_literals_seen();
+
+      if(filename==NULL)
+	break;
     }
 
   set_next_passphrase(NULL);
@@ -48,6 +48,11 @@
 #error We need the cache for key creation
 #endif
 
+/* The number of seconds a negative entry of the pk cache is valid.
+ * Keys added by this process flush these entries but keys added by
+ * other processes are only noticed after this time.  */
+#define PK_CACHE_NEG_TTL       10
+
 /* Flags values returned by the lookup code.  Note that the values are
  * directly used by the KEY_CONSIDERED status line.  */
 #define LOOKUP_NOT_SELECTED        (1<<0)
@@ -120,15 +125,41 @@ typedef struct keyid_list
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache.  The entries are indexed by the keyid using a
+ * hash table and kept on a list in most recently used order.  A
+ * lookup by fingerprint uses the keyid part of the fingerprint.  An
+ * entry without a PK records that there is no key with that keyid in
+ * the database; such an entry expires after PK_CACHE_NEG_TTL
+ * seconds.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next entry in the bucket.  */
+  struct pk_cache_entry *lru_prev;  /* The next more recently used.  */
+  struct pk_cache_entry *lru_next;  /* The next less recently used.  */
   u32 keyid[2];
-  PKT_public_key *pk;
+  PKT_public_key *pk;               /* NULL for a negative entry.  */
+  time_t expires;                   /* Expiration of a negative entry.  */
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
-static int pk_cache_entries;	/* Number of entries in pk cache.  */
-static int pk_cache_disabled;
+
+static struct
+{
+  pk_cache_entry_t *table;   /* The hash table.  */
+  unsigned int table_size;   /* Number of buckets; a power of 2.  */
+  unsigned int max_entries;  /* The configured size of the cache.  */
+  unsigned int entries;      /* Number of entries in pk cache.  */
+  pk_cache_entry_t lru_head; /* The most recently used entry.  */
+  pk_cache_entry_t lru_tail; /* The least recently used entry.  */
+  int disabled;
+} pk_cache = { NULL, 0, MAX_PK_CACHE_ENTRIES };
+
+static struct
+{
+  unsigned int hits;      /* Lookups answered by a positive entry.  */
+  unsigned int neg_hits;  /* Lookups answered by a negative entry.  */
+  unsigned int misses;    /* Lookups not answered by the cache.  */
+  unsigned int added;     /* Number of entries added.  */
+  unsigned int evicted;   /* Number of entries evicted.  */
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -162,11 +193,188 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Return the hash bucket of the pk cache for KEYID.  */
+static inline pk_cache_entry_t *
+pk_cache_bucket (u32 *keyid)
+{
+  return pk_cache.table + (keyid[1] & (pk_cache.table_size - 1));
+}
+
+
+/* Allocate the hash table of the pk cache.  Returns false if the
+ * cache can't be used.  */
+static int
+pk_cache_init (void)
+{
+  unsigned int size;
+
+  if (pk_cache.table)
+    return 1;
+  if (pk_cache.disabled || pk_cache.max_entries < 2)
+    return 0;
+
+  for (size = 16; size < pk_cache.max_entries && size < (1 << 20); size <<= 1)
+    ;
+  pk_cache.table = xtrycalloc (size, sizeof *pk_cache.table);
+  if (!pk_cache.table)
+    return 0;
+  pk_cache.table_size = size;
+  return 1;
+}
+
+
+/* Return the entry for KEYID or NULL if there is none.  */
+static pk_cache_entry_t
+pk_cache_find (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache.table)
+    return NULL;
+
+  for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      break;
+  return ce;
+}
+
+
+/* Unlink CE from the LRU list.  */
+static void
+pk_cache_lru_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache.lru_head = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache.lru_tail = ce->lru_prev;
+  ce->lru_prev = ce->lru_next = NULL;
+}
+
+
+/* Put CE at the head of the LRU list.  */
+static void
+pk_cache_lru_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache.lru_head;
+  if (pk_cache.lru_head)
+    pk_cache.lru_head->lru_prev = ce;
+  else
+    pk_cache.lru_tail = ce;
+  pk_cache.lru_head = ce;
+}
+
+
+/* Mark CE as the most recently used entry.  */
+static void
+pk_cache_touch (pk_cache_entry_t ce)
+{
+  if (pk_cache.lru_head != ce)
+    {
+      pk_cache_lru_unlink (ce);
+      pk_cache_lru_push (ce);
+    }
+}
+
+
+/* Remove CE from the cache and release it.  */
+static void
+pk_cache_remove (pk_cache_entry_t ce)
+{
+  pk_cache_entry_t *cep;
+
+  for (cep = pk_cache_bucket (ce->keyid); *cep; cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  pk_cache_lru_unlink (ce);
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache.entries--;
+}
+
+
+/* Add an entry for KEYID to the cache.  PK is the public key to
+ * store or NULL to record that there is no such key.  The caller
+ * must make sure that no entry for KEYID exists.  */
+static void
+pk_cache_add (u32 *keyid, PKT_public_key *pk)
+{
+  pk_cache_entry_t ce, *bucket;
+
+  if (!pk_cache_init ())
+    return;
+
+  while (pk_cache.entries >= pk_cache.max_entries && pk_cache.lru_tail)
+    {
+      pk_cache_remove (pk_cache.lru_tail);
+      pk_cache_stats.evicted++;
+    }
+
+  ce = xtrycalloc (1, sizeof *ce);
+  if (!ce)
+    return;  /* Out of core - ignore.  */
+  if (pk)
+    {
+      ce->pk = copy_public_key (NULL, pk);
+      /* Make sure the fingerprint is available for lookups.  */
+      fingerprint_from_pk (ce->pk, NULL, NULL);
+    }
+  else
+    ce->expires = gnupg_get_time () + PK_CACHE_NEG_TTL;
+  ce->keyid[0] = keyid[0];
+  ce->keyid[1] = keyid[1];
+  bucket = pk_cache_bucket (keyid);
+  ce->next = *bucket;
+  *bucket = ce;
+  pk_cache_lru_push (ce);
+  pk_cache.entries++;
+  pk_cache_stats.added++;
+}
+
+
+/* Look up KEYID in the cache and update the statistics.  Returns the
+ * entry or NULL.  An expired negative entry is removed.  */
+static pk_cache_entry_t
+pk_cache_lookup (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  ce = pk_cache_find (keyid);
+  if (ce && !ce->pk && ce->expires <= gnupg_get_time ())
+    {
+      pk_cache_remove (ce);
+      ce = NULL;
+    }
+  if (!ce)
+    {
+      pk_cache_stats.misses++;
+      return NULL;
+    }
+
+  pk_cache_touch (ce);
+  if (ce->pk)
+    pk_cache_stats.hits++;
+  else
+    pk_cache_stats.neg_hits++;
+  return ce;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
  * from the public key (e.g., unsupported algorithm), or a key with
- * the key id is already in the cache.
+ * the key id is already in the cache.  A negative entry for the key
+ * id is replaced.
  *
  * The public key packet is copied into the cache using
  * copy_public_key.  Thus, any secret parts are not copied, for
@@ -178,10 +386,10 @@ void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce;
   u32 keyid[2];
 
-  if (pk_cache_disabled)
+  if (pk_cache.disabled)
     return;
 
   if (pk->flags.dont_cache)
@@ -199,43 +407,73 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
-    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-      {
-	if (DBG_CACHE)
-	  log_debug ("cache_public_key: already in cache\n");
-	return;
-      }
-
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
+  ce = pk_cache_find (keyid);
+  if (ce && ce->pk)
     {
-      int n;
+      if (DBG_CACHE)
+        log_debug ("cache_public_key: already in cache\n");
+      return;
+    }
+  if (ce)
+    pk_cache_remove (ce);  /* Drop the negative entry.  */
 
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
+  pk_cache_add (keyid, pk);
+#endif
+}
+
+
+/* Set the maximum number of entries of the public key cache to N.
+ * This is expected to be called before the cache is used; entries
+ * already in the cache are dropped.  Note that key generation needs
+ * at least two entries.  */
+void
+getkey_set_pk_cache_size (unsigned int n)
+{
+#if MAX_PK_CACHE_ENTRIES
+  if (n < 2)
+    n = 2;
+  while (pk_cache.lru_head)
+    pk_cache_remove (pk_cache.lru_head);
+  xfree (pk_cache.table);
+  pk_cache.table = NULL;
+  pk_cache.table_size = 0;
+  pk_cache.max_entries = n;
+#else
+  (void)n;
+#endif
+}
+
+
+/* Remove all negative entries from the public key cache.  This needs
+ * to be called whenever keys are added to the database.  */
+void
+getkey_flush_negative_cache (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  pk_cache_entry_t ce, ce_next;
+
+  for (ce = pk_cache.lru_head; ce; ce = ce_next)
+    {
+      ce_next = ce->lru_next;
+      if (!ce->pk)
+        pk_cache_remove (ce);
     }
-  pk_cache_entries++;
-  ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
-  ce->pk = copy_public_key (NULL, pk);
-  ce->keyid[0] = keyid[0];
-  ce->keyid[1] = keyid[1];
+#endif
+}
+
+
+/* Print statistics of the public key cache.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk_cache: entries=%u/%u buckets=%u hits=%u neg=%u misses=%u"
+            " added=%u evicted=%u%s\n",
+            pk_cache.entries, pk_cache.max_entries, pk_cache.table_size,
+            pk_cache_stats.hits, pk_cache_stats.neg_hits,
+            pk_cache_stats.misses, pk_cache_stats.added,
+            pk_cache_stats.evicted,
+            pk_cache.disabled? " (disabled)":"");
 #endif
 }
 
@@ -263,19 +501,8 @@ void
 getkey_disable_caches (void)
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  getkey_set_pk_cache_size (0);
+  pk_cache.disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
@@ -362,23 +589,22 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   int rc = 0;
 
 #if MAX_PK_CACHE_ENTRIES
-  if (pk)
-    {
-      /* Try to get it from the cache.  We don't do this when pk is
-         NULL as it does not guarantee that the user IDs are
-         cached. */
-      pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
-    }
+  {
+    /* Try to get it from the cache.  We use a positive entry only if
+       PK is not NULL as it does not guarantee that the user IDs are
+       cached. */
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
+
+    if (ce && !ce->pk)
+      return GPG_ERR_NO_PUBKEY;  /* Known to be missing.  */
+    if (ce && pk)
+      {
+        /* XXX: We don't check PK->REQ_USAGE here, but if we don't
+           read from the cache, we do check it!  */
+        copy_public_key (pk, ce->pk);
+        return 0;
+      }
+  }
 #endif
   /* More init stuff.  */
   if (!pk)
@@ -428,6 +654,14 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
       {
 	pk_from_block (pk, kb, found_key);
       }
+#if MAX_PK_CACHE_ENTRIES
+    else if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY && !pk_cache.disabled)
+      {
+        /* Remember that there is no key with this keyid at all.  */
+        if (!pk_cache_find (keyid))
+          pk_cache_add (keyid, NULL);
+      }
+#endif
     getkey_end (ctrl, &ctx);
     release_kbnode (kb);
   }
@@ -503,19 +737,18 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
 #if MAX_PK_CACHE_ENTRIES
   {
     /* Try to get it from the cache */
-    pk_cache_entry_t ce;
-
-    for (ce = pk_cache; ce; ce = ce->next)
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
+
+    if (ce && !ce->pk)
+      return GPG_ERR_NO_PUBKEY;  /* Known to be missing.  */
+    if (ce
+        /* Only consider primary keys.  */
+        && ce->pk->keyid[0] == ce->pk->main_keyid[0]
+        && ce->pk->keyid[1] == ce->pk->main_keyid[1])
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -1848,6 +2081,38 @@ get_pubkey_byfprint (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
   if (r_keyblock)
     *r_keyblock = NULL;
 
+#if MAX_PK_CACHE_ENTRIES
+  if (fprint_len == 32 || fprint_len == 20)
+    {
+      /* Try to get it from the cache.  The keyid is part of the
+       * fingerprint and thus a negative entry for it tells that there
+       * is no key with this fingerprint.  */
+      pk_cache_entry_t ce;
+      u32 keyid[2];
+
+      if (fprint_len == 20)
+        {
+          keyid[0] = buf32_to_u32 (fprint+12);
+          keyid[1] = buf32_to_u32 (fprint+16);
+        }
+      else
+        {
+          keyid[0] = buf32_to_u32 (fprint);
+          keyid[1] = buf32_to_u32 (fprint+4);
+        }
+      ce = pk_cache_lookup (keyid);
+      if (ce && !ce->pk)
+        return GPG_ERR_NO_PUBKEY;
+      if (ce && pk && !pk->req_usage && !r_keyblock
+          && ce->pk->fprlen == fprint_len
+          && !memcmp (ce->pk->fpr, fprint, fprint_len))
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+    }
+#endif
+
   if (fprint_len == 32 || fprint_len == 20 || fprint_len == 16)
     {
       struct getkey_ctx_s ctx;
@@ -1871,7 +2136,10 @@ get_pubkey_byfprint (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
         ctx.req_usage = pk->req_usage;
       rc = lookup (ctrl, &ctx, 0, &kb, &found_key);
       if (!rc && pk)
-	pk_from_block (pk, kb, found_key);
+        {
+          pk_from_block (pk, kb, found_key);
+          cache_public_key (pk);
+        }
       if (!rc && r_keyblock)
 	{
 	  *r_keyblock = kb;
@@ -3373,6 +3641,11 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
 
   subpk->flags.valid = 1;
 
+  /* Use the status of the back signature cached with the binding
+   * signature (see build_packet_and_meta).  */
+  if (!subpk->flags.backsig && !opt.no_sig_cache && sig->flags.backsig)
+    subpk->flags.backsig = sig->flags.backsig;
+
   /* Find the most recent 0x19 embedded signature on our self-sig. */
   if (!subpk->flags.backsig)
     {
@@ -3443,6 +3716,7 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
 	    subpk->flags.backsig = 2;
 	  else
 	    subpk->flags.backsig = 1;
+	  sig->flags.backsig = subpk->flags.backsig;
 
 	  free_seckey_enc (backsig);
 	}
@@ -4120,18 +4394,18 @@ get_seckey_default_or_card (ctrl_t ctrl, PKT_public_key *pk,
 static char *
 get_user_id_string (ctrl_t ctrl, u32 * keyid, int mode)
 {
-  char *name;
+  const char *name;
   unsigned int namelen;
   char *p;
 
   log_assert (mode != 2);
 
-  name = cache_get_uid_bykid (keyid, &namelen);
+  name = cache_ref_uid_bykid (keyid, &namelen);
   if (!name)
     {
       /* Get it so that the cache will be filled.  */
       if (!get_pubkey (ctrl, NULL, keyid))
-        name = cache_get_uid_bykid (keyid, &namelen);
+        name = cache_ref_uid_bykid (keyid, &namelen);
     }
 
   if (name)
@@ -4142,7 +4416,7 @@ get_user_id_string (ctrl_t ctrl, u32 * keyid, int mode)
       else
         p = xasprintf ("%s %.*s", keystr (keyid), namelen, name);
 
-      xfree (name);
+      cache_unref_uid (name);
     }
   else
     {
@@ -4177,34 +4451,66 @@ get_long_user_id_string (ctrl_t ctrl, u32 * keyid)
 char *
 get_user_id (ctrl_t ctrl, u32 *keyid, size_t *rn, int *r_nouid)
 {
+  const char *ref;
   char *name;
+  size_t namelen;
+
+  ref = get_user_id_ref (ctrl, keyid, &namelen, r_nouid);
+  /* The user id may contain a Nul; thus copy by length.  */
+  name = xmalloc (namelen + 1);
+  memcpy (name, ref, namelen);
+  name[namelen] = 0;
+  release_user_id_ref (ref);
+
+  if (rn)
+    *rn = namelen;
+  return name;
+}
+
+
+/* Same as get_user_id but return a reference to the user id interned
+ * in the object cache instead of a copy.  The returned string must
+ * not be modified and must be released using release_user_id_ref.  */
+const char *
+get_user_id_ref (ctrl_t ctrl, u32 *keyid, size_t *rn, int *r_nouid)
+{
+  const char *name;
   unsigned int namelen;
 
   if (r_nouid)
     *r_nouid = 0;
 
-  name = cache_get_uid_bykid (keyid, &namelen);
+  name = cache_ref_uid_bykid (keyid, &namelen);
   if (!name)
     {
       /* Get it so that the cache will be filled.  */
       if (!get_pubkey (ctrl, NULL, keyid))
-        name = cache_get_uid_bykid (keyid, &namelen);
+        name = cache_ref_uid_bykid (keyid, &namelen);
     }
 
   if (!name)
     {
-      name = xstrdup (user_id_not_found_utf8 ());
+      name = user_id_not_found_utf8 ();
       namelen = strlen (name);
       if (r_nouid)
         *r_nouid = 1;
     }
 
-  if (rn && name)
+  if (rn)
     *rn = namelen;
   return name;
 }
 
 
+/* Release the user id NAME returned by get_user_id_ref.  */
+void
+release_user_id_ref (const char *name)
+{
+  if (name && name != user_id_not_found_utf8 ())
+    cache_unref_uid (name);
+}
+
+
 /* Please try to use get_user_id_byfpr_native instead of this one.  */
 char *
 get_user_id_native (ctrl_t ctrl, u32 *keyid)
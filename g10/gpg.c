@@ -235,6 +235,7 @@ enum cmd_and_opt_values
     oDebugSetIobufSize,
     oDebugAllowLargeChunks,
     oDebugIgnoreExpiration,
+    oDebugVerifyTrustdb,
     oStatusFD,
     oStatusFile,
     oAttributeFD,
@@ -244,6 +245,7 @@ enum cmd_and_opt_values
     oCompletesNeeded,
     oMarginalsNeeded,
     oMaxCertDepth,
+    oTrustDBThreads,
     oLoadExtension,
     oCompliance,
     oGnuPG,
@@ -332,6 +334,7 @@ enum cmd_and_opt_values
     oExportFilter,
     oListOptions,
     oListFilter,
+    oKeylistThreads,
     oVerifyOptions,
     oTempDir,
     oExecPath,
@@ -381,6 +384,7 @@ enum cmd_and_opt_values
     oFixedListMode,
     oLegacyListMode,
     oNoSigCache,
+    oPKCacheSize,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -705,6 +709,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oCompletesNeeded, "completes-needed", "@"),
   ARGPARSE_s_i (oMarginalsNeeded, "marginals-needed", "@"),
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
+  ARGPARSE_s_i (oTrustDBThreads, "trustdb-threads", "@"),
 #ifndef NO_TRUST_MODELS
   ARGPARSE_s_s (oTrustDBName, "trustdb-name", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
@@ -806,6 +811,7 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_s_s (oListOptions,   "list-options", "@"),
   ARGPARSE_s_s (oListFilter,    "list-filter", "@"),
+  ARGPARSE_s_i (oKeylistThreads, "keylist-threads", "@"),
   ARGPARSE_s_n (oFullTimestrings, "full-timestrings", "@"),
   ARGPARSE_s_n (oShowPhotos,   "show-photos", "@"),
   ARGPARSE_s_n (oNoShowPhotos, "no-show-photos", "@"),
@@ -879,6 +885,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oEnableSpecialFilenames, "enable-special-filenames", "@"),
   ARGPARSE_s_n (oNoRandomSeedFile,  "no-random-seed-file", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_u (oPKCacheSize,        "pk-cache-size", "@"),
   ARGPARSE_s_n (oIgnoreTimeConflict, "ignore-time-conflict", "@"),
   ARGPARSE_s_n (oIgnoreValidFrom,    "ignore-valid-from", "@"),
   ARGPARSE_s_n (oIgnoreCrcError, "ignore-crc-error", "@"),
@@ -933,6 +940,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_p_u (oKbxBufferSize,  "kbx-buffer-size", "@"),
   ARGPARSE_s_n (oQuickRandom, "debug-quick-random", "@"),
   ARGPARSE_s_n (oDebugIgnoreExpiration,  "debug-ignore-expiration", "@"),
+  ARGPARSE_s_n (oDebugVerifyTrustdb,     "debug-verify-trustdb", "@"),
 
   ARGPARSE_header (NULL, ""),  /* Stop the header group.  */
 
@@ -2340,6 +2348,7 @@ gpg_deinit_default_ctrl (ctrl_t ctrl)
   gpg_dirmngr_deinit_session_data (ctrl);
 
   keydb_release (ctrl->cached_getkey_kdb);
+  release_prefetched_session_keys (ctrl);
   gpg_keyboxd_deinit_session_data (ctrl);
   xfree (ctrl->secret_keygrips);
   ctrl->secret_keygrips = NULL;
@@ -2860,6 +2869,10 @@ main (int argc, char **argv)
             opt.ignore_expiration = 1;
             break;
 
+          case oDebugVerifyTrustdb:
+            opt.verify_trustdb = 1;
+            break;
+
           case oCompatibilityFlags:
             if (parse_compatibility_flags (pargs.r.ret_str, &opt.compat_flags,
                                            compatibility_flags))
@@ -2954,6 +2967,7 @@ main (int argc, char **argv)
 	  case oCompletesNeeded: opt.completes_needed = pargs.r.ret_int; break;
 	  case oMarginalsNeeded: opt.marginals_needed = pargs.r.ret_int; break;
 	  case oMaxCertDepth: opt.max_cert_depth = pargs.r.ret_int; break;
+          case oTrustDBThreads: opt.trustdb_threads = pargs.r.ret_int; break;
 
 #ifndef NO_TRUST_MODELS
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
@@ -3406,6 +3420,7 @@ main (int argc, char **argv)
 	    if (rc)
               log_error (_("invalid filter option: %s\n"), gpg_strerror (rc));
 	    break;
+          case oKeylistThreads: opt.keylist_threads = pargs.r.ret_int; break;
 	  case oListOptions:
 	    if(!parse_list_options(pargs.r.ret_str))
 	      {
@@ -3502,6 +3517,7 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oPKCacheSize: getkey_set_pk_cache_size (pargs.r.ret_ulong); break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -4003,6 +4019,10 @@ main (int argc, char **argv)
       log_error(_("marginals-needed must be greater than 1\n"));
     if( opt.max_cert_depth < 1 || opt.max_cert_depth > 255 )
       log_error(_("max-cert-depth must be in the range from 1 to 255\n"));
+    if (opt.trustdb_threads < 0 || opt.trustdb_threads > 64)
+      log_error (_("trustdb-threads must be in the range from 0 to 64\n"));
+    if (opt.keylist_threads < 0 || opt.keylist_threads > 64)
+      log_error (_("keylist-threads must be in the range from 0 to 64\n"));
     if(opt.def_cert_level<0 || opt.def_cert_level>3)
       log_error(_("invalid default-cert-level; must be 0, 1, 2, or 3\n"));
     if( opt.min_cert_level < 1 || opt.min_cert_level > 3 )
@@ -4058,7 +4078,7 @@ main (int argc, char **argv)
 	switch(cmd)
 	  {
 	  case aSign:
-	    cmdname="--sign";
+	    cmdname = detached_sig? NULL : "--sign";
 	    break;
 	  case aSignEncr:
 	    cmdname="--sign --encrypt";
@@ -4446,6 +4466,11 @@ main (int argc, char **argv)
 	break;
 
       case aSign: /* sign the given file */
+	if (multifile && detached_sig)
+	  {
+	    sign_files_detached (ctrl, argc, argv, locusr);
+	    break;
+	  }
 	sl = NULL;
 	if( detached_sig ) { /* sign all files */
 	    for( ; argc; argc--, argv++ )
@@ -5475,6 +5500,7 @@ g10_exit( int rc )
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
+      getkey_dump_stats ();
       sig_check_dump_stats ();
       objcache_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
@@ -2241,7 +2241,7 @@ import_one_real (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
 
       /* Release the handle and thus unlock the keyring asap.  */
@@ -2334,7 +2334,7 @@ import_one_real (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (err));
           else if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
 
           /* Release the handle and thus unlock the keyring asap.  */
           keydb_release (hd);
@@ -3651,7 +3651,7 @@ import_revoke_cert (ctrl_t ctrl, kbnode_t node, unsigned int options,
       if (get_ownertrust (ctrl, pk) == TRUST_ULTIMATE)
         clear_ownertrusts (ctrl, pk);
 
-      revalidation_mark (ctrl);
+      revalidation_mark_key (ctrl, pk);
     }
   stats->n_revoc++;
 
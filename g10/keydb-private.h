@@ -59,7 +59,9 @@ struct resource_item
  * successful fingerprint search.  This works only for keybox
  * resources because (due to lack of a copy_keyblock function) we need
  * to store an image of the keyblock which is fortunately instantly
- * available for keyboxes.   Only used in non-keyboxd mode.  */
+ * available for keyboxes.   Only used in non-keyboxd mode.  The
+ * images are also kept in a process wide cache so that the result
+ * can be used by other handles (see keyblock_cache_lookup).  */
 enum keyblock_cache_states {
   KEYBLOCK_CACHE_EMPTY,
   KEYBLOCK_CACHE_PREPARED,
@@ -76,6 +78,9 @@ struct keyblock_cache {
   /* Offset of the record in the keybox.  */
   int resource;
   off_t offset;
+  /* Set if the entry has been taken from the process wide cache; the
+   * keybox itself has then not selected the record.  */
+  int shared;
 };
 
 
@@ -107,6 +112,13 @@ struct keydb_handle_s
   int last_uid_no;
   int last_pk_no;
 
+  /* If the current search is answered from prefetched results (see
+   * keydb_prefetch) this holds a reference to them, the item for the
+   * search pattern, and the index of the next result to return.  */
+  keydb_prefetch_t pf;
+  struct keydb_prefetch_item_s *pf_item;
+  unsigned int pf_next;
+
   /* END USE_KEYBOXD */
 
   /* BEGIN !USE_KEYBOXD */
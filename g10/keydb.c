@@ -103,6 +103,50 @@ struct
 } keydb_stats;
 
 
+/* The process wide cache of keyblock images.  This extends the per
+   handle keyblock cache so that alternating lookups for a few keys
+   (e.g. the signer and several recipients) can be answered without
+   scanning the keybox again.  The items are kept in most recently
+   used order and the total size of the images is limited to
+   KEYBLOCK_CACHE_MEMLIMIT.  The entire cache is flushed whenever a
+   keyblock is inserted, updated, or deleted.  */
+#define KEYBLOCK_CACHE_MEMLIMIT (4 * 1024 * 1024)
+
+struct keyblock_cache_item_s
+{
+  struct keyblock_cache_item_s *next;
+  struct keyblock_cache_item_s *prev;
+  void *token;          /* Token of the resource.  */
+  int resource;         /* Index of the resource.  */
+  off_t offset;         /* Offset of the last byte of the record.  */
+  byte fpr[MAX_FINGERPRINT_LEN]; /* The fingerprint used to find it.  */
+  byte fprlen;
+  int pk_no;
+  int uid_no;
+  /* Inode, size and modification time of the resource file at the
+     time the item was stored.  Used to detect changes done by other
+     processes.  */
+  ino_t ino;
+  off_t filesize;
+  time_t mtime;
+  size_t imagelen;      /* Length of IMAGE.  */
+  char image[1];        /* The keyblock image.  */
+};
+/* The items in LRU order; the most recently used item comes first.  */
+static struct keyblock_cache_item_s *keyblock_cache_items;
+static struct keyblock_cache_item_s *keyblock_cache_tail;
+
+struct
+{
+  unsigned int count;   /* The current number of items.  */
+  size_t memused;       /* The sum of the image lengths.  */
+  unsigned int hits;    /* Number of lookups answered from the cache.  */
+  unsigned int misses;  /* Number of failed lookups.  */
+  unsigned int evicted; /* Number of items evicted due to the limit.  */
+  unsigned int flushes; /* The number of flushes.  */
+} keyblock_cache_stats;
+
+
 static int lock_all (KEYDB_HANDLE hd);
 static void unlock_all (KEYDB_HANDLE hd);
 
@@ -199,6 +243,229 @@ keyblock_cache_clear (struct keydb_handle_s *hd)
   hd->keyblock_cache.iobuf = NULL;
   hd->keyblock_cache.resource = -1;
   hd->keyblock_cache.offset = -1;
+  hd->keyblock_cache.shared = 0;
+}
+
+
+/* Flush the process wide keyblock cache.  */
+static void
+keyblock_cache_flush (void)
+{
+  struct keyblock_cache_item_s *item, *item_next;
+
+  if (!keyblock_cache_items)
+    return;
+
+  if (DBG_CACHE)
+    log_debug ("keydb: keyblock_cache_flush\n");
+
+  for (item = keyblock_cache_items; item; item = item_next)
+    {
+      item_next = item->next;
+      xfree (item);
+    }
+  keyblock_cache_items = NULL;
+  keyblock_cache_tail = NULL;
+  keyblock_cache_stats.count = 0;
+  keyblock_cache_stats.memused = 0;
+  keyblock_cache_stats.flushes++;
+}
+
+
+/* Stat the file of the resource with index RESOURCE of HD.  Returns
+   false on error.  */
+static int
+keyblock_cache_stat (KEYDB_HANDLE hd, int resource, struct stat *r_st)
+{
+  const char *fname;
+
+  fname = keybox_get_resource_name (hd->active[resource].u.kb);
+  return fname && !gnupg_stat (fname, r_st);
+}
+
+
+/* Unlink ITEM from the process wide keyblock cache.  */
+static void
+keyblock_cache_unlink (struct keyblock_cache_item_s *item)
+{
+  if (item->prev)
+    item->prev->next = item->next;
+  else
+    keyblock_cache_items = item->next;
+  if (item->next)
+    item->next->prev = item->prev;
+  else
+    keyblock_cache_tail = item->prev;
+  item->next = item->prev = NULL;
+}
+
+
+/* Link ITEM to the front of the process wide keyblock cache.  */
+static void
+keyblock_cache_link (struct keyblock_cache_item_s *item)
+{
+  item->prev = NULL;
+  item->next = keyblock_cache_items;
+  if (keyblock_cache_items)
+    keyblock_cache_items->prev = item;
+  else
+    keyblock_cache_tail = item;
+  keyblock_cache_items = item;
+}
+
+
+/* Store the keyblock cached by HD into the process wide cache.  HD
+   must have its keyblock cache filled.  */
+static void
+keyblock_cache_put (KEYDB_HANDLE hd)
+{
+  struct keyblock_cache_item_s *item;
+  iobuf_t iobuf = hd->keyblock_cache.iobuf;
+  size_t imagelen;
+  struct stat st;
+
+  log_assert (hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED);
+
+  imagelen = iobuf_get_temp_length (iobuf);
+  if (imagelen > KEYBLOCK_CACHE_MEMLIMIT / 4)
+    return;  /* Too large to be worth caching.  */
+
+  if (!keyblock_cache_stat (hd, hd->keyblock_cache.resource, &st))
+    return;
+
+  for (item = keyblock_cache_items; item; item = item->next)
+    if (item->token == hd->active[hd->keyblock_cache.resource].token
+        && item->offset == hd->keyblock_cache.offset
+        && item->fprlen == hd->keyblock_cache.fprlen
+        && !memcmp (item->fpr, hd->keyblock_cache.fpr, item->fprlen))
+      return;  /* Already cached.  */
+
+  item = xtrymalloc (sizeof *item + imagelen);
+  if (!item)
+    return;  /* Out of core - ignore.  */
+  item->token = hd->active[hd->keyblock_cache.resource].token;
+  item->resource = hd->keyblock_cache.resource;
+  item->offset = hd->keyblock_cache.offset;
+  memcpy (item->fpr, hd->keyblock_cache.fpr, hd->keyblock_cache.fprlen);
+  item->fprlen = hd->keyblock_cache.fprlen;
+  item->pk_no = hd->keyblock_cache.pk_no;
+  item->uid_no = hd->keyblock_cache.uid_no;
+  item->ino = st.st_ino;
+  item->filesize = st.st_size;
+  item->mtime = st.st_mtime;
+  item->imagelen = imagelen;
+  memcpy (item->image, iobuf_get_temp_buffer (iobuf), imagelen);
+
+  keyblock_cache_link (item);
+  keyblock_cache_stats.count++;
+  keyblock_cache_stats.memused += imagelen;
+
+  /* Evict the least recently used items to stay within the limit.  */
+  while (keyblock_cache_stats.memused > KEYBLOCK_CACHE_MEMLIMIT
+         && keyblock_cache_items->next)
+    {
+      item = keyblock_cache_tail;
+      keyblock_cache_unlink (item);
+      keyblock_cache_stats.count--;
+      keyblock_cache_stats.memused -= item->imagelen;
+      keyblock_cache_stats.evicted++;
+      xfree (item);
+    }
+}
+
+
+/* Try to answer a search for the fingerprint (FPR,FPRLEN) on HD from
+   the process wide keyblock cache.  Only items located at or after
+   the current file position of HD are considered.  Another process
+   may have changed the resource file; thus the cache is flushed if
+   the file does not match the one the item was read from.  On
+   success the keyblock cache of HD is filled and true is returned.  */
+static int
+keyblock_cache_lookup (KEYDB_HANDLE hd, const byte *fpr, int fprlen)
+{
+  struct keyblock_cache_item_s *item;
+  struct stat st;
+
+  for (item = keyblock_cache_items; item; item = item->next)
+    if (item->fprlen == fprlen
+        && !memcmp (item->fpr, fpr, fprlen)
+        && item->resource < hd->used
+        && item->token == hd->active[item->resource].token
+        && hd->active[item->resource].type == KEYDB_RESOURCE_TYPE_KEYBOX
+        /* Make sure the current file position occurs before the
+           cached result to avoid an infinite loop.  */
+        && (hd->current < item->resource
+            || (hd->current == item->resource
+                && (keybox_offset (hd->active[hd->current].u.kb)
+                    <= item->offset))))
+      break;
+  if (!item)
+    {
+      keyblock_cache_stats.misses++;
+      return 0;
+    }
+
+  if (!keyblock_cache_stat (hd, item->resource, &st)
+      || st.st_ino != item->ino
+      || st.st_size != item->filesize
+      || st.st_mtime != item->mtime)
+    {
+      keyblock_cache_flush ();
+      keyblock_cache_stats.misses++;
+      return 0;
+    }
+
+  /* Move to the front.  */
+  if (item->prev)
+    {
+      keyblock_cache_unlink (item);
+      keyblock_cache_link (item);
+    }
+
+  keyblock_cache_clear (hd);
+  hd->keyblock_cache.iobuf = iobuf_temp_with_content (item->image,
+                                                      item->imagelen);
+  hd->keyblock_cache.state = KEYBLOCK_CACHE_FILLED;
+  hd->keyblock_cache.pk_no = item->pk_no;
+  hd->keyblock_cache.uid_no = item->uid_no;
+  hd->keyblock_cache.resource = item->resource;
+  hd->keyblock_cache.offset = item->offset;
+  memcpy (hd->keyblock_cache.fpr, fpr, fprlen);
+  hd->keyblock_cache.fprlen = fprlen;
+  hd->keyblock_cache.shared = 1;
+  keyblock_cache_stats.hits++;
+  return 1;
+}
+
+
+/* If the current search result of HD has been taken from the process
+   wide keyblock cache, the keybox has not selected the record.  In
+   this case repeat the search without the cache so that operations
+   acting on the selected record work as expected.  */
+static gpg_error_t
+keyblock_cache_resync (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC desc;
+  int save_no_caching;
+
+  if (hd->use_keyboxd
+      || hd->keyblock_cache.state != KEYBLOCK_CACHE_FILLED
+      || !hd->keyblock_cache.shared)
+    return 0;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  desc.fprlen = hd->keyblock_cache.fprlen;
+  memcpy (desc.u.fpr, hd->keyblock_cache.fpr, desc.fprlen);
+
+  save_no_caching = hd->no_caching;
+  hd->no_caching = 1;
+  err = internal_keydb_search_reset (hd);
+  if (!err)
+    err = internal_keydb_search (hd, &desc, 1, NULL);
+  hd->no_caching = save_no_caching;
+  return err;
 }
 
 
@@ -825,6 +1092,14 @@ keydb_dump_stats (void)
             keydb_stats.notfound,
             keydb_stats.found_cached,
             keydb_stats.notfound_cached);
+  log_info ("keyblock_cache: count=%u mem=%lu hits=%u misses=%u"
+            " evicted=%u flushes=%u\n",
+            keyblock_cache_stats.count,
+            (unsigned long)keyblock_cache_stats.memused,
+            keyblock_cache_stats.hits,
+            keyblock_cache_stats.misses,
+            keyblock_cache_stats.evicted,
+            keyblock_cache_stats.flushes);
   log_info ("kid_not_found_cache: count=%u peak=%u flushes=%u\n",
             kid_not_found_stats.count,
             kid_not_found_stats.peak,
@@ -1102,6 +1377,9 @@ keydb_push_found_state (KEYDB_HANDLE hd)
   if (!hd)
     return;
 
+  if (keyblock_cache_resync (hd))
+    hd->found = -1;
+
   if (hd->found < 0 || hd->found >= hd->used)
     {
       hd->saved_found = -1;
@@ -1359,6 +1637,7 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
                 hd->keyblock_cache.iobuf     = iobuf;
                 hd->keyblock_cache.pk_no     = pk_no;
                 hd->keyblock_cache.uid_no    = uid_no;
+                keyblock_cache_put (hd);
               }
             else
               {
@@ -1407,6 +1686,7 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   pk = kb->pkt->pkt.public_key;
 
   kid_not_found_flush ();
+  keyblock_cache_flush ();
   keyblock_cache_clear (hd);
 
   if (opt.dry_run)
@@ -1488,6 +1768,7 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   log_assert (!hd->use_keyboxd);
 
   kid_not_found_flush ();
+  keyblock_cache_flush ();
   keyblock_cache_clear (hd);
 
   if (opt.dry_run)
@@ -1551,7 +1832,13 @@ internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
 
   log_assert (!hd->use_keyboxd);
 
+  /* Make sure the keybox has the record selected before we flush the
+   * caches.  */
+  if (keyblock_cache_resync (hd))
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
   kid_not_found_flush ();
+  keyblock_cache_flush ();
   keyblock_cache_clear (hd);
 
   if (hd->found < 0 || hd->found >= hd->used)
@@ -1790,21 +2077,24 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   if (!hd->no_caching
       && ndesc == 1
       && fprlen
-      && hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED
-      && hd->keyblock_cache.fprlen == fprlen
-      && !memcmp (hd->keyblock_cache.fpr, desc[0].u.fpr, fprlen)
-      /* Make sure the current file position occurs before the cached
-         result to avoid an infinite loop.  */
-      && (hd->current < hd->keyblock_cache.resource
-          || (hd->current == hd->keyblock_cache.resource
-              && (keybox_offset (hd->active[hd->current].u.kb)
-                  <= hd->keyblock_cache.offset))))
+      && ((hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED
+           && hd->keyblock_cache.fprlen == fprlen
+           && !memcmp (hd->keyblock_cache.fpr, desc[0].u.fpr, fprlen)
+           /* Make sure the current file position occurs before the
+              cached result to avoid an infinite loop.  */
+           && (hd->current < hd->keyblock_cache.resource
+               || (hd->current == hd->keyblock_cache.resource
+                   && (keybox_offset (hd->active[hd->current].u.kb)
+                       <= hd->keyblock_cache.offset))))
+          || keyblock_cache_lookup (hd, desc[0].u.fpr, fprlen)))
     {
       /* (DESCINDEX is already set).  */
       if (DBG_CLOCK)
         log_clock ("%s leave (cached)", __func__);
 
       hd->current = hd->keyblock_cache.resource;
+      hd->found = hd->current;
+      hd->is_reset = 0;
       /* HD->KEYBLOCK_CACHE.OFFSET is the last byte in the record.
          Seek just beyond that.  */
       keybox_seek (hd->active[hd->current].u.kb, hd->keyblock_cache.offset + 1);
@@ -204,6 +204,13 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Look up all keys matching DESC in one batch for use by keydb_search.  */
+gpg_error_t keydb_prefetch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc,
+                            size_t ndesc);
+
+/* Release the results of keydb_prefetch.  */
+void keydb_prefetch_release (ctrl_t ctrl);
+
 
 
 /*-- keydb.c --*/
@@ -329,6 +336,15 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Set the size of the public key cache.  */
+void getkey_set_pk_cache_size (unsigned int n);
+
+/* Remove the entries for not existing keys from the cache.  */
+void getkey_flush_negative_cache (void);
+
+/* Print statistics of the public key cache.  */
+void getkey_dump_stats (void);
+
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
                                 PKT_public_key *pk, PKT_signature *sig,
@@ -475,6 +491,9 @@ unsigned int parse_key_usage (PKT_signature *sig);
 char *get_user_id_string_native (ctrl_t ctrl, u32 *keyid);
 char *get_long_user_id_string (ctrl_t ctrl, u32 *keyid);
 char *get_user_id (ctrl_t ctrl, u32 *keyid, size_t *rn, int *r_nouid);
+const char *get_user_id_ref (ctrl_t ctrl, u32 *keyid, size_t *rn,
+                             int *r_nouid);
+void release_user_id_ref (const char *name);
 char *get_user_id_native (ctrl_t ctrl, u32 *keyid);
 char *get_user_id_byfpr_native (ctrl_t ctrl, const byte *fpr, size_t fprlen);
 
@@ -733,6 +733,61 @@ print_signature_stats (struct keylist_context *s)
 }
 
 
+/* The number of keyblocks list_all reads at once if
+   opt.keylist_threads is used.  */
+#define LIST_BATCH_SIZE 64
+
+/* A keyblock read by list_all.  */
+struct list_batch_item
+{
+  kbnode_t keyblock;
+  const char *resname;
+  int any_secret;
+};
+
+
+/* Verify the self-signatures of the keyblocks in BATCH using
+   opt.keylist_threads threads.  The results are cached in the
+   signature packets and later picked up by merge_keys_and_selfsig.  */
+static void
+check_batch_selfsigs (ctrl_t ctrl, struct list_batch_item *batch, int nbatch)
+{
+  struct key_sig_ref_s *items;
+  size_t nitems = 0;
+  kbnode_t node;
+  u32 kid[2];
+  int i;
+
+  for (i = 0; i < nbatch; i++)
+    for (node = batch[i].keyblock; node; node = node->next)
+      if (node->pkt->pkttype == PKT_SIGNATURE)
+        nitems++;
+  if (!nitems)
+    return;
+  items = xtrycalloc (nitems, sizeof *items);
+  if (!items)
+    return;  /* Fall back to the regular checks.  */
+
+  nitems = 0;
+  for (i = 0; i < nbatch; i++)
+    {
+      keyid_from_pk (batch[i].keyblock->pkt->pkt.public_key, kid);
+      for (node = batch[i].keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_SIGNATURE
+            && node->pkt->pkt.signature->keyid[0] == kid[0]
+            && node->pkt->pkt.signature->keyid[1] == kid[1])
+          {
+            items[nitems].root = batch[i].keyblock;
+            items[nitems].node = node;
+            nitems++;
+          }
+    }
+
+  check_key_signatures_parallel (ctrl, items, nitems, opt.keylist_threads);
+  xfree (items);
+}
+
+
 /* List all keys.  If SECRET is true only secret keys are listed.  If
    MARK_SECRET is true secret keys are indicated in a public key
    listing.  */
@@ -745,6 +800,9 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
   int any_secret;
   const char *lastresname, *resname;
   struct keylist_context listctx;
+  struct list_batch_item *batch = NULL;
+  int batchsize, nbatch = 0;
+  int i;
 
   memset (&listctx, 0, sizeof (listctx));
   if (opt.check_sigs)
@@ -762,53 +820,88 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
       goto leave;
     }
 
+  /* With several threads the keyblocks are read in batches so that
+   * the self-signatures of a batch can be verified in parallel.  The
+   * keyblocks are then merged and listed in keyring order.  */
+  batchsize = opt.keylist_threads > 1? LIST_BATCH_SIZE : 1;
+  batch = xtrycalloc (batchsize, sizeof *batch);
+  if (!batch)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error ("error allocating memory: %s\n", gpg_strerror (rc));
+      goto leave;
+    }
+
   lastresname = NULL;
-  do
+  while (!rc)
     {
-      if (secret)
-        glo_ctrl.silence_parse_warnings++;
-      rc = keydb_get_keyblock (hd, &keyblock);
-      if (secret)
-        glo_ctrl.silence_parse_warnings--;
-      if (rc)
-	{
-          if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
-            continue;  /* Skip legacy keys.  */
-	  log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
-	  goto leave;
-	}
+      do
+        {
+          if (secret)
+            glo_ctrl.silence_parse_warnings++;
+          rc = keydb_get_keyblock (hd, &keyblock);
+          if (secret)
+            glo_ctrl.silence_parse_warnings--;
+          if (rc)
+            {
+              if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
+                continue;  /* Skip legacy keys.  */
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (rc));
+              goto leave;
+            }
 
-      if (secret || mark_secret)
-        any_secret = !agent_probe_any_secret_key (ctrl, keyblock);
-      else
-        any_secret = 0;
+          if (secret || mark_secret)
+            any_secret = !agent_probe_any_secret_key (ctrl, keyblock);
+          else
+            any_secret = 0;
 
-      if (secret && !any_secret)
-        ; /* Secret key listing requested but this isn't one.  */
-      else
+          if (secret && !any_secret)
+            release_kbnode (keyblock); /* Secret key listing requested
+                                        * but this isn't one.  */
+          else
+            {
+              batch[nbatch].keyblock = keyblock;
+              batch[nbatch].resname = keydb_get_resource_name (hd);
+              batch[nbatch].any_secret = any_secret;
+              nbatch++;
+            }
+          keyblock = NULL;
+        }
+      while (nbatch < batchsize && !(rc = keydb_search_next (hd)));
+
+      if (nbatch > 1)
+        check_batch_selfsigs (ctrl, batch, nbatch);
+
+      for (i = 0; i < nbatch; i++)
         {
+          keyblock = batch[i].keyblock;
+          batch[i].keyblock = NULL;
           if (!opt.with_colons && !(opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
             {
-              resname = keydb_get_resource_name (hd);
+              resname = batch[i].resname;
               if (lastresname != resname)
                 {
-                  int i;
+                  int n;
 
                   es_fprintf (es_stdout, "%s\n", resname);
-                  for (i = strlen (resname); i; i--)
+                  for (n = strlen (resname); n; n--)
                     es_putc ('-', es_stdout);
                   es_putc ('\n', es_stdout);
                   lastresname = resname;
                 }
             }
           merge_keys_and_selfsig (ctrl, keyblock);
-          list_keyblock (ctrl, keyblock, secret, any_secret, opt.fingerprint,
-                         &listctx);
+          list_keyblock (ctrl, keyblock, secret, batch[i].any_secret,
+                         opt.fingerprint, &listctx);
+          release_kbnode (keyblock);
+          keyblock = NULL;
         }
-      release_kbnode (keyblock);
-      keyblock = NULL;
+      nbatch = 0;
+
+      if (!rc)
+        rc = keydb_search_next (hd);
     }
-  while (!(rc = keydb_search_next (hd)));
   es_fflush (es_stdout);
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
@@ -822,6 +915,9 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
     print_signature_stats (&listctx);
 
  leave:
+  for (i = 0; i < nbatch; i++)
+    release_kbnode (batch[i].keyblock);
+  xfree (batch);
   keylist_context_release (&listctx);
   release_kbnode (keyblock);
   keydb_release (hd);
@@ -1326,9 +1422,9 @@ list_signature_print (ctrl_t ctrl, kbnode_t keyblock, kbnode_t node,
           else if (!opt.fast_list_mode )
 	    {
 	      size_t n;
-	      char *p = get_user_id (ctrl, sig->keyid, &n, NULL);
+	      const char *p = get_user_id_ref (ctrl, sig->keyid, &n, NULL);
 	      print_utf8_buffer (es_stdout, p, n);
-	      xfree (p);
+	      release_user_id_ref (p);
 	    }
 	  es_putc ('\n', es_stdout);
 
@@ -2025,7 +2121,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  char *sigstr;
 	  size_t fplen;
 	  byte fparray[MAX_FINGERPRINT_LEN];
-          char *siguid;
+          const char *siguid;
           size_t siguidlen;
           char *issuer_fpr = NULL;
           char *reason_text = NULL;
@@ -2100,7 +2196,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  if (sigrc != '%' && sigrc != '?' && !opt.fast_list_mode)
             {
               int nouid;
-              siguid = get_user_id (ctrl, sig->keyid, &siguidlen, &nouid);
+              siguid = get_user_id_ref (ctrl, sig->keyid, &siguidlen, &nouid);
               if (!opt.check_sigs && nouid)
                 sigrc = '?';  /* No key in local keyring.  */
             }
@@ -2165,7 +2261,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  /* fixme: check or list other sigs here */
           xfree (reason_text);
           xfree (reason_comment);
-          xfree (siguid);
+          release_user_id_ref (siguid);
           xfree (issuer_fpr);
 	}
     }
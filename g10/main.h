@@ -256,6 +256,8 @@ int write_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, int throw_keyid,
 /*-- sign.c --*/
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+void sign_files_detached (ctrl_t ctrl, int nfiles, char **files,
+                          strlist_t locusr);
 int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
@@ -296,6 +298,19 @@ gpg_error_t check_signature_over_key_or_uid (ctrl_t ctrl,
                                              int *is_selfsig,
                                              PKT_public_key *ret_pk);
 
+/* A signature on a key for check_key_signatures_parallel.  */
+struct key_sig_ref_s
+{
+  kbnode_t root;  /* The keyblock.  */
+  kbnode_t node;  /* The signature node in ROOT.  */
+};
+
+/* Verify the signatures ITEMS on keyblocks in parallel and cache the
+   results in the signature packets.  */
+void check_key_signatures_parallel (ctrl_t ctrl,
+                                    struct key_sig_ref_s *items,
+                                    size_t nitems, int nthreads);
+
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (ctrl_t ctrl,
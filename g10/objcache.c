@@ -21,6 +21,7 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "gpg.h"
@@ -30,14 +31,27 @@
 #include "options.h"
 #include "objcache.h"
 
-/* Note that max value for uid_items is actually the threshold when
- * we start to look for items which can be removed.  */
+/* The initial number of buckets of the tables.  A table is grown by
+ * doubling the number of buckets as soon as the average number of
+ * items per bucket exceeds MAX_ITEMS_PER_BUCKET_AVG.  Note that the
+ * max values per bucket are actually the threshold when we start to
+ * look for items which can be removed; with growing tables this
+ * happens only due to a bad distribution or after the memory limit
+ * has been reached.  */
 #define NO_OF_UID_ITEM_BUCKETS    107
 #define MAX_UID_ITEMS_PER_BUCKET  20
 
 #define NO_OF_KEY_ITEM_BUCKETS    383
 #define MAX_KEY_ITEMS_PER_BUCKET  20
 
+#define MAX_ITEMS_PER_BUCKET_AVG  4
+
+/* The memory used by the cache is limited to about this number of
+ * bytes.  If the limit has been reached, the tables are not grown
+ * anymore and items are removed from a bucket before a new one is
+ * added.  */
+#define OBJCACHE_MEMLIMIT  (16 * 1024 * 1024)
+
 
 /* An object to store a user id.  This describes an item in the linked
  * lists of a bucket in hash table.  The reference count will
@@ -53,8 +67,10 @@ typedef struct uid_item_s
 static uid_item_t *uid_table; /* Hash table for with user ids.  */
 static size_t uid_table_size; /* Number of allocated buckets.   */
 static unsigned int uid_table_max;    /* Max. # of items in a bucket.  */
+static unsigned int uid_table_items;  /* # of items in the table.  */
 static unsigned int uid_table_added;  /* # of items added.   */
 static unsigned int uid_table_dropped;/* # of items dropped.  */
+static unsigned int uid_table_resized;/* # of times the table grew.  */
 
 
 /* An object to store properties of a key.  Note that this can be used
@@ -73,10 +89,20 @@ typedef struct key_item_s
 static key_item_t *key_table; /* Hash table with the keys.      */
 static size_t key_table_size; /* Number of allocated buckents.  */
 static unsigned int key_table_max;    /* Max. # of items in a bucket.  */
+static unsigned int key_table_items;  /* # of items in the table.  */
 static unsigned int key_table_added;  /* # of items added.   */
 static unsigned int key_table_dropped;/* # of items dropped.  */
+static unsigned int key_table_resized;/* # of times the table grew.  */
 static key_item_t key_item_attic;     /* List of freed items.  */
 
+/* The memory allocated for the tables and the items.  */
+static size_t objcache_memused;
+
+/* Number of user id lookups answered from the cache and the number
+ * of lookups which had to fall back to a key lookup.  */
+static unsigned int uid_lookup_hits;
+static unsigned int uid_lookup_misses;
+
 
 
 /* Dump stats.  */
@@ -113,10 +139,10 @@ objcache_dump_stats (void)
   for (attic=0, ki = key_item_attic; ki; ki = ki->next)
     attic++;
   log_info ("objcache: keys=%u/%u/%u chains=%u,%d..%d buckets=%zu/%u"
-            " attic=%u\n",
+            " attic=%u resized=%u\n",
             count, key_table_added, key_table_dropped,
             empty, minlen > 0? minlen : 0, maxlen,
-            key_table_size, key_table_max, attic);
+            key_table_size, key_table_max, attic, key_table_resized);
 
   count = empty = 0;
   minlen = -1;
@@ -139,10 +165,14 @@ objcache_dump_stats (void)
       else if (minlen == -1 || len < minlen)
         minlen = len;
     }
-  log_info ("objcache: uids=%u/%u/%u chains=%u,%d..%d buckets=%zu/%u\n",
+  log_info ("objcache: uids=%u/%u/%u chains=%u,%d..%d buckets=%zu/%u"
+            " resized=%u\n",
             count, uid_table_added, uid_table_dropped,
             empty, minlen > 0? minlen : 0, maxlen,
-            uid_table_size, uid_table_max);
+            uid_table_size, uid_table_max, uid_table_resized);
+  log_info ("objcache: lookups=%u/%u memory=%zu/%u\n",
+            uid_lookup_hits, uid_lookup_misses,
+            objcache_memused, (unsigned int)OBJCACHE_MEMLIMIT);
 }
 
 
@@ -180,6 +210,50 @@ uid_table_init (void)
   uid_table_size = NO_OF_UID_ITEM_BUCKETS;
   uid_table_max = MAX_UID_ITEMS_PER_BUCKET;
   uid_table = xcalloc (uid_table_size, sizeof *uid_table);
+  objcache_memused += uid_table_size * sizeof *uid_table;
+}
+
+
+/* Double the number of buckets of the uid table.  Nothing is done if
+ * this would exceed the memory limit or on an allocation error.  */
+static void
+uid_table_grow (void)
+{
+  uid_item_t *newtable, *oldtable, ui, ui_next;
+  size_t newsize, oldsize, idx;
+  unsigned int hash;
+
+  oldsize = uid_table_size;
+  newsize = 2 * oldsize;
+  if (objcache_memused + newsize * sizeof *newtable > OBJCACHE_MEMLIMIT)
+    return;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - continue with the old table.  */
+  if (uid_table_size != oldsize)
+    {
+      /* Another thread was faster.  */
+      xfree (newtable);
+      return;
+    }
+
+  /* No syscalls from here .. */
+  oldtable = uid_table;
+  uid_table = newtable;
+  uid_table_size = newsize;
+  for (idx = 0; idx < oldsize; idx++)
+    for (ui = oldtable[idx]; ui; ui = ui_next)
+      {
+        ui_next = ui->next;
+        hash = uid_table_hasher (ui->name, ui->namelen);
+        ui->next = uid_table[hash];
+        uid_table[hash] = ui;
+      }
+  /* ... to here */
+
+  xfree (oldtable);
+  objcache_memused += (newsize - oldsize) * sizeof *newtable;
+  uid_table_resized++;
 }
 
 
@@ -226,8 +300,18 @@ uid_table_put (const char *name, unsigned int namelen)
     if (ui->namelen == namelen && !memcmp (ui->name, name, namelen))
       return uid_item_ref (ui);  /* Found.  */
 
-  /* If the bucket is full remove all unrefed items.  */
-  if (count >= uid_table_max)
+  if (uid_table_items >= uid_table_size * MAX_ITEMS_PER_BUCKET_AVG)
+    {
+      uid_table_grow ();
+      hash = uid_table_hasher (name, namelen);
+      for (ui = uid_table[hash], count = 0; ui; ui = ui->next, count++)
+        ;
+    }
+
+  /* If the bucket is full or we reached the memory limit remove all
+   * unrefed items of the bucket.  */
+  if (count >= uid_table_max
+      || (count && objcache_memused > OBJCACHE_MEMLIMIT))
     {
       uid_item_t ui_next, ui_prev, list_head, drop_head;
 
@@ -260,20 +344,24 @@ uid_table_put (const char *name, unsigned int namelen)
       for (ui = drop_head; ui; ui = ui_next)
         {
           ui_next = ui->next;
+          objcache_memused -= sizeof *ui + ui->namelen;
           xfree (ui);
+          uid_table_items--;
           uid_table_dropped++;
         }
     }
 
-  count = uid_table_added + uid_table_dropped;
+  count = uid_table_added + uid_table_dropped + uid_table_resized;
   ui = xtrycalloc (1, sizeof *ui + namelen);
   if (!ui)
     return NULL;  /* Out of core.  */
-  if (count != uid_table_added + uid_table_dropped)
+  if (count != uid_table_added + uid_table_dropped + uid_table_resized)
     {
-      /* During the malloc another thread added an item.  Thus we need
-       * to check again.  */
+      /* During the malloc another thread added an item or resized
+       * the table.  Thus we need to check again.  */
       uid_item_t ui_new = ui;
+
+      hash = uid_table_hasher (name, namelen);
       for (ui = uid_table[hash]; ui; ui = ui->next)
         if (ui->namelen == namelen && !memcmp (ui->name, name, namelen))
           {
@@ -290,7 +378,9 @@ uid_table_put (const char *name, unsigned int namelen)
   ui->refcount = 1;
   ui->next = uid_table[hash];
   uid_table[hash] = ui;
+  uid_table_items++;
   uid_table_added++;
+  objcache_memused += sizeof *ui + namelen;
   return ui;
 }
 
@@ -320,6 +410,50 @@ key_table_init (void)
   key_table_size = NO_OF_KEY_ITEM_BUCKETS;
   key_table_max  = MAX_KEY_ITEMS_PER_BUCKET;
   key_table = xcalloc (key_table_size, sizeof *key_table);
+  objcache_memused += key_table_size * sizeof *key_table;
+}
+
+
+/* Double the number of buckets of the key table.  Nothing is done if
+ * this would exceed the memory limit or on an allocation error.  */
+static void
+key_table_grow (void)
+{
+  key_item_t *newtable, *oldtable, ki, ki_next;
+  size_t newsize, oldsize, idx;
+  unsigned int hash;
+
+  oldsize = key_table_size;
+  newsize = 2 * oldsize;
+  if (objcache_memused + newsize * sizeof *newtable > OBJCACHE_MEMLIMIT)
+    return;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - continue with the old table.  */
+  if (key_table_size != oldsize)
+    {
+      /* Another thread was faster.  */
+      xfree (newtable);
+      return;
+    }
+
+  /* No syscalls from here .. */
+  oldtable = key_table;
+  key_table = newtable;
+  key_table_size = newsize;
+  for (idx = 0; idx < oldsize; idx++)
+    for (ki = oldtable[idx]; ki; ki = ki_next)
+      {
+        ki_next = ki->next;
+        hash = key_table_hasher (ki->keyid);
+        ki->next = key_table[hash];
+        key_table[hash] = ki;
+      }
+  /* ... to here */
+
+  xfree (oldtable);
+  objcache_memused += (newsize - oldsize) * sizeof *newtable;
+  key_table_resized++;
 }
 
 
@@ -332,6 +466,7 @@ key_item_free (key_item_t ki)
   ki->ui = NULL;
   ki->next = key_item_attic;
   key_item_attic = ki;
+  key_table_items--;
 }
 
 
@@ -419,10 +554,20 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
     if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
       return ki;  /* Found  */
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= key_table_max)
+  if (key_table_items >= key_table_size * MAX_ITEMS_PER_BUCKET_AVG)
     {
-      key_item_t list_head, *list_tailp, ki_next;
+      key_table_grow ();
+      hash = key_table_hasher (keyid);
+      for (ki = key_table[hash], count=0; ki; ki = ki->next, count++)
+        ;
+    }
+
+  /* If the bucket is full or we reached the memory limit remove a
+   * couple of items. */
+  if (count >= key_table_max
+      || (count && objcache_memused > OBJCACHE_MEMLIMIT))
+    {
+      key_item_t list_head, ki_next;
       key_item_t *array;
       int narray, idx;
 
@@ -451,21 +596,21 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
         }
       log_assert (narray == count);
 
-      /* Sort the array and put half of it onto a new list.  */
+      /* Sort the array and put half of it back into the table.  The
+       * table may have been resized in the meantime and thus we
+       * compute the bucket for each item again.  */
       qsort (array, narray, sizeof *array, compare_key_items);
-      list_head = NULL;
-      list_tailp = &list_head;
+      hash = key_table_hasher (keyid);
+      list_head = key_table[hash];
+      key_table[hash] = NULL;
       for (idx=0; idx < narray/2; idx++)
         {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
+          ki = array[idx];
+          n = key_table_hasher (ki->keyid);
+          ki->next = key_table[n];
+          key_table[n] = ki;
         }
 
-      /* Put the new list into the bucket.  */
-      ki = key_table[hash];
-      key_table[hash] = list_head;
-      list_head = ki;
-
       /* Free the remaining items and the array.  */
       for (; idx < narray; idx++)
         {
@@ -501,9 +646,11 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
           ki->next = key_item_attic;
           key_item_attic = ki;
         }
+      objcache_memused += kiblocksize * sizeof *kiblock;
 
-      /* During the malloc another thread may have changed the bucket.
-       * Thus we need to check again.  */
+      /* During the malloc another thread may have changed the bucket
+       * or resized the table.  Thus we need to check again.  */
+      hash = key_table_hasher (keyid);
       for (ki = key_table[hash]; ki; ki = ki->next)
         if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
           return ki;  /* Found  */
@@ -522,6 +669,7 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
   ki->usecount = 0;
   ki->next = key_table[hash];
   key_table[hash] = ki;
+  key_table_items++;
   key_table_added++;
   return ki;
 }
@@ -622,7 +770,10 @@ cache_get_uid_bykid (u32 *keyid, unsigned int *r_length)
 
   ki = key_table_get (NULL, keyid);
   if (!ki)
-    return NULL; /* Not found or duplicate keyid.  */
+    {
+      uid_lookup_misses++;
+      return NULL; /* Not found or duplicate keyid.  */
+    }
 
   if (!ki->ui)
     p = NULL;  /* No user id known for key.  */
@@ -638,6 +789,10 @@ cache_get_uid_bykid (u32 *keyid, unsigned int *r_length)
         }
     }
 
+  if (p)
+    uid_lookup_hits++;
+  else
+    uid_lookup_misses++;
   return p;
 }
 
@@ -669,7 +824,10 @@ cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
       break; /* Found */
 
   if (!ki)
-    return NULL; /* Not found.  */
+    {
+      uid_lookup_misses++;
+      return NULL; /* Not found.  */
+    }
 
   if (!ki->ui)
     p = NULL;  /* No user id known for key.  */
@@ -685,5 +843,46 @@ cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
         }
     }
 
+  if (p)
+    uid_lookup_hits++;
+  else
+    uid_lookup_misses++;
   return p;
 }
+
+
+/* Return the interned user id string for KEYID.  Unlike
+ * cache_get_uid_bykid this does not copy the string but returns a
+ * reference to the cached item; this is useful to print the user ids
+ * of signers which are often the same for many signatures.  The
+ * returned string is nul terminated and its length is stored at
+ * R_LENGTH.  NULL is returned if a user id is not known.  The caller
+ * must release a non-NULL result using cache_unref_uid.  */
+const char *
+cache_ref_uid_bykid (u32 *keyid, unsigned int *r_length)
+{
+  key_item_t ki;
+
+  *r_length = 0;
+
+  ki = key_table_get (NULL, keyid);
+  if (!ki || !ki->ui)
+    {
+      uid_lookup_misses++;
+      return NULL; /* Not found, duplicate keyid, or no user id.  */
+    }
+
+  ki->usecount++;
+  uid_lookup_hits++;
+  *r_length = ki->ui->namelen;
+  return uid_item_ref (ki->ui)->name;
+}
+
+
+/* Release a user id string returned by cache_ref_uid_bykid.  */
+void
+cache_unref_uid (const char *name)
+{
+  if (name)
+    uid_item_unref ((uid_item_t)(name - offsetof (struct uid_item_s, name)));
+}
@@ -125,6 +125,7 @@ struct
   int marginals_needed;
   int completes_needed;
   int max_cert_depth;
+  int trustdb_threads;  /* Threads used to check the signatures.  */
   const char *agent_program;
   const char *keyboxd_program;
   const char *dirmngr_program;
@@ -179,6 +180,7 @@ struct
   unsigned int import_options;
   unsigned int export_options;
   unsigned int list_options;
+  int keylist_threads;  /* Threads used to check self-signatures.  */
   unsigned int verify_options;
   const char *def_preference_list;
   const char *def_keyserver_url;
@@ -209,6 +211,7 @@ struct
   int ignore_crc_error;
   int ignore_mdc_error;
   int ignore_expiration;
+  int verify_trustdb;   /* Compare incremental trustdb checks.  */
   int command_fd;
   const char *override_session_key;
   int show_session_key;
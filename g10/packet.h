@@ -222,6 +222,9 @@ typedef struct
     unsigned pref_ks:1;     /* At least one preferred keyserver is present */
     unsigned key_block:1;   /* A key block subpacket is present.  */
     unsigned expired:1;
+    unsigned backsig:2;     /* Cached status of the back signature of
+                               a chosen subkey binding signature:
+                               0=none, 1=bad, 2=good.  */
   } flags;
   /* The key that allegedly generated this signature.  (Directly
      serialized in v3 sigs; for v4 sigs, this must be explicitly added
@@ -919,6 +922,8 @@ gpg_error_t check_signature2 (ctrl_t ctrl,
 
 /*-- pubkey-enc.c --*/
 gpg_error_t get_session_key (ctrl_t ctrl, struct pubkey_enc_list *k, DEK *dek);
+void prefetch_session_keys (ctrl_t ctrl, char **fnames, int nfnames);
+void release_prefetched_session_keys (ctrl_t ctrl);
 gpg_error_t get_override_session_key (DEK *dek, const char *string);
 
 /*-- compress.c --*/
@@ -3377,6 +3377,8 @@ parse_ring_trust (parse_packet_ctx_t ctx, unsigned long pktlen)
         {
           sig->flags.checked = 1;
           sig->flags.valid = !!(rt.sigcache & 2);
+          if (sig->flags.valid && (rt.sigcache & 4))
+            sig->flags.backsig = (rt.sigcache & 8)? 2 : 1;
         }
     }
   else if (rt.subtype == RING_TRUST_UID
@@ -964,6 +964,47 @@ find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
 
 
 
+/* Look up the keys for all regular recipients in REMUSR with one
+ * request to the keyboxd so that the following per-recipient lookups
+ * don't each need a round trip.  Errors are not fatal because the
+ * regular lookup reports them anyway.  */
+static void
+prefetch_recipients (ctrl_t ctrl, strlist_t remusr)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC *desc;
+  strlist_t sl;
+  size_t n, ndesc;
+
+  if (!opt.use_keyboxd)
+    return;
+
+  for (n=0, sl = remusr; sl; sl = sl->next)
+    n++;
+  if (n < 2)
+    return;  /* Not worth the overhead.  */
+
+  desc = xtrycalloc (n, sizeof *desc);
+  if (!desc)
+    return;
+  for (ndesc=0, sl = remusr; sl; sl = sl->next)
+    {
+      if ((sl->flags & (PK_LIST_ENCRYPT_TO|PK_LIST_FROM_FILE)))
+        continue;
+      if (!classify_user_id (sl->d, desc + ndesc, 1))
+        ndesc++;
+    }
+  if (ndesc > 1)
+    {
+      err = keydb_prefetch (ctrl, desc, ndesc);
+      if (err)
+        log_info ("prefetching %zu recipient keys failed: %s\n",
+                  ndesc, gpg_strerror (err));
+    }
+  xfree (desc);
+}
+
+
 /* This is the central function to collect the keys for recipients.
  * It is thus used to prepare a public key encryption. encrypt-to
  * keys, default keys and the keys for the actual recipients are all
@@ -1338,6 +1379,7 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
     {
       /* General case: Check all keys. */
       any_recipients = 0;
+      prefetch_recipients (ctrl, remusr);
       for (; remusr; remusr = remusr->next )
         {
           if ( (remusr->flags & PK_LIST_ENCRYPT_TO) )
@@ -1384,6 +1426,7 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
 #endif /*USE_TOFU*/
 
  fail:
+  keydb_prefetch_release (ctrl);
 
   if ( rc )
     release_pk_list( pk_list );
@@ -40,6 +40,28 @@
 
 static gpg_error_t get_it (ctrl_t ctrl, struct pubkey_enc_list *k,
                            DEK *dek, PKT_public_key *sk, u32 *keyid);
+static int take_prefetched_frame (ctrl_t ctrl, const char *keygrip,
+                                  gcry_sexp_t s_data,
+                                  unsigned char **r_frame, size_t *r_nframe,
+                                  int *r_padding);
+
+
+/* A session key frame decrypted ahead of time by
+ * prefetch_session_keys.  */
+struct pkdecrypt_prefetch_s
+{
+  struct pkdecrypt_prefetch_s *next;
+  char keygrip[2*KEYGRIP_LEN+1];  /* The hexified keygrip.  */
+  unsigned char *ciphertext;      /* The ciphertext in canonical format.  */
+  size_t ciphertextlen;
+  unsigned char *frame;           /* The decrypted frame (secure memory).  */
+  size_t nframe;
+  int padding;
+};
+
+/* The maximum number of ciphertexts sent to the agent in one
+ * request.  This is the limit of the agent's PKDECRYPT --multi.  */
+#define MAX_PREFETCH_ITEMS 256
 
 
 /* Check that the given algo is mentioned in one of the valid user-ids. */
@@ -187,6 +209,47 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
 }
 
 
+/* Convert the encrypted session key DATA for the public key algorithm
+ * PUBKEY_ALGO to an S-expression and store it at R_SEXP.  */
+static gpg_error_t
+make_enc_val_sexp (int pubkey_algo, gcry_mpi_t *data, gcry_sexp_t *r_sexp)
+{
+  gpg_error_t err;
+
+  *r_sexp = NULL;
+
+  if (pubkey_algo == PUBKEY_ALGO_ELGAMAL
+      || pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
+    {
+      if (!data[0] || !data[1])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(elg(a%m)(b%m)))",
+                               data[0], data[1]);
+    }
+  else if (pubkey_algo == PUBKEY_ALGO_RSA
+           || pubkey_algo == PUBKEY_ALGO_RSA_E)
+    {
+      if (!data[0])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(rsa(a%m)))",
+                               data[0]);
+    }
+  else if (pubkey_algo == PUBKEY_ALGO_ECDH)
+    {
+      if (!data[0] || !data[1])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(ecdh(s%m)(e%m)))",
+                               data[1], data[0]);
+    }
+  else
+    err = gpg_error (GPG_ERR_BUG);
+  return err;
+}
+
+
 static gpg_error_t
 get_it (ctrl_t ctrl,
         struct pubkey_enc_list *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
@@ -211,47 +274,25 @@ get_it (ctrl_t ctrl,
     goto leave;
 
   /* Convert the data to an S-expression.  */
-  if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
-      || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
-    {
-      if (!enc->data[0] || !enc->data[1])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
-                               enc->data[0], enc->data[1]);
-    }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
-           || sk->pubkey_algo == PUBKEY_ALGO_RSA_E)
-    {
-      if (!enc->data[0])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
-                               enc->data[0]);
-    }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
-    {
-      if (!enc->data[0] || !enc->data[1])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
-                               enc->data[1], enc->data[0]);
-    }
-  else
-    err = gpg_error (GPG_ERR_BUG);
-
+  err = make_enc_val_sexp (sk->pubkey_algo, enc->data, &s_data);
   if (err)
     goto leave;
 
   if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
     fingerprint_from_pk (sk, fp, NULL);
 
-  /* Decrypt. */
-  desc = gpg_format_keydesc (ctrl, sk, FORMAT_KEYDESC_NORMAL, 1);
-  err = agent_pkdecrypt (NULL, keygrip,
-                         desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
-                         s_data, &frame, &nframe, &padding);
-  xfree (desc);
+  /* Decrypt.  Use a result from prefetch_session_keys if there is
+   * one.  */
+  if (!take_prefetched_frame (ctrl, keygrip, s_data,
+                              &frame, &nframe, &padding))
+    {
+      desc = gpg_format_keydesc (ctrl, sk, FORMAT_KEYDESC_NORMAL, 1);
+      err = agent_pkdecrypt (NULL, keygrip,
+                             desc, sk->keyid, sk->main_keyid,
+                             sk->pubkey_algo,
+                             s_data, &frame, &nframe, &padding);
+      xfree (desc);
+    }
   gcry_sexp_release (s_data);
   if (err)
     goto leave;
@@ -501,3 +542,292 @@ get_override_session_key (DEK *dek, const char *string)
   dek->keylen = i;
   return 0;
 }
+
+
+/* Release all frames prefetched for CTRL.  */
+void
+release_prefetched_session_keys (ctrl_t ctrl)
+{
+  pkdecrypt_prefetch_t pf, pfnext;
+
+  for (pf = ctrl->pkdecrypt_prefetch; pf; pf = pfnext)
+    {
+      pfnext = pf->next;
+      if (pf->frame)
+        wipememory (pf->frame, pf->nframe);
+      xfree (pf->frame);
+      xfree (pf->ciphertext);
+      xfree (pf);
+    }
+  ctrl->pkdecrypt_prefetch = NULL;
+}
+
+
+/* Look for a frame prefetched for the ciphertext S_DATA and the key
+ * KEYGRIP.  If one is found it is removed from the list and returned
+ * at R_FRAME, R_NFRAME and R_PADDING and true is returned.  */
+static int
+take_prefetched_frame (ctrl_t ctrl, const char *keygrip, gcry_sexp_t s_data,
+                       unsigned char **r_frame, size_t *r_nframe,
+                       int *r_padding)
+{
+  pkdecrypt_prefetch_t pf, pfprev;
+  unsigned char *ciphertext;
+  size_t ciphertextlen;
+
+  if (!ctrl->pkdecrypt_prefetch)
+    return 0;
+  if (make_canon_sexp (s_data, &ciphertext, &ciphertextlen))
+    return 0;
+
+  for (pfprev = NULL, pf = ctrl->pkdecrypt_prefetch; pf;
+       pfprev = pf, pf = pf->next)
+    if (pf->ciphertextlen == ciphertextlen
+        && !strcmp (pf->keygrip, keygrip)
+        && !memcmp (pf->ciphertext, ciphertext, ciphertextlen))
+      break;
+  xfree (ciphertext);
+  if (!pf)
+    return 0;
+
+  if (pfprev)
+    pfprev->next = pf->next;
+  else
+    ctrl->pkdecrypt_prefetch = pf->next;
+  *r_frame = pf->frame;
+  *r_nframe = pf->nframe;
+  *r_padding = pf->padding;
+  xfree (pf->ciphertext);
+  xfree (pf);
+  if (DBG_CLOCK)
+    log_clock ("using prefetched session key");
+  return 1;
+}
+
+
+/* A secret key looked up by prefetch_session_keys.  */
+struct prefetch_key_s
+{
+  u32 keyid[2];
+  PKT_public_key *sk;      /* NULL if there is no usable secret key.  */
+  char *keygrip;
+};
+
+
+/* Read the public key encrypted session key packets at the start of
+ * the message in the file FNAME and return the first one for which
+ * we have a usable secret key.  The secret key is looked up using
+ * the array KEYS of size NKEYS, which is extended as needed.  On
+ * success true is returned, the key's index is stored at R_KEYIDX
+ * and the ciphertext at R_DATA.  */
+static int
+find_prefetch_candidate (ctrl_t ctrl, const char *fname,
+                         struct prefetch_key_s **keys, int *nkeys,
+                         int *r_keyidx, gcry_sexp_t *r_data)
+{
+  iobuf_t fp;
+  struct parse_packet_ctx_s parsectx;
+  PACKET *pkt;
+  PKT_pubkey_enc *enc;
+  struct prefetch_key_s *tmpkeys;
+  int found = 0;
+  int i;
+
+  fp = iobuf_open (fname);
+  if (fp)
+    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+    }
+  if (!fp)
+    return 0;  /* The error will be shown by the actual decryption.  */
+
+  if (!opt.no_armor && use_armor_filter (fp))
+    {
+      armor_filter_context_t *afx = new_armor_context ();
+      push_armor_filter (afx, fp);
+      release_armor_context (afx);
+    }
+
+  pkt = xmalloc (sizeof *pkt);
+  init_packet (pkt);
+  init_parse_packet (&parsectx, fp);
+  while (!found && !parse_packet (&parsectx, pkt))
+    {
+      if (pkt->pkttype == PKT_MARKER || pkt->pkttype == PKT_SYMKEY_ENC)
+        {
+          free_packet (pkt, &parsectx);
+          continue;
+        }
+      if (pkt->pkttype != PKT_PUBKEY_ENC)
+        break;
+
+      enc = pkt->pkt.pubkey_enc;
+      if ((enc->keyid[0] || enc->keyid[1])
+          && !openpgp_pk_test_algo2 (enc->pubkey_algo, PUBKEY_USAGE_ENC))
+        {
+          for (i=0; i < *nkeys; i++)
+            if ((*keys)[i].keyid[0] == enc->keyid[0]
+                && (*keys)[i].keyid[1] == enc->keyid[1])
+              break;
+          if (i == *nkeys)
+            {
+              /* Not yet seen - look it up.  */
+              tmpkeys = xtryrealloc (*keys, (*nkeys + 1) * sizeof *tmpkeys);
+              if (!tmpkeys)
+                break;
+              *keys = tmpkeys;
+              memset (tmpkeys + i, 0, sizeof *tmpkeys);
+              tmpkeys[i].keyid[0] = enc->keyid[0];
+              tmpkeys[i].keyid[1] = enc->keyid[1];
+              (*nkeys)++;
+
+              tmpkeys[i].sk = xmalloc_clear (sizeof *tmpkeys[i].sk);
+              tmpkeys[i].sk->req_usage = PUBKEY_USAGE_ENC;
+              if (get_seckey (ctrl, tmpkeys[i].sk, enc->keyid)
+                  || !gnupg_pk_is_allowed (opt.compliance, PK_USE_DECRYPTION,
+                                           tmpkeys[i].sk->pubkey_algo, 0,
+                                           tmpkeys[i].sk->pkey,
+                                           nbits_from_pk (tmpkeys[i].sk),
+                                           NULL)
+                  || hexkeygrip_from_pk (tmpkeys[i].sk, &tmpkeys[i].keygrip))
+                {
+                  free_public_key (tmpkeys[i].sk);
+                  tmpkeys[i].sk = NULL;
+                }
+            }
+          if ((*keys)[i].sk
+              && (*keys)[i].sk->pubkey_algo == enc->pubkey_algo
+              && !make_enc_val_sexp (enc->pubkey_algo, enc->data, r_data))
+            {
+              *r_keyidx = i;
+              found = 1;
+            }
+        }
+      free_packet (pkt, &parsectx);
+    }
+  free_packet (pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  xfree (pkt);
+  iobuf_close (fp);
+  return found;
+}
+
+
+/* Decrypt the session keys of the NFNAMES messages in the files
+ * FNAMES ahead of time so that they are available when the messages
+ * are processed.  For each message only the first public key
+ * encrypted session key for which a secret key is available is
+ * considered.  The session keys for the same secret key are
+ * requested from the agent in one go so that the agent needs to
+ * unprotect the key only once.  Errors are not reported here; they
+ * show up again when the messages are actually decrypted.  Any
+ * frames not used by then should be released using
+ * release_prefetched_session_keys.  */
+void
+prefetch_session_keys (ctrl_t ctrl, char **fnames, int nfnames)
+{
+  gpg_error_t err;
+  struct prefetch_key_s *keys = NULL;
+  int nkeys = 0;
+  int *keyidx = NULL;
+  gcry_sexp_t *s_data = NULL;
+  gcry_sexp_t *s_batch = NULL;
+  unsigned char **frames = NULL;
+  size_t *nframes = NULL;
+  int *paddings = NULL;
+  gpg_error_t *errs = NULL;
+  pkdecrypt_prefetch_t pf;
+  char *desc;
+  int i, k, n;
+
+  release_prefetched_session_keys (ctrl);
+  if (nfnames < 2 || opt.override_session_key || opt.list_only
+      || opt.try_all_secrets)
+    return;
+
+  keyidx = xtrycalloc (nfnames, sizeof *keyidx);
+  s_data = xtrycalloc (nfnames, sizeof *s_data);
+  s_batch = xtrycalloc (nfnames, sizeof *s_batch);
+  frames = xtrycalloc (nfnames, sizeof *frames);
+  nframes = xtrycalloc (nfnames, sizeof *nframes);
+  paddings = xtrycalloc (nfnames, sizeof *paddings);
+  errs = xtrycalloc (nfnames, sizeof *errs);
+  if (!keyidx || !s_data || !s_batch || !frames || !nframes
+      || !paddings || !errs)
+    goto leave;
+
+  for (i=0; i < nfnames; i++)
+    if (!find_prefetch_candidate (ctrl, fnames[i], &keys, &nkeys,
+                                  keyidx + i, s_data + i))
+      keyidx[i] = -1;
+
+  for (k=0; k < nkeys; k++)
+    {
+      if (!keys[k].sk)
+        continue;
+
+      for (i=n=0; i < nfnames && n < MAX_PREFETCH_ITEMS; i++)
+        if (keyidx[i] == k)
+          s_batch[n++] = s_data[i];
+      if (n < 2)
+        continue;  /* Not worth it.  */
+
+      desc = gpg_format_keydesc (ctrl, keys[k].sk, FORMAT_KEYDESC_NORMAL, 1);
+      err = agent_pkdecrypt_multi (NULL, keys[k].keygrip, desc,
+                                   keys[k].sk->keyid, keys[k].sk->main_keyid,
+                                   keys[k].sk->pubkey_algo,
+                                   s_batch, n,
+                                   frames, nframes, paddings, errs);
+      xfree (desc);
+      if (err)
+        {
+          if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED && opt.verbose)
+            log_info ("prefetching session keys failed: %s\n",
+                      gpg_strerror (err));
+          break;
+        }
+
+      for (i=0; i < n; i++)
+        {
+          if (errs[i])
+            continue;
+          pf = xtrycalloc (1, sizeof *pf);
+          if (!pf
+              || make_canon_sexp (s_batch[i],
+                                  &pf->ciphertext, &pf->ciphertextlen))
+            {
+              xfree (pf);
+              wipememory (frames[i], nframes[i]);
+              xfree (frames[i]);
+              continue;
+            }
+          strcpy (pf->keygrip, keys[k].keygrip);
+          pf->frame = frames[i];
+          pf->nframe = nframes[i];
+          pf->padding = paddings[i];
+          pf->next = ctrl->pkdecrypt_prefetch;
+          ctrl->pkdecrypt_prefetch = pf;
+        }
+    }
+
+ leave:
+  if (s_data)
+    for (i=0; i < nfnames; i++)
+      gcry_sexp_release (s_data[i]);
+  for (k=0; k < nkeys; k++)
+    {
+      free_public_key (keys[k].sk);
+      xfree (keys[k].keygrip);
+    }
+  xfree (keys);
+  xfree (errs);
+  xfree (paddings);
+  xfree (nframes);
+  xfree (frames);
+  xfree (s_batch);
+  xfree (s_data);
+  xfree (keyidx);
+}
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -492,54 +493,14 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-/* This function is similar to check_signature_end, but it only checks
- * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
-static int
-check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
-                            gcry_md_hd_t digest,
-                            const void *extrahash, size_t extrahashlen)
+/* Complete the hash context DIGEST with the trailer of SIG and
+ * return the digest as an MPI suitable to verify SIG with PK.
+ * Returns NULL on error.  */
+static gcry_mpi_t
+finish_signature_digest (PKT_public_key *pk, PKT_signature *sig,
+                         gcry_md_hd_t digest,
+                         const void *extrahash, size_t extrahashlen)
 {
-  gcry_mpi_t result = NULL;
-  int rc = 0;
-
-  if (!opt.flags.allow_weak_digest_algos)
-    {
-      if (is_weak_digest (sig->digest_algo))
-        {
-          print_digest_rejected_note (sig->digest_algo);
-          return GPG_ERR_DIGEST_ALGO;
-        }
-    }
-
-  /* For key signatures check that the key has a cert usage.  We may
-   * do this only for subkeys because the primary may always issue key
-   * signature.  The latter may not be reflected in the pubkey_usage
-   * field because we need to check the key signatures to extract the
-   * key usage.  */
-  if (!pk->flags.primary
-      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
-  /* For data signatures check that the key has sign usage.  */
-  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
-      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
   /* Make sure the digest algo is enabled (in case of a detached
    * signature).  */
   gcry_md_enable (digest, sig->digest_algo);
@@ -622,18 +583,70 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     }
     gcry_md_final( digest );
 
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
+  return encode_md_value (pk, digest, sig->digest_algo);
+}
+
 
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+/* This function is similar to check_signature_end, but it only checks
+ * whether the signature was generated by PK.  It does not check
+ * expiration, revocation, etc.  */
+static int
+check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+                            gcry_md_hd_t digest,
+                            const void *extrahash, size_t extrahashlen)
+{
+  gcry_mpi_t result = NULL;
+  int rc = 0;
+
+  if (!opt.flags.allow_weak_digest_algos)
+    {
+      if (is_weak_digest (sig->digest_algo))
+        {
+          print_digest_rejected_note (sig->digest_algo);
+          return GPG_ERR_DIGEST_ALGO;
+        }
+    }
+
+  /* For key signatures check that the key has a cert usage.  We may
+   * do this only for subkeys because the primary may always issue key
+   * signature.  The latter may not be reflected in the pubkey_usage
+   * field because we need to check the key signatures to extract the
+   * key usage.  */
+  if (!pk->flags.primary
+      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
+
+  /* For data signatures check that the key has sign usage.  */
+  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
+      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
+
+  result = finish_signature_digest (pk, sig, digest,
+                                    extrahash, extrahashlen);
+  if (!result)
+    return GPG_ERR_GENERAL;
+
+  /* Verify the signature.  */
+  if (DBG_CLOCK && sig->sig_class <= 0x01)
+    log_clock ("enter pk_verify");
+  rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+  if (DBG_CLOCK && sig->sig_class <= 0x01)
+    log_clock ("leave pk_verify");
+  gcry_mpi_release (result);
 
   if (!rc && sig->flags.unknown_critical)
     {
@@ -822,7 +835,8 @@ check_revocation_keys (ctrl_t ctrl, PKT_public_key *pk, PKT_signature *sig)
  * For example, there is no support for expiring backsigs since it is
  * questionable what such a thing actually means.  Note also that the
  * sig cache check here, unlike other sig caches in GnuPG, is not
- * persistent.  */
+ * persistent; merge_selfsigs_subkey instead caches the result with
+ * the binding signature.  */
 int
 check_backsig (PKT_public_key *main_pk,PKT_public_key *sub_pk,
 	       PKT_signature *backsig)
@@ -1286,3 +1300,199 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* A public key operation for check_key_signatures_parallel.  */
+struct sig_check_job_s
+{
+  PKT_public_key *signer;
+  int signer_alloced;
+  PKT_signature *sig;
+  gcry_mpi_t hash;
+  int rc;
+};
+
+struct sig_check_jobs_s
+{
+  struct sig_check_job_s *jobs;
+  size_t njobs;
+  size_t next;
+};
+
+
+static void *
+sig_check_worker (void *arg)
+{
+  struct sig_check_jobs_s *parm = arg;
+  struct sig_check_job_s *job;
+
+  /* NEXT is only accessed while we hold the nPth lock, which at most
+   * one thread does at a time; thus it needs no extra lock.  The
+   * verification itself does not need random numbers and thus
+   * Libgcrypt won't run into the system call clamp while we are
+   * unprotected.  */
+  while (parm->next < parm->njobs)
+    {
+      job = parm->jobs + parm->next++;
+      npth_unprotect ();
+      job->rc = pk_verify (job->signer->pubkey_algo, job->hash,
+                           job->sig->data, job->signer->pkey);
+      npth_protect ();
+    }
+
+  return NULL;
+}
+
+
+/* Prepare JOB for the signature NODE of the keyblock ROOT.  Returns
+ * false if the signature is not to be handled in parallel.  */
+static int
+prepare_sig_check_job (ctrl_t ctrl, kbnode_t root, kbnode_t node,
+                       struct sig_check_job_s *job)
+{
+  PKT_public_key *pripk = root->pkt->pkt.public_key;
+  PKT_signature *sig = node->pkt->pkt.signature;
+  kbnode_t signed_node = NULL;
+  gcry_md_hd_t md;
+  int is_selfsig;
+
+  memset (job, 0, sizeof *job);
+  if (sig->flags.checked || sig->flags.unknown_critical)
+    return 0;
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return 0;
+  if (!opt.flags.allow_weak_digest_algos && is_weak_digest (sig->digest_algo))
+    return 0;
+
+  is_selfsig = (sig->keyid[0] == pripk->keyid[0]
+                && sig->keyid[1] == pripk->keyid[1]);
+  if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      signed_node = find_prev_kbnode (root, node, PKT_USER_ID);
+      if (!signed_node)
+        return 0;
+      if (sig->digest_algo == DIGEST_ALGO_SHA1 && !is_selfsig
+          && !opt.flags.allow_weak_key_signatures)
+        return 0;
+    }
+  else if (!is_selfsig)
+    return 0;  /* Only self-signatures on keys and subkeys.  */
+  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    {
+      signed_node = find_prev_kbnode (root, node, PKT_PUBLIC_SUBKEY);
+      if (!signed_node)
+        return 0;
+    }
+  else if (!IS_KEY_SIG (sig) && !IS_KEY_REV (sig))
+    return 0;
+
+  if (is_selfsig)
+    job->signer = pripk;
+  else
+    {
+      job->signer = xmalloc_clear (sizeof *job->signer);
+      job->signer_alloced = 1;
+      if (IS_CERT (sig))
+        job->signer->req_usage = PUBKEY_USAGE_CERT;
+      if (get_pubkey_for_sig (ctrl, job->signer, sig, NULL))
+        goto fail;
+    }
+
+  /* These are the checks done by check_signature_end_simple which
+   * would print a diagnostic; we leave that to the regular check.  */
+  if (!job->signer->flags.primary && IS_CERT (sig)
+      && !(job->signer->pubkey_usage & PUBKEY_USAGE_CERT))
+    goto fail;
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    BUG ();
+  hash_public_key (md, pripk);
+  if (signed_node && signed_node->pkt->pkttype == PKT_USER_ID)
+    hash_uid_packet (signed_node->pkt->pkt.user_id, md, sig);
+  else if (signed_node)
+    hash_public_key (md, signed_node->pkt->pkt.public_key);
+  job->hash = finish_signature_digest (job->signer, sig, md, NULL, 0);
+  gcry_md_close (md);
+  if (!job->hash)
+    goto fail;
+
+  job->sig = sig;
+  return 1;
+
+ fail:
+  if (job->signer_alloced)
+    free_public_key (job->signer);
+  job->signer = NULL;
+  return 0;
+}
+
+
+/* Verify the signatures ITEMS on keyblocks using up to NTHREADS
+ * threads and cache the results in the signature packets so that a
+ * following check_key_signature takes them from there.  Only user ID
+ * certifications and self-signatures are handled; the signers are
+ * looked up and the data is hashed by the calling thread and only the
+ * public key operations run in parallel.  Signatures which can't be
+ * handled here are skipped.  */
+void
+check_key_signatures_parallel (ctrl_t ctrl, struct key_sig_ref_s *items,
+                               size_t nitems, int nthreads)
+{
+  struct sig_check_jobs_s parm;
+  npth_t *thds = NULL;
+  npth_attr_t tattr;
+  int nthds = 0;
+  size_t n;
+  int i, rc;
+
+  if (opt.no_sig_cache || !nitems)
+    return;
+
+  memset (&parm, 0, sizeof parm);
+  parm.jobs = xtrycalloc (nitems, sizeof *parm.jobs);
+  if (!parm.jobs)
+    return;
+  for (n = 0; n < nitems; n++)
+    if (prepare_sig_check_job (ctrl, items[n].root, items[n].node,
+                               parm.jobs + parm.njobs))
+      parm.njobs++;
+
+  if (nthreads > 0 && (size_t)nthreads > parm.njobs)
+    nthreads = parm.njobs;
+  if (nthreads > 1)
+    {
+      thds = xtrycalloc (nthreads, sizeof *thds);
+      if (thds && !npth_attr_init (&tattr))
+        {
+          npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+          for (i = 0; i < nthreads; i++)
+            {
+              rc = npth_create (thds + nthds, &tattr, sig_check_worker, &parm);
+              if (rc)
+                {
+                  log_error ("error spawning signature check thread: %s\n",
+                             gpg_strerror (gpg_error_from_errno (rc)));
+                  break;
+                }
+              nthds++;
+            }
+          npth_attr_destroy (&tattr);
+        }
+    }
+  /* Also take part in the work; this does all of it if no threads
+   * could be created.  */
+  sig_check_worker (&parm);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+  xfree (thds);
+
+  for (n = 0; n < parm.njobs; n++)
+    {
+      cache_sig_result (parm.jobs[n].sig, parm.jobs[n].rc);
+      gcry_mpi_release (parm.jobs[n].hash);
+      if (parm.jobs[n].signer_alloced)
+        free_public_key (parm.jobs[n].signer);
+    }
+  xfree (parm.jobs);
+}
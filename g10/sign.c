@@ -399,17 +399,14 @@ hash_sigversion_to_magic (gcry_md_hd_t md, const PKT_signature *sig,
 }
 
 
-/* Perform the sign operation.  If CACHE_NONCE is given the agent is
- * advised to use that cached passphrase for the key.  SIGNHINTS has
- * hints so that we can do some additional checks. */
-static int
-do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
-	 gcry_md_hd_t md, int mdalgo,
-         const char *cache_nonce, unsigned int signhints)
+/* Check that the key PKSK may be used to create the signature SIG
+ * with the digest algorithm MDALGO.  SIGNHINTS has hints so that we
+ * can do some additional checks.  */
+static gpg_error_t
+check_sign_allowed (PKT_public_key *pksk, PKT_signature *sig, int mdalgo,
+                    unsigned int signhints)
 {
   gpg_error_t err;
-  byte *dp;
-  char *hexgrip;
 
   /* An ADSK key commonly has a creation date older than the primary
    * key.  For example because the ADSK is used as an archive key for
@@ -428,9 +425,6 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
 
   print_pubkey_algo_note (pksk->pubkey_algo);
 
-  if (!mdalgo)
-    mdalgo = gcry_md_get_algo (md);
-
   if ((signhints & SIGNHINT_KEYSIG) && !(signhints & SIGNHINT_SELFSIG)
       && mdalgo == GCRY_MD_SHA1
       && !opt.flags.allow_weak_key_signatures)
@@ -440,8 +434,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
        * that this will render dsa1024 keys unsuitable for such
        * keysigs and in turn the WoT. */
       print_sha1_keysig_rejected_note ();
-      err = gpg_error (GPG_ERR_DIGEST_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_DIGEST_ALGO);
     }
 
   /* Check compliance.  */
@@ -450,8 +443,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       log_error (_("digest algorithm '%s' may not be used in %s mode\n"),
 		 gcry_md_algo_name (mdalgo),
 		 gnupg_compliance_option_string (opt.compliance));
-      err = gpg_error (GPG_ERR_DIGEST_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_DIGEST_ALGO);
     }
 
   if (! gnupg_pk_is_allowed (opt.compliance, PK_USE_SIGNING,
@@ -461,8 +453,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       log_error (_("key %s may not be used for signing in %s mode\n"),
                  keystr_from_pk (pksk),
                  gnupg_compliance_option_string (opt.compliance));
-      err = gpg_error (GPG_ERR_PUBKEY_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_PUBKEY_ALGO);
     }
 
   if (!gnupg_rng_is_compliant (opt.compliance))
@@ -472,11 +463,19 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
                  "RNG",
                  gnupg_compliance_option_string (opt.compliance));
       write_status_error ("random-compliance", err);
-      goto leave;
+      return err;
     }
 
   print_digest_algo_note (mdalgo);
-  dp = gcry_md_read  (md, mdalgo);
+  return 0;
+}
+
+
+/* Prepare SIG for the signature values by storing the first two
+ * bytes of the digest DP.  */
+static void
+prepare_sig_data (PKT_signature *sig, int mdalgo, const byte *dp)
+{
   sig->digest_algo = mdalgo;
   sig->digest_start[0] = dp[0];
   sig->digest_start[1] = dp[1];
@@ -484,8 +483,85 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
   sig->data[0] = NULL;
   mpi_release (sig->data[1]);
   sig->data[1] = NULL;
+}
+
+
+/* Store the signature values from the S-expression S_SIGVAL as
+ * returned by the agent into SIG.  */
+static gpg_error_t
+sig_data_from_sigval (PKT_public_key *pksk, PKT_signature *sig,
+                      gcry_sexp_t s_sigval)
+{
+  gpg_error_t err = 0;
+
+  if (pksk->pubkey_algo == GCRY_PK_RSA
+      || pksk->pubkey_algo == GCRY_PK_RSA_S)
+    sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+  else if (pksk->pubkey_algo == PUBKEY_ALGO_EDDSA
+           && openpgp_oid_is_ed25519 (pksk->pkey[0]))
+    {
+      err = sexp_extract_param_sos_nlz (s_sigval, "r", &sig->data[0]);
+      if (!err)
+        err = sexp_extract_param_sos_nlz (s_sigval, "s", &sig->data[1]);
+    }
+  else if (pksk->pubkey_algo == PUBKEY_ALGO_ECDSA
+           || pksk->pubkey_algo == PUBKEY_ALGO_EDDSA)
+    {
+      err = sexp_extract_param_sos (s_sigval, "r", &sig->data[0]);
+      if (!err)
+        err = sexp_extract_param_sos (s_sigval, "s", &sig->data[1]);
+    }
+  else
+    {
+      sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
+      sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+    }
+
+  return err;
+}
+
+
+/* Print the info about a created signature in verbose mode.  */
+static void
+print_sig_created_info (ctrl_t ctrl, PKT_public_key *pksk,
+                        PKT_signature *sig)
+{
+  char *ustr;
+
+  if (!opt.verbose)
+    return;
+
+  ustr = get_user_id_string_native (ctrl, sig->keyid);
+  log_info (_("%s/%s signature from: \"%s\"\n"),
+            openpgp_pk_algo_name (pksk->pubkey_algo),
+            openpgp_md_algo_name (sig->digest_algo),
+            ustr);
+  xfree (ustr);
+}
 
 
+/* Perform the sign operation.  If CACHE_NONCE is given the agent is
+ * advised to use that cached passphrase for the key.  SIGNHINTS has
+ * hints so that we can do some additional checks. */
+static int
+do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
+	 gcry_md_hd_t md, int mdalgo,
+         const char *cache_nonce, unsigned int signhints)
+{
+  gpg_error_t err;
+  byte *dp;
+  char *hexgrip;
+
+  if (!mdalgo)
+    mdalgo = gcry_md_get_algo (md);
+
+  err = check_sign_allowed (pksk, sig, mdalgo, signhints);
+  if (err)
+    goto leave;
+
+  dp = gcry_md_read  (md, mdalgo);
+  prepare_sig_data (sig, mdalgo, dp);
+
   err = hexkeygrip_from_pk (pksk, &hexgrip);
   if (!err)
     {
@@ -499,30 +575,8 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
                           &s_sigval);
       xfree (desc);
 
-      if (err)
-        ;
-      else if (pksk->pubkey_algo == GCRY_PK_RSA
-               || pksk->pubkey_algo == GCRY_PK_RSA_S)
-        sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-      else if (pksk->pubkey_algo == PUBKEY_ALGO_EDDSA
-               && openpgp_oid_is_ed25519 (pksk->pkey[0]))
-        {
-          err = sexp_extract_param_sos_nlz (s_sigval, "r", &sig->data[0]);
-          if (!err)
-            err = sexp_extract_param_sos_nlz (s_sigval, "s", &sig->data[1]);
-        }
-      else if (pksk->pubkey_algo == PUBKEY_ALGO_ECDSA
-               || pksk->pubkey_algo == PUBKEY_ALGO_EDDSA)
-        {
-          err = sexp_extract_param_sos (s_sigval, "r", &sig->data[0]);
-          if (!err)
-            err = sexp_extract_param_sos (s_sigval, "s", &sig->data[1]);
-        }
-      else
-        {
-          sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
-          sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-        }
+      if (!err)
+        err = sig_data_from_sigval (pksk, sig, s_sigval);
 
       gcry_sexp_release (s_sigval);
     }
@@ -532,17 +586,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
   if (err)
     log_error (_("signing failed: %s\n"), gpg_strerror (err));
   else
-    {
-      if (opt.verbose)
-        {
-          char *ustr = get_user_id_string_native (ctrl, sig->keyid);
-          log_info (_("%s/%s signature from: \"%s\"\n"),
-                    openpgp_pk_algo_name (pksk->pubkey_algo),
-                    openpgp_md_algo_name (sig->digest_algo),
-                    ustr);
-          xfree (ustr);
-	}
-    }
+    print_sig_created_info (ctrl, pksk, sig);
   return err;
 }
 
@@ -1411,6 +1455,451 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 }
 
 
+/* Maximum number of files signed in one batch.  This is also the
+ * number of digests sent to the agent in one PKSIGN --multi request
+ * and must not be larger than the limit the agent imposes.  */
+#define MAX_SIGN_BATCH 1024
+
+/* Information about one file in a batch of detached signatures.  */
+struct detached_item_s
+{
+  char *fname;             /* The name of the file to sign.  */
+  gcry_md_hd_t md;         /* The hash context over the file's data.  */
+  PKT_signature **sigs;    /* The signatures; one for each key.  */
+  gpg_error_t err;         /* The first error seen for this file.  */
+};
+typedef struct detached_item_s *detached_item_t;
+
+
+/* Read the file ITEM->FNAME and hash it into a new context using all
+ * algorithms required by the keys in SK_LIST.  */
+static gpg_error_t
+hash_detached_item (SK_LIST sk_list, detached_item_t item,
+                    progress_filter_context_t *pfx)
+{
+  gpg_error_t err;
+  SK_LIST sk_rover;
+  iobuf_t inp;
+  md_filter_context_t mfx;
+  text_filter_context_t tfx;
+  size_t iobuf_size = iobuf_set_buffer_size(0) * 1024;
+
+  inp = iobuf_open (item->fname);
+  if (inp && is_secured_file (iobuf_get_fd (inp)))
+    {
+      iobuf_close (inp);
+      inp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!inp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), item->fname, gpg_strerror (err));
+      return err;
+    }
+  handle_progress (pfx, inp, item->fname);
+
+  if (gcry_md_open (&item->md, 0, 0))
+    BUG ();
+  if (DBG_HASHING)
+    gcry_md_debug (item->md, "sign");
+  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    gcry_md_enable (item->md, hash_for (sk_rover->pk));
+
+  if (opt.textmode)
+    {
+      memset (&tfx, 0, sizeof tfx);
+      iobuf_push_filter (inp, text_filter, &tfx);
+    }
+  memset (&mfx, 0, sizeof mfx);
+  mfx.md = item->md;
+  iobuf_push_filter (inp, md_filter, &mfx);
+
+  while (iobuf_read (inp, NULL, iobuf_size) != -1)
+    ;
+  err = iobuf_error (inp);
+  iobuf_close (inp);
+  if (err)
+    log_error (_("error reading '%s': %s\n"),
+               item->fname, gpg_strerror (err));
+  return err;
+}
+
+
+/* Create the signatures with key number SKIDX from SK_LIST for all
+ * items in ITEMS which have no error yet.  The signatures are
+ * requested from the agent with one PKSIGN --multi transaction
+ * unless the agent does not support that.  */
+static void
+sign_detached_items (ctrl_t ctrl, SK_LIST sk_list, int skidx,
+                     detached_item_t items, int nitems,
+                     u32 timestamp, u32 duration)
+{
+  gpg_error_t err;
+  PKT_public_key *pk;
+  SK_LIST sk_rover;
+  int mdalgo;
+  int i, n;
+  int *idx = NULL;
+  unsigned char **digests = NULL;
+  gcry_sexp_t *sigvals = NULL;
+  char *hexgrip = NULL;
+  char *desc = NULL;
+
+  for (sk_rover = sk_list, i = 0; i < skidx; sk_rover = sk_rover->next, i++)
+    ;
+  pk = sk_rover->pk;
+  mdalgo = hash_for (pk);
+
+  idx = xtrycalloc (nitems, sizeof *idx);
+  digests = xtrycalloc (nitems, sizeof *digests);
+  sigvals = xtrycalloc (nitems, sizeof *sigvals);
+  if (!idx || !digests || !sigvals)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Build the signature packets and the digests to sign.  */
+  for (i = n = 0; i < nitems; i++)
+    {
+      PKT_signature *sig;
+      gcry_md_hd_t md;
+
+      if (items[i].err)
+        continue;
+
+      sig = xtrycalloc (1, sizeof *sig);
+      if (!sig)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      items[i].sigs[skidx] = sig;
+
+      if (pk->version >= 5)
+        sig->version = 5;  /* Required for v5 keys.  */
+      else
+        sig->version = 4;  /* Required.  */
+      keyid_from_pk (pk, sig->keyid);
+      sig->digest_algo = mdalgo;
+      sig->pubkey_algo = pk->pubkey_algo;
+      sig->timestamp = timestamp;
+      if (duration)
+        sig->expiredate = sig->timestamp + duration;
+      sig->sig_class = opt.textmode? 0x01 : 0x00;
+
+      build_sig_subpkt_from_sig (sig, pk, 0);
+      mk_notation_policy_etc (ctrl, sig, NULL, pk);
+      if (opt.flags.include_key_block)
+        {
+          err = mk_sig_subpkt_key_block (ctrl, sig, pk);
+          if (err)
+            goto leave;
+        }
+
+      if (!n)
+        {
+          err = check_sign_allowed (pk, sig, mdalgo, 0);
+          if (err)
+            goto leave;
+        }
+
+      if (gcry_md_copy (&md, items[i].md))
+        BUG ();
+      hash_sigversion_to_magic (md, sig, NULL);
+      gcry_md_final (md);
+      digests[n] = xtrymalloc (gcry_md_get_algo_dlen (mdalgo));
+      if (!digests[n])
+        {
+          err = gpg_error_from_syserror ();
+          gcry_md_close (md);
+          goto leave;
+        }
+      memcpy (digests[n], gcry_md_read (md, mdalgo),
+              gcry_md_get_algo_dlen (mdalgo));
+      gcry_md_close (md);
+      prepare_sig_data (sig, mdalgo, digests[n]);
+      idx[n++] = i;
+    }
+  if (!n)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  err = hexkeygrip_from_pk (pk, &hexgrip);
+  if (err)
+    goto leave;
+  desc = gpg_format_keydesc (ctrl, pk, FORMAT_KEYDESC_NORMAL, 1);
+
+  err = agent_pksign_multi (NULL/*ctrl*/, NULL, hexgrip, desc,
+                            pk->keyid, pk->main_keyid, pk->pubkey_algo,
+                            digests, n, mdalgo, sigvals);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      /* Old agent - sign the digests one by one.  */
+      for (i = 0; i < n; i++)
+        {
+          err = agent_pksign (NULL/*ctrl*/, NULL, hexgrip, desc,
+                              pk->keyid, pk->main_keyid, pk->pubkey_algo,
+                              digests[i], gcry_md_get_algo_dlen (mdalgo),
+                              mdalgo, &sigvals[i]);
+          if (err)
+            break;
+        }
+    }
+  if (err)
+    goto leave;
+
+  for (i = 0; i < n; i++)
+    {
+      detached_item_t item = items + idx[i];
+
+      err = sig_data_from_sigval (pk, item->sigs[skidx], sigvals[i]);
+      if (err)
+        {
+          log_error (_("signing failed: %s\n"), gpg_strerror (err));
+          item->err = err;
+        }
+      else
+        print_sig_created_info (ctrl, pk, item->sigs[skidx]);
+    }
+  err = 0;
+
+ leave:
+  if (err)
+    {
+      log_error (_("signing failed: %s\n"), gpg_strerror (err));
+      for (i = 0; i < nitems; i++)
+        if (!items[i].err)
+          items[i].err = err;
+    }
+  if (sigvals)
+    for (i = 0; i < nitems; i++)
+      gcry_sexp_release (sigvals[i]);
+  if (digests)
+    for (i = 0; i < nitems; i++)
+      xfree (digests[i]);
+  xfree (sigvals);
+  xfree (digests);
+  xfree (idx);
+  xfree (desc);
+  xfree (hexgrip);
+}
+
+
+/* Write the signatures of ITEM to a new file named after the signed
+ * file.  */
+static gpg_error_t
+write_detached_item (SK_LIST sk_list, detached_item_t item)
+{
+  gpg_error_t err;
+  armor_filter_context_t *afx;
+  iobuf_t out = NULL;
+  SK_LIST sk_rover;
+  int i;
+
+  afx = new_armor_context ();
+  err = open_outfile (GNUPG_INVALID_FD, item->fname,
+                      opt.armor? 1 : 2, 0, &out);
+  if (err)
+    goto leave;
+
+  afx->what = 2;
+  if (opt.armor)
+    push_armor_filter (afx, out);
+
+  for (sk_rover = sk_list, i = 0; sk_rover; sk_rover = sk_rover->next, i++)
+    {
+      PACKET pkt;
+
+      init_packet (&pkt);
+      pkt.pkttype = PKT_SIGNATURE;
+      pkt.pkt.signature = item->sigs[i];
+      err = build_packet (out, &pkt);
+      if (err)
+        {
+          log_error ("build signature packet failed: %s\n",
+                     gpg_strerror (err));
+          goto leave;
+        }
+      if (is_status_enabled())
+        print_status_sig_created (sk_rover->pk, item->sigs[i], 'D');
+    }
+
+ leave:
+  if (err)
+    iobuf_cancel (out);
+  else
+    iobuf_close (out);
+  release_armor_context (afx);
+  return err;
+}
+
+
+/* Release the resources of the NITEMS items in ITEMS.  NSK is the
+ * number of signatures per item.  */
+static void
+release_detached_items (detached_item_t items, int nitems, int nsk)
+{
+  int i, j;
+
+  for (i = 0; i < nitems; i++)
+    {
+      if (items[i].sigs)
+        for (j = 0; j < nsk; j++)
+          if (items[i].sigs[j])
+            free_seckey_enc (items[i].sigs[j]);
+      xfree (items[i].sigs);
+      gcry_md_close (items[i].md);
+      xfree (items[i].fname);
+    }
+}
+
+
+/* Create detached signatures for the batch of NITEMS items.  */
+static void
+sign_detached_batch (ctrl_t ctrl, SK_LIST sk_list, int nsk,
+                     detached_item_t items, int nitems, u32 duration,
+                     progress_filter_context_t *pfx)
+{
+  u32 timestamp;
+  int i;
+
+  for (i = 0; i < nitems; i++)
+    {
+      items[i].sigs = xtrycalloc (nsk, sizeof *items[i].sigs);
+      if (!items[i].sigs)
+        items[i].err = gpg_error_from_syserror ();
+      else
+        items[i].err = hash_detached_item (sk_list, items + i, pfx);
+    }
+
+  timestamp = make_timestamp ();
+  for (i = 0; i < nsk; i++)
+    sign_detached_items (ctrl, sk_list, i, items, nitems,
+                         timestamp, duration);
+
+  for (i = 0; i < nitems; i++)
+    {
+      print_file_status (STATUS_FILE_START, items[i].fname, 4);
+      if (!items[i].err)
+        items[i].err = write_detached_item (sk_list, items + i);
+      if (items[i].err)
+        log_error ("signing of '%s' failed: %s\n",
+                   print_fname_stdin (items[i].fname),
+                   gpg_strerror (items[i].err));
+      write_status (STATUS_FILE_DONE);
+    }
+}
+
+
+/* Create a detached signature for each of the NFILES files in FILES
+ * using all secret keys which can be taken from LOCUSR; if this is
+ * NULL the default secret key is used.  If NFILES is 0 the file names
+ * are read from stdin.  The signatures are written to files named
+ * after the signed files.  The files are processed in batches so
+ * that the agent is asked only once per key and batch to create the
+ * signatures.  */
+void
+sign_files_detached (ctrl_t ctrl, int nfiles, char **files, strlist_t locusr)
+{
+  gpg_error_t err;
+  SK_LIST sk_list = NULL;
+  SK_LIST sk_rover;
+  int nsk = 0;
+  int from_stdin = !nfiles;
+  u32 duration;
+  detached_item_t items = NULL;
+  int nitems = 0;
+  progress_filter_context_t *pfx = NULL;
+  char line[2048];
+  unsigned int lno = 0;
+
+  if (opt.outfile)
+    {
+      log_error (_("--output doesn't work for this command\n"));
+      return;
+    }
+
+  if (opt.ask_sig_expire && !opt.batch)
+    duration = ask_expire_interval (1, opt.def_sig_expire);
+  else
+    duration = parse_expire_string (opt.def_sig_expire);
+
+  if ((err = build_sk_list (ctrl, locusr, &sk_list, PUBKEY_USAGE_SIG)))
+    goto leave;
+  for (nsk = 0, sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    nsk++;
+
+  items = xtrycalloc (MAX_SIGN_BATCH, sizeof *items);
+  if (!items)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  pfx = new_progress_context ();
+
+  for (;;)
+    {
+      const char *name = NULL;
+
+      if (!from_stdin)
+        {
+          if (nfiles)
+            {
+              name = *files++;
+              nfiles--;
+            }
+        }
+      else if (fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            log_error ("input line %u too long or missing LF\n", lno);
+          else
+            {
+              line[strlen(line)-1] = '\0';
+              name = line;
+            }
+        }
+
+      if (name)
+        {
+          items[nitems].fname = xtrystrdup (name);
+          if (!items[nitems].fname)
+            {
+              log_error ("%s\n", gpg_strerror (gpg_error_from_syserror ()));
+              name = NULL;
+            }
+          else
+            nitems++;
+        }
+
+      if (nitems && (!name || nitems == MAX_SIGN_BATCH))
+        {
+          sign_detached_batch (ctrl, sk_list, nsk, items, nitems,
+                               duration, pfx);
+          release_detached_items (items, nitems, nsk);
+          memset (items, 0, nitems * sizeof *items);
+          nitems = 0;
+        }
+      if (!name)
+        break;
+    }
+
+ leave:
+  if (err)
+    log_error (_("signing failed: %s\n"), gpg_strerror (err));
+  if (items)
+    release_detached_items (items, nitems, nsk);
+  xfree (items);
+  release_progress_context (pfx);
+  release_sk_list (sk_list);
+}
+
+
 /*
  * Make a clear signature.  Note that opt.armor is not needed.
  */
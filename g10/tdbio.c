@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -50,17 +53,20 @@
 
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache is an open addressing hash table keyed by the
+ * record number using linear probing.  Removed entries are marked as
+ * deleted so that probing continues over them; they are purged when
+ * the table is rehashed.  Where possible the trustdb file is also
+ * mapped into memory so that records not in the cache can be read
+ * without a system call.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
-  CACHE_CTRL next;
   struct {
     unsigned used:1;
     unsigned dirty:1;
+    unsigned deleted:1;
   } flags;
   ulong recno;
   char data[TRUST_RECORD_LEN];
@@ -73,8 +79,12 @@ struct cache_ctrl_struct
 #define MAX_CACHE_ENTRIES_HARD	10000
 
 
-/* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
+/* The cache is controlled by these variables.  CACHE_TABLE_SIZE is
+ * a power of 2 and CACHE_SLOTS_USED counts the used and the deleted
+ * slots.  */
+static CACHE_CTRL cache_table;
+static size_t cache_table_size;
+static size_t cache_slots_used;
 static int cache_entries;
 static int cache_is_dirty;
 
@@ -107,9 +117,44 @@ static unsigned int is_locked;
 /* The file descriptor of the trustdb.  */
 static int  db_fd = -1;
 
-/* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+#ifdef HAVE_MMAP
+/* The read-only mapping of the trustdb and its length.  The mapping
+ * is extended on demand when records behind its end are read.  */
+static const byte *db_map;
+static size_t db_map_len;
+static int db_map_failed;
+#endif
 
+/* The nesting level of the active transaction and a flag telling
+ * that an inner level has been canceled.  */
+static int in_transaction;
+static int transaction_canceled;
+
+/* While a transaction is active dirty records can't be written to
+ * the trustdb.  If the cache reached its hard limit some of them are
+ * moved to a private spill file instead.  SPILL_INDEX maps the record
+ * numbers to their slot in that file.  It is an open addressing table
+ * with linear probing whose size is a power of 2; the key of a slot
+ * is the record number plus one so that 0 marks an empty slot.  */
+struct spill_slot_s
+{
+  ulong key;
+  ulong slot;
+};
+static estream_t spill_fp;
+static struct spill_slot_s *spill_index;
+static size_t spill_index_size;
+static ulong spill_count;
+
+/* The journal is written next to the trustdb.  It starts with
+ * JOURNAL_MAGIC followed by the records to write, each prefixed by
+ * its 4 byte record number, and ends with a trailer of the 4 byte
+ * record count and the SHA-1 hash over everything before the hash.
+ * Only a journal with a matching trailer will be replayed.  */
+#define JOURNAL_MAGIC      "gpgtdbj1"
+#define JOURNAL_MAGIC_LEN  8
+#define JOURNAL_ENTRY_LEN  (4 + TRUST_RECORD_LEN)
+#define JOURNAL_HASH_LEN   20
 
 
 static void open_db (void);
@@ -181,6 +226,101 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/* Return the hash table slot for RECNO.  */
+static inline size_t
+cache_hash (ulong recno)
+{
+  return (recno * 2654435761UL) & (cache_table_size - 1);
+}
+
+
+/* Return the cache entry for RECNO or NULL.  */
+static CACHE_CTRL
+find_cache_entry (ulong recno)
+{
+  size_t i;
+
+  if (!cache_entries)
+    return NULL;
+  for (i = cache_hash (recno);
+       cache_table[i].flags.used || cache_table[i].flags.deleted;
+       i = (i + 1) & (cache_table_size - 1))
+    if (cache_table[i].flags.used && cache_table[i].recno == recno)
+      return cache_table + i;
+  return NULL;
+}
+
+
+/* Rebuild the cache table with NEWSIZE slots dropping all deleted
+ * entries.  */
+static void
+rehash_cache (size_t newsize)
+{
+  CACHE_CTRL oldtbl = cache_table;
+  size_t oldsize = cache_table_size;
+  size_t i, j;
+
+  cache_table = xcalloc (newsize, sizeof *cache_table);
+  cache_table_size = newsize;
+  for (i=0; i < oldsize; i++)
+    {
+      if (!oldtbl[i].flags.used)
+        continue;
+      for (j = cache_hash (oldtbl[i].recno); cache_table[j].flags.used;
+           j = (j + 1) & (newsize - 1))
+        ;
+      cache_table[j] = oldtbl[i];
+    }
+  cache_slots_used = cache_entries;
+  xfree (oldtbl);
+}
+
+
+/* Add a new entry for the record RECNO with DATA to the cache.  The
+ * record must not yet be cached.  The entry is marked dirty.  */
+static void
+new_cache_entry (ulong recno, const char *data)
+{
+  CACHE_CTRL r;
+  size_t i;
+
+  /* Keep the load factor including the deleted slots below 1/2.  */
+  if ((cache_slots_used + 1) * 2 > cache_table_size)
+    {
+      size_t newsize = cache_table_size? cache_table_size : 512;
+
+      while ((cache_entries + 1) * 4 > newsize)
+        newsize *= 2;
+      rehash_cache (newsize);
+    }
+
+  for (i = cache_hash (recno); cache_table[i].flags.used;
+       i = (i + 1) & (cache_table_size - 1))
+    ;
+  r = cache_table + i;
+  if (!r->flags.deleted)
+    cache_slots_used++;
+  r->flags.used = 1;
+  r->flags.deleted = 0;
+  r->flags.dirty = 1;
+  r->recno = recno;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  cache_is_dirty = 1;
+  cache_entries++;
+}
+
+
+/* Remove the entry R from the cache.  */
+static void
+remove_cache_entry (CACHE_CTRL r)
+{
+  r->flags.used = 0;
+  r->flags.dirty = 0;
+  r->flags.deleted = 1;
+  cache_entries--;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -191,46 +331,178 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
-  return NULL;
+  r = find_cache_entry (recno);
+  return r? r->data : NULL;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write the record DATA with number RECNO to the trustdb file.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_record_data (ulong recno, const void *data)
 {
   gpg_error_t err;
   int n;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
+  n = write (db_fd, data, TRUST_RECORD_LEN);
   if (n != TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, n, strerror (errno) );
       return err;
     }
+  return 0;
+}
+
+
+/*
+ * Write a cached item back to the trustdb file.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+write_cache_item (CACHE_CTRL r)
+{
+  int rc;
+
+  rc = write_record_data (r->recno, r->data);
+  if (rc)
+    return rc;
   r->flags.dirty = 0;
   return 0;
 }
 
 
+/* Return the slot of record RECNO in the spill index or NULL if it
+ * has not been spilled.  If CREATE is set a new slot is allocated
+ * for a record not yet in the index; NULL is then only returned on
+ * a memory allocation failure.  */
+static struct spill_slot_s *
+find_spill_slot (ulong recno, int create)
+{
+  size_t i, mask;
+
+  if (create && (spill_count + 1) * 2 > spill_index_size)
+    {
+      struct spill_slot_s *newidx;
+      size_t newsize, j;
+
+      newsize = spill_index_size? spill_index_size * 2 : 1024;
+      newidx = xtrycalloc (newsize, sizeof *newidx);
+      if (!newidx)
+        return NULL;
+      for (j=0; j < spill_index_size; j++)
+        if (spill_index[j].key)
+          {
+            i = (spill_index[j].key * 2654435761UL) & (newsize - 1);
+            while (newidx[i].key)
+              i = (i + 1) & (newsize - 1);
+            newidx[i] = spill_index[j];
+          }
+      xfree (spill_index);
+      spill_index = newidx;
+      spill_index_size = newsize;
+    }
+
+  if (!spill_index_size)
+    return NULL;
+
+  mask = spill_index_size - 1;
+  for (i = ((recno + 1) * 2654435761UL) & mask;
+       spill_index[i].key; i = (i + 1) & mask)
+    if (spill_index[i].key == recno + 1)
+      return spill_index + i;
+
+  if (!create)
+    return NULL;
+  spill_index[i].key = recno + 1;
+  spill_index[i].slot = spill_count++;
+  return spill_index + i;
+}
+
+
+/* Move the record DATA with number RECNO to the spill file.  */
+static gpg_error_t
+spill_record (ulong recno, const char *data)
+{
+  gpg_error_t err;
+  struct spill_slot_s *sl;
+
+  if (!spill_fp)
+    {
+      spill_fp = es_tmpfile ();
+      if (!spill_fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb: error creating spill file: %s\n"),
+                     gpg_strerror (err));
+          return err;
+        }
+    }
+
+  sl = find_spill_slot (recno, 1);
+  if (!sl)
+    return gpg_error_from_syserror ();
+  if (es_fseeko (spill_fp, (off_t)sl->slot * TRUST_RECORD_LEN, SEEK_SET)
+      || es_fwrite (data, TRUST_RECORD_LEN, 1, spill_fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("trustdb: error writing spill file: %s\n"),
+                 gpg_strerror (err));
+      return err;
+    }
+  return 0;
+}
+
+
+/* Read the spilled record RECNO into BUFFER.  Returns GPG_ERR_NOT_FOUND
+ * if the record has not been spilled.  */
+static gpg_error_t
+read_spilled_record (ulong recno, void *buffer)
+{
+  gpg_error_t err;
+  struct spill_slot_s *sl;
+
+  sl = spill_count? find_spill_slot (recno, 0) : NULL;
+  if (!sl)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (es_fseeko (spill_fp, (off_t)sl->slot * TRUST_RECORD_LEN, SEEK_SET)
+      || es_fread (buffer, TRUST_RECORD_LEN, 1, spill_fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("trustdb: error reading spill file: %s\n"),
+                 gpg_strerror (err));
+      return err;
+    }
+  return 0;
+}
+
+
+/* Release the spill file and its index.  */
+static void
+release_spill_file (void)
+{
+  if (spill_fp)
+    es_fclose (spill_fp);
+  spill_fp = NULL;
+  xfree (spill_index);
+  spill_index = NULL;
+  spill_index_size = 0;
+  spill_count = 0;
+}
+
+
 /*
  * Put data into the cache.  This function may flush
  * some cache entries if the cache is filled up.
@@ -240,52 +512,25 @@ write_cache_item (CACHE_CTRL r)
 static int
 put_record_into_cache (ulong recno, const char *data)
 {
-  CACHE_CTRL r, unused;
+  CACHE_CTRL r;
   int dirty_count = 0;
   int clean_count = 0;
+  size_t i;
 
   /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  r = find_cache_entry (recno);
+  if (r)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
+      if (!r->flags.dirty)
         {
-          if (!r->flags.dirty)
+          /* Hmmm: should we use a copy and compare? */
+          if (memcmp (r->data, data, TRUST_RECORD_LEN))
             {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
-    }
-
-  /* Not in the cache: add a new entry. */
-  if (unused)
-    {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
+              r->flags.dirty = 1;
+              cache_is_dirty = 1;
+            }
+        }
       memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
       return 0;
     }
 
@@ -293,18 +538,22 @@ put_record_into_cache (ulong recno, const char *data)
   if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
     {
       /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
+      new_cache_entry (recno, data);
       return 0;
     }
 
+  for (i=0; i < cache_table_size; i++)
+    {
+      r = cache_table + i;
+      if (r->flags.used)
+        {
+          if (r->flags.dirty)
+            dirty_count++;
+          else
+            clean_count++;
+	}
+    }
+
   /* Cache is full: discard some clean entries.  */
   if (clean_count)
     {
@@ -315,57 +564,38 @@ put_record_into_cache (ulong recno, const char *data)
       if (!n)
         n = 1;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
+      for (i=0; i < cache_table_size; i++)
         {
+          r = cache_table + i;
           if (r->flags.used && !r->flags.dirty)
             {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
+              remove_cache_entry (r);
               if (!--n)
                 break;
 	    }
 	}
 
       /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      new_cache_entry (recno, data);
       return 0;
     }
 
   /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
   if (in_transaction)
     {
       /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
+       * increase the cache size instead and only if this is not
+       * possible anymore spill them to a temporary file.  */
       if (cache_entries < MAX_CACHE_ENTRIES_HARD)
         {
           if (opt.debug && !(cache_entries % 100))
             log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
+          new_cache_entry (recno, data);
           return 0;
 	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+      if (opt.debug && !spill_count)
+        log_debug ("spilling tdbio cache entries\n");
     }
-#endif
 
   if (dirty_count)
     {
@@ -376,35 +606,31 @@ put_record_into_cache (ulong recno, const char *data)
       if (!n)
         n = 1;
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
+      if (!in_transaction)
+        take_write_lock ();
+      for (i=0; i < cache_table_size; i++)
         {
+          r = cache_table + i;
           if (r->flags.used && r->flags.dirty)
             {
               int rc;
 
-              rc = write_cache_item (r);
+              if (in_transaction)
+                rc = spill_record (r->recno, r->data);
+              else
+                rc = write_cache_item (r);
               if (rc)
                 return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
+              remove_cache_entry (r);
               if (!--n)
                 break;
 	    }
 	}
-      release_write_lock ();
+      if (!in_transaction)
+        release_write_lock ();
 
       /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      new_cache_entry (recno, data);
       return 0;
     }
 
@@ -422,20 +648,20 @@ tdbio_is_dirty (void)
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * records are written when the transaction is committed.
  */
 int
 tdbio_sync (void)
 {
     CACHE_CTRL r;
+    size_t i;
     int did_lock = 0;
 
     if( db_fd == -1 )
 	open_db();
-#if 0 /* Transactions are not yet used.  */
     if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+	return 0;
 
     if( !cache_is_dirty )
 	return 0;
@@ -443,7 +669,8 @@ tdbio_sync (void)
     if (!take_write_lock ())
         did_lock = 1;
 
-    for( r = cache_list; r; r = r->next ) {
+    for( i=0; i < cache_table_size; i++ ) {
+	r = cache_table + i;
 	if( r->flags.used && r->flags.dirty ) {
 	    int rc = write_cache_item( r );
 	    if( rc )
@@ -458,73 +685,364 @@ tdbio_sync (void)
 }
 
 
-#if 0  /* Not yet used.  */
+/* Return the malloced name of the journal file.  */
+static char *
+journal_name (void)
+{
+  return xstrconcat (db_name, ".jnl", NULL);
+}
+
+
+/* Helper for write_journal.  */
+static gpg_error_t
+put_journal_data (estream_t fp, gcry_md_hd_t md, const void *data, size_t len)
+{
+  if (es_fwrite (data, len, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  if (md)
+    gcry_md_write (md, data, len);
+  return 0;
+}
+
+
+/* Write the journal FNAME with all spilled and dirty cached records
+ * and flush it to the disk.  Once this function returned success
+ * the transaction is committed.  */
+static gpg_error_t
+write_journal (const char *fname)
+{
+  gpg_error_t err;
+  estream_t fp;
+  gcry_md_hd_t md = NULL;
+  byte buf[JOURNAL_ENTRY_LEN];
+  ulong count = 0;
+  ulong recno;
+  size_t i;
+  CACHE_CTRL r;
+  mode_t oldmask;
+
+  oldmask = umask (077);
+  fp = es_fopen (fname, "wb");
+  umask (oldmask);
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't create '%s': %s\n"), fname, gpg_strerror (err));
+      return err;
+    }
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (!err)
+    err = put_journal_data (fp, md, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+
+  /* The spilled records go first because the cache may have newer
+   * versions of them.  */
+  for (i=0; !err && i < spill_index_size; i++)
+    {
+      if (!spill_index[i].key)
+        continue;
+      recno = spill_index[i].key - 1;
+      ulongtobuf (buf, recno);
+      err = read_spilled_record (recno, buf + 4);
+      if (!err)
+        err = put_journal_data (fp, md, buf, JOURNAL_ENTRY_LEN);
+      count++;
+    }
+  for (i=0; !err && i < cache_table_size; i++)
+    {
+      r = cache_table + i;
+      if (!r->flags.used || !r->flags.dirty)
+        continue;
+      ulongtobuf (buf, r->recno);
+      memcpy (buf + 4, r->data, TRUST_RECORD_LEN);
+      err = put_journal_data (fp, md, buf, JOURNAL_ENTRY_LEN);
+      count++;
+    }
+
+  if (!err)
+    {
+      ulongtobuf (buf, count);
+      err = put_journal_data (fp, md, buf, 4);
+    }
+  if (!err)
+    err = put_journal_data (fp, NULL, gcry_md_read (md, GCRY_MD_SHA1),
+                            JOURNAL_HASH_LEN);
+  if (!err && es_fflush (fp))
+    err = gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  if (!err && fsync (es_fileno (fp)))
+    err = gpg_error_from_syserror ();
+#endif
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  gcry_md_close (md);
+
+  if (err)
+    {
+      log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (err));
+      gnupg_remove (fname);
+    }
+  else if (DBG_TRUST)
+    log_debug ("trustdb: journal with %lu records written\n", count);
+  return err;
+}
+
+
+/* Check the journal FNAME and copy its records to the trustdb.  The
+ * trustdb is flushed to the disk before returning.  An incomplete
+ * journal is not replayed and GPG_ERR_INV_DATA returned.  The number
+ * of replayed records is stored at R_COUNT.  */
+static gpg_error_t
+replay_journal (const char *fname, ulong *r_count)
+{
+  gpg_error_t err;
+  estream_t fp;
+  gcry_md_hd_t md = NULL;
+  byte buf[JOURNAL_ENTRY_LEN];
+  byte hash[JOURNAL_HASH_LEN];
+  off_t size;
+  ulong n, count, recno;
+
+  *r_count = 0;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  if (es_fseeko (fp, 0, SEEK_END) || (size = es_ftello (fp)) == -1
+      || es_fseeko (fp, 0, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  size -= JOURNAL_MAGIC_LEN + 4 + JOURNAL_HASH_LEN;
+  if (size < 0 || (size % JOURNAL_ENTRY_LEN))
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+  count = size / JOURNAL_ENTRY_LEN;
+
+  /* First pass: Check the hash.  */
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    goto leave;
+  if (es_fread (buf, JOURNAL_MAGIC_LEN, 1, fp) != 1
+      || memcmp (buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN))
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+  gcry_md_write (md, buf, JOURNAL_MAGIC_LEN);
+  for (n=0; n < count; n++)
+    {
+      if (es_fread (buf, JOURNAL_ENTRY_LEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_INV_DATA);
+          goto leave;
+        }
+      gcry_md_write (md, buf, JOURNAL_ENTRY_LEN);
+    }
+  if (es_fread (buf, 4, 1, fp) != 1
+      || es_fread (hash, JOURNAL_HASH_LEN, 1, fp) != 1)
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+  gcry_md_write (md, buf, 4);
+  if (buf32_to_ulong (buf) != count
+      || memcmp (hash, gcry_md_read (md, GCRY_MD_SHA1), JOURNAL_HASH_LEN))
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+
+  /* Second pass: Write the records.  */
+  if (es_fseeko (fp, JOURNAL_MAGIC_LEN, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (n=0; n < count; n++)
+    {
+      if (es_fread (buf, JOURNAL_ENTRY_LEN, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      recno = buf32_to_ulong (buf);
+      err = write_record_data (recno, buf + 4);
+      if (err)
+        goto leave;
+    }
+#ifdef HAVE_FSYNC
+  if (fsync (db_fd))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+#endif
+  *r_count = count;
+
+ leave:
+  gcry_md_close (md);
+  es_fclose (fp);
+  return err;
+}
+
+
+/* Replay a journal left behind by an interrupted commit.  This is
+ * called right after the trustdb has been opened for writing.  */
+static void
+recover_journal (void)
+{
+  gpg_error_t err;
+  char *fname;
+  ulong count;
+
+  fname = journal_name ();
+  if (!gnupg_access (fname, F_OK))
+    {
+      take_write_lock ();
+      /* Check again; another process may have done the recovery.  */
+      if (!gnupg_access (fname, F_OK))
+        {
+          err = replay_journal (fname, &count);
+          if (!err)
+            log_info (_("%s: %lu records recovered from the journal\n"),
+                      db_name, count);
+          else if (gpg_err_code (err) == GPG_ERR_INV_DATA)
+            log_info (_("%s: incomplete journal discarded\n"), db_name);
+          else
+            log_fatal (_("%s: error replaying the journal: %s\n"),
+                       db_name, gpg_strerror (err));
+          gnupg_remove (fname);
+        }
+      release_write_lock ();
+    }
+  xfree (fname);
+}
+
+
+/* Drop all dirty records of the current transaction so that the
+ * original ones are read back the next time.  */
+static void
+drop_transaction (void)
+{
+  size_t i;
+
+  if (cache_is_dirty)
+    {
+      for (i=0; i < cache_table_size; i++)
+        {
+          if (cache_table[i].flags.used && cache_table[i].flags.dirty)
+            remove_cache_entry (cache_table + i);
+	}
+      cache_is_dirty = 0;
+    }
+  release_spill_file ();
+  transaction_canceled = 0;
+}
+
+
 /*
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * Transactions may be nested; only the outermost end_transaction
+ * commits.  A commit first writes all changed records to a journal
+ * and flushes it; this is the commit point.  The records are then
+ * written to the trustdb and after flushing that too the journal is
+ * removed.  If the process dies in between, the journal is replayed
+ * the next time the trustdb is opened for writing.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
   int rc;
 
-  if (in_transaction)
-    log_bug ("tdbio: nested transactions\n");
-  /* Flush everything out. */
-  rc = tdbio_sync();
-  if (rc)
-    return rc;
-  in_transaction = 1;
+  if (!in_transaction)
+    {
+      /* Flush everything out. */
+      rc = tdbio_sync();
+      if (rc)
+        return rc;
+    }
+  in_transaction++;
   return 0;
 }
 
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
-  int rc;
+  gpg_error_t err;
+  char *fname;
+  size_t i;
+  ulong count;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
+  if (--in_transaction)
+    return 0;
+
+  if (transaction_canceled)
+    {
+      drop_transaction ();
+      return gpg_error (GPG_ERR_CANCELED);
+    }
+  if (!cache_is_dirty && !spill_count)
+    {
+      release_spill_file ();
+      return 0;
+    }
+
+  if (db_fd == -1)
+    open_db ();
+  fname = journal_name ();
   take_write_lock ();
   gnupg_block_all_signals ();
-  in_transaction = 0;
-  rc = tdbio_sync();
-  gnupg_unblock_all_signals();
+  err = write_journal (fname);
+  if (err)
+    {
+      /* Not committed; make sure that the dirty records are not
+       * written later by tdbio_sync.  */
+      drop_transaction ();
+    }
+  else
+    {
+      err = replay_journal (fname, &count);
+      if (!err)
+        gnupg_remove (fname);
+      else /* The journal will be replayed by the next process.  */
+        log_error (_("%s: error replaying the journal: %s\n"),
+                   db_name, gpg_strerror (err));
+    }
+  if (!err)
+    {
+      for (i=0; i < cache_table_size; i++)
+        cache_table[i].flags.dirty = 0;
+      cache_is_dirty = 0;
+    }
+  gnupg_unblock_all_signals ();
   release_write_lock ();
-  return rc;
+  release_spill_file ();
+  xfree (fname);
+  return err;
 }
 
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
-  CACHE_CTRL r;
-
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
 
-  /* Remove all dirty marked entries, so that the original ones are
-   * read back the next time.  */
-  if (cache_is_dirty)
-    {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
-    }
-
-  in_transaction = 0;
+  if (--in_transaction)
+    transaction_canceled = 1;  /* Let the outermost level cancel.  */
+  else
+    drop_transaction ();
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
 
@@ -771,6 +1289,44 @@ tdbio_get_dbname (void)
 }
 
 
+#ifdef HAVE_MMAP
+/*
+ * Return a pointer to the record RECNO in the mapped trustdb or NULL
+ * if that record can't be accessed this way.  If the record is
+ * behind the end of the current mapping the file is mapped again.
+ */
+static const byte *
+get_record_from_map (ulong recno)
+{
+  off_t off = (off_t)recno * TRUST_RECORD_LEN;
+  struct stat st;
+  void *p;
+
+  if (off + TRUST_RECORD_LEN <= (off_t)db_map_len)
+    return db_map + off;
+
+  if (db_map_failed || fstat (db_fd, &st)
+      || off + TRUST_RECORD_LEN > st.st_size)
+    return NULL;
+  if (db_map)
+    munmap ((void *)db_map, db_map_len);
+  db_map = NULL;
+  db_map_len = 0;
+  p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, db_fd, 0);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_TRUST)
+        log_debug ("trustdb: mmap failed: %s\n", strerror (errno));
+      db_map_failed = 1;
+      return NULL;
+    }
+  db_map = p;
+  db_map_len = st.st_size;
+  return db_map + off;
+}
+#endif /*HAVE_MMAP*/
+
+
 /*
  * Open the trustdb.  This may only be called if it has not yet been
  * opened and after a successful call to tdbio_set_dbname.  On return
@@ -780,6 +1336,7 @@ static void
 open_db (void)
 {
   TRUSTREC rec;
+  int writable = 1;
 
   log_assert( db_fd == -1 );
 
@@ -794,12 +1351,17 @@ open_db (void)
       db_fd = gnupg_open (db_name, O_RDONLY | MY_O_BINARY, 0);
       if (db_fd != -1 && !opt.quiet)
           log_info (_("Note: trustdb not writable\n"));
+      writable = 0;
   }
   if ( db_fd == -1 )
     log_fatal( _("can't open '%s': %s\n"), db_name, strerror(errno) );
 
   register_secured_file (db_name);
 
+  /* Finish an interrupted commit before reading anything.  */
+  if (writable)
+    recover_journal ();
+
   /* Read the version record. */
   if (tdbio_read_record (0, &rec, RECTYPE_VER ) )
     log_fatal( _("%s: invalid trustdb\n"), db_name );
@@ -1456,10 +2018,12 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
       es_fprintf (fp, "trust ");
       for (i=0; i < 20; i++)
         es_fprintf (fp, "%02X", rec->r.trust.fingerprint[i]);
-      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu, mo=%d, f=%02x\n",
+      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu, mo=%d, f=%02x,"
+                  " wd=%d, wf=%02x\n",
                   rec->r.trust.ownertrust,
                   rec->r.trust.depth, rec->r.trust.validlist,
-                  rec->r.trust.min_ownertrust, rec->r.trust.flags);
+                  rec->r.trust.min_ownertrust, rec->r.trust.flags,
+                  rec->r.trust.wot_depth, rec->r.trust.wot_flags);
       break;
 
     case RECTYPE_VALID:
@@ -1497,6 +2061,19 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
     open_db ();
 
   buf = get_record_from_cache( recnum );
+  if (!buf && in_transaction)
+    {
+      err = read_spilled_record (recnum, readbuf);
+      if (!err)
+        buf = readbuf;
+      else if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+        return err;
+      err = 0;
+    }
+#ifdef HAVE_MMAP
+  if (!buf)
+    buf = get_record_from_map (recnum);
+#endif
   if (!buf)
     {
       if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
@@ -1555,7 +2132,9 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           p += 4;
           rec->r.ver.nextcheck = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.wotflags = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.wotnextcheck = buf32_to_ulong(p);
           p += 4;
           rec->r.ver.firstfree = buf32_to_ulong(p);
           p += 4;
@@ -1606,6 +2185,9 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
       rec->r.trust.min_ownertrust = *p++;
       rec->r.trust.flags = *p++;
       rec->r.trust.validlist = buf32_to_ulong(p);
+      p += 4;
+      rec->r.trust.wot_depth = *p++;
+      rec->r.trust.wot_flags = *p++;
       break;
 
     case RECTYPE_VALID:
@@ -1668,8 +2250,8 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       p += 2;
       ulongtobuf(p, rec->r.ver.created); p += 4;
       ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
-      p += 4;
-      p += 4;
+      ulongtobuf(p, rec->r.ver.wotflags); p += 4;
+      ulongtobuf(p, rec->r.ver.wotnextcheck); p += 4;
       ulongtobuf(p, rec->r.ver.firstfree ); p += 4;
       p += 4;
       ulongtobuf(p, rec->r.ver.trusthashtbl ); p += 4;
@@ -1701,6 +2283,8 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       *p++ = rec->r.trust.min_ownertrust;
       *p++ = rec->r.trust.flags;
       ulongtobuf( p, rec->r.trust.validlist); p += 4;
+      *p++ = rec->r.trust.wot_depth;
+      *p++ = rec->r.trust.wot_flags;
       break;
 
     case RECTYPE_VALID:
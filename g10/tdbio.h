@@ -40,6 +40,13 @@
 #define RECTYPE_VALID 13
 #define RECTYPE_FREE 254
 
+/* Flags for the wotflags of the version record.  */
+#define TDB_WOTFLAG_SIGNERS 1  /* wot_depth and wot_flags are valid.  */
+
+/* Flags for the wot_flags of a trust record.  */
+#define WOT_FLAG_REGEXP  1  /* The signer's trust sig has a regexp.  */
+#define WOT_FLAG_CHANGED 2  /* The key needs to be revalidated.  */
+
 
 struct trust_record {
     int  rectype;
@@ -57,8 +64,8 @@ struct trust_record {
 	    byte  min_cert_level;
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
-	    ulong reserved;
-	    ulong reserved2;
+	    ulong wotflags;  /* TDB_WOTFLAG_* values.  */
+	    ulong wotnextcheck; /* nextcheck saved while a key is pending */
 	    ulong firstfree;
 	    ulong reserved3;
             ulong trusthashtbl;
@@ -80,6 +87,8 @@ struct trust_record {
         ulong validlist;
 	byte min_ownertrust;
         byte flags;
+        byte wot_depth;  /* 1 + depth the key was a signer at or 0.  */
+        byte wot_flags;  /* WOT_FLAG_* values.  */
       } trust;
       struct {
         byte namehash[20];
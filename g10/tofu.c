@@ -56,6 +56,41 @@
 #define FULL_TRUST_THRESHOLD  21
 
 
+/* The number of hash buckets and the maximum number of items of the
+ * binding cache.  */
+#define BINDING_CACHE_BUCKETS   256
+#define BINDING_CACHE_MAX_ITEMS 4096
+
+/* The maximum number of signatures queued during a batch update
+ * before they are written to the DB.  */
+#define MAX_PENDING_SIGNATURES  1000
+
+/* An item of the binding cache.  It caches the policy, conflict and
+ * effective_policy columns of the binding <FINGERPRINT, EMAIL>.
+ * POLICY is TOFU_POLICY_NONE if the binding is not in the DB.  */
+struct binding_cache_item
+{
+  struct binding_cache_item *next;
+  enum tofu_policy policy;
+  enum tofu_policy effective_policy;
+  char *conflict;   /* Malloced or NULL.  */
+  char *email;      /* Points into FINGERPRINT.  */
+  char fingerprint[1];
+};
+
+/* A signature observation waiting to be written to the DB.  */
+struct pending_signature
+{
+  struct pending_signature *next;
+  time_t sig_time;
+  time_t now;
+  char *email;       /* These point into FINGERPRINT.  */
+  char *sig_digest;
+  char *origin;
+  char fingerprint[1];
+};
+
+
 /* A struct with data pertaining to the tofu DB.  There is one such
    struct per session and it is cached in session's ctrl structure.
    To initialize this or get the current singleton, call opendbs().
@@ -82,11 +117,24 @@ struct tofu_dbs_s
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
     sqlite3_stmt *register_encryption;
+    sqlite3_stmt *register_signature_stats;
+    sqlite3_stmt *register_encryption_stats;
+    sqlite3_stmt *get_binding_stats;
   } s;
 
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
+
+  /* The binding cache.  */
+  struct binding_cache_item *binding_cache[BINDING_CACHE_BUCKETS];
+  unsigned int binding_cache_count;
+
+  /* Signatures registered during a batch update but not yet written
+   * to the DB.  */
+  struct pending_signature *pending_sigs;
+  struct pending_signature **pending_sigs_tail;
+  unsigned int pending_sigs_count;
 };
 
 
@@ -110,6 +158,8 @@ struct tofu_dbs_s
 
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
+static void flush_binding_cache (tofu_dbs_t dbs);
+static gpg_error_t write_pending_signatures (tofu_dbs_t dbs);
 static char *email_from_user_id (const char *user_id);
 static int show_statistics (tofu_dbs_t dbs,
                             const char *fingerprint, const char *email,
@@ -347,6 +397,9 @@ rollback_transaction (ctrl_t ctrl)
                            "rollback to inner%d;",
                            dbs->in_transaction);
 
+  /* The binding cache may now be out of sync with the DB.  */
+  flush_binding_cache (dbs);
+
   dbs->in_transaction --;
 
   if (rc)
@@ -369,8 +422,23 @@ tofu_begin_batch_update (ctrl_t ctrl)
 void
 tofu_end_batch_update (ctrl_t ctrl)
 {
+  tofu_dbs_t dbs = ctrl->tofu.dbs;
+  gpg_error_t err;
+
   log_assert (ctrl->tofu.batch_updated_wanted > 0);
   ctrl->tofu.batch_updated_wanted --;
+
+  /* Write the queued signatures in one transaction.  Note that this
+   * starts a batch transaction which is committed right away.  */
+  if (!ctrl->tofu.batch_updated_wanted && dbs && dbs->pending_sigs
+      && !dbs->in_transaction)
+    {
+      begin_transaction (ctrl, 1);
+      err = write_pending_signatures (dbs);
+      if (err)
+        log_error ("error writing queued TOFU signatures: %s\n",
+                   gpg_strerror (err));
+    }
   end_transaction (ctrl, 1);
 }
 
@@ -845,6 +913,56 @@ initdb (sqlite3 *db)
           sqlite3_free (err);
         }
     }
+  if (! rc)
+    {
+      /* Summary statistics for each binding.  This table is updated
+       * along with the signatures and encryptions tables so that
+       * show_statistics does not need to scan them.  The days are
+       * the number of distinct days (TIME / 86400) on which
+       * signatures were seen or messages were encrypted.  If the
+       * table does not yet exist, it is created from the existing
+       * records.  */
+      rc = sqlite3_exec (db,
+                         "select count(*) from sqlite_master"
+                         " where type='table' and name='binding_stats';",
+                         get_single_unsigned_long_cb, &count, &err);
+      if (!rc && !count)
+        rc = sqlite3_exec
+          (db,
+           "create table binding_stats\n"
+           " (binding INTEGER PRIMARY KEY,\n"
+           "  sig_count INTEGER DEFAULT 0, sig_first INTEGER DEFAULT 0,\n"
+           "  sig_last INTEGER DEFAULT 0, sig_days INTEGER DEFAULT 0,\n"
+           "  enc_count INTEGER DEFAULT 0, enc_first INTEGER DEFAULT 0,\n"
+           "  enc_last INTEGER DEFAULT 0, enc_days INTEGER DEFAULT 0);\n"
+           "insert into binding_stats (binding)\n"
+           " select oid from bindings;\n"
+           "update binding_stats set\n"
+           " sig_count = (select count (*) from signatures\n"
+           "               where binding = binding_stats.binding),\n"
+           " sig_first = (select coalesce (min (time), 0) from signatures\n"
+           "               where binding = binding_stats.binding),\n"
+           " sig_last = (select coalesce (max (time), 0) from signatures\n"
+           "              where binding = binding_stats.binding),\n"
+           " sig_days = (select count (distinct time / 86400) from signatures\n"
+           "              where binding = binding_stats.binding),\n"
+           " enc_count = (select count (*) from encryptions\n"
+           "               where binding = binding_stats.binding),\n"
+           " enc_first = (select coalesce (min (time), 0) from encryptions\n"
+           "               where binding = binding_stats.binding),\n"
+           " enc_last = (select coalesce (max (time), 0) from encryptions\n"
+           "              where binding = binding_stats.binding),\n"
+           " enc_days = (select count (distinct time / 86400)"
+           " from encryptions\n"
+           "              where binding = binding_stats.binding);\n",
+           NULL, NULL, &err);
+      if (rc)
+        {
+	  log_error ("error creating 'binding_stats' TOFU table: %s\n",
+		     err);
+          sqlite3_free (err);
+        }
+    }
   if (! rc)
     {
       /* The effective policy for a binding.  If a key is ultimately
@@ -995,6 +1113,7 @@ tofu_closedbs (ctrl_t ctrl)
 {
   tofu_dbs_t dbs;
   sqlite3_stmt **statements;
+  gpg_error_t err;
 
   dbs = ctrl->tofu.dbs;
   if (!dbs)
@@ -1002,7 +1121,16 @@ tofu_closedbs (ctrl_t ctrl)
 
   log_assert (dbs->in_transaction == 0);
 
+  if (dbs->pending_sigs)
+    {
+      begin_transaction (ctrl, 1);
+      err = write_pending_signatures (dbs);
+      if (err)
+        log_error ("error writing queued TOFU signatures: %s\n",
+                   gpg_strerror (err));
+    }
   end_transaction (ctrl, 2);
+  flush_binding_cache (dbs);
 
   /* Arghh, that is a surprising use of the struct.  */
   for (statements = (void *) &dbs->s;
@@ -1042,6 +1170,118 @@ get_single_long_cb2 (void *cookie, int argc, char **argv, char **azColName,
   return get_single_long_cb (cookie, argc, argv, azColName);
 }
 
+/* Return the bucket of the binding cache for FINGERPRINT.  All
+ * bindings of a key are in the same bucket.  */
+static struct binding_cache_item **
+binding_cache_bucket (tofu_dbs_t dbs, const char *fingerprint)
+{
+  unsigned int hash = 0;
+
+  for (; *fingerprint; fingerprint++)
+    hash = hash * 33 + *(const unsigned char *)fingerprint;
+  return &dbs->binding_cache[hash % BINDING_CACHE_BUCKETS];
+}
+
+
+static void
+release_binding_cache_item (struct binding_cache_item *item)
+{
+  xfree (item->conflict);
+  xfree (item);
+}
+
+
+/* Remove all items from the binding cache.  */
+static void
+flush_binding_cache (tofu_dbs_t dbs)
+{
+  struct binding_cache_item *item;
+  int i;
+
+  for (i=0; i < BINDING_CACHE_BUCKETS; i++)
+    while ((item = dbs->binding_cache[i]))
+      {
+        dbs->binding_cache[i] = item->next;
+        release_binding_cache_item (item);
+      }
+  dbs->binding_cache_count = 0;
+}
+
+
+/* Return the cached binding <FINGERPRINT, EMAIL> or NULL.  */
+static struct binding_cache_item *
+find_cached_binding (tofu_dbs_t dbs, const char *fingerprint,
+                     const char *email)
+{
+  struct binding_cache_item *item;
+
+  for (item = *binding_cache_bucket (dbs, fingerprint); item; item = item->next)
+    if (!strcmp (item->fingerprint, fingerprint)
+        && !strcmp (item->email, email))
+      return item;
+  return NULL;
+}
+
+
+/* Remove the binding <FINGERPRINT, EMAIL> from the cache.  If EMAIL
+ * is NULL all bindings of FINGERPRINT are removed.  */
+static void
+invalidate_cached_binding (tofu_dbs_t dbs, const char *fingerprint,
+                           const char *email)
+{
+  struct binding_cache_item *item, **itemp;
+
+  itemp = binding_cache_bucket (dbs, fingerprint);
+  while ((item = *itemp))
+    {
+      if (!strcmp (item->fingerprint, fingerprint)
+          && (!email || !strcmp (item->email, email)))
+        {
+          *itemp = item->next;
+          release_binding_cache_item (item);
+          dbs->binding_cache_count--;
+        }
+      else
+        itemp = &item->next;
+    }
+}
+
+
+/* Store the DB values of the binding <FINGERPRINT, EMAIL> in the
+ * cache.  */
+static void
+cache_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+               enum tofu_policy policy, enum tofu_policy effective_policy,
+               const char *conflict)
+{
+  struct binding_cache_item *item, **bucket;
+  size_t fprlen = strlen (fingerprint);
+
+  invalidate_cached_binding (dbs, fingerprint, email);
+  if (dbs->binding_cache_count >= BINDING_CACHE_MAX_ITEMS)
+    flush_binding_cache (dbs);
+
+  item = xtrymalloc (sizeof *item + fprlen + 1 + strlen (email));
+  if (!item)
+    return;  /* It is just a cache.  */
+  strcpy (item->fingerprint, fingerprint);
+  item->email = item->fingerprint + fprlen + 1;
+  strcpy (item->email, email);
+  item->policy = policy;
+  item->effective_policy = effective_policy;
+  item->conflict = conflict && *conflict? xtrystrdup (conflict) : NULL;
+  if (conflict && *conflict && !item->conflict)
+    {
+      xfree (item);
+      return;
+    }
+  bucket = binding_cache_bucket (dbs, fingerprint);
+  item->next = *bucket;
+  *bucket = item;
+  dbs->binding_cache_count++;
+}
+
+
 /* Record (or update) a trust policy about a (possibly new)
    binding.
 
@@ -1152,7 +1392,16 @@ record_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
       goto leave;
     }
 
+  if (set_conflict)
+    {
+      cache_binding (dbs, fingerprint, email, policy, effective_policy,
+                     conflict);
+      goto leave_cached;
+    }
+
  leave:
+  invalidate_cached_binding (dbs, fingerprint, email);
+ leave_cached:
   xfree (fingerprint_pp);
   return rc;
 }
@@ -1639,6 +1888,10 @@ ask_about_binding (ctrl_t ctrl,
       free_strlist (other_user_ids);
     }
 
+  /* Make sure that queued signatures are counted.  */
+  if (dbs->pending_sigs)
+    write_pending_signatures (dbs);
+
   /* Get the stats for all the keys in CONFLICT_SET.  */
   strlist_rev (&conflict_set);
   for (iter = conflict_set; iter && ! rc; iter = iter->next)
@@ -2341,6 +2594,17 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
   char *conflict = NULL;
   strlist_t conflict_set = NULL;
   int conflict_set_count;
+  struct binding_cache_item *cached;
+
+  cached = find_cached_binding (dbs, fingerprint, email);
+  if (cached)
+    {
+      policy = cached->policy;
+      effective_policy = cached->effective_policy;
+      if (cached->conflict)
+        conflict = xstrdup (cached->conflict);
+      goto have_binding;
+    }
 
   /* Check if the <FINGERPRINT, EMAIL> binding is known
      (TOFU_POLICY_NONE cannot appear in the DB.  Thus, if POLICY is
@@ -2433,6 +2697,9 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
       goto out;
     }
 
+  cache_binding (dbs, fingerprint, email, policy, effective_policy, conflict);
+
+ have_binding:
   /* Save the effective policy and conflict so we know if we changed
    * them.  */
   effective_policy_orig = effective_policy;
@@ -2840,6 +3107,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
       else if (DBG_TRUST)
         log_debug ("Set %s to conflict with %s\n",
                    iter->d, fingerprint);
+      invalidate_cached_binding (dbs, iter->d, email);
     }
 
  out:
@@ -3009,92 +3277,26 @@ show_statistics (tofu_dbs_t dbs,
   if (only_status_fd && ! is_status_enabled ())
     return 0;
 
-  fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
-
-  /* Get the signature stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (signatures.time), 0),\n"
-     "  coalesce (max (signatures.time), 0)\n"
-     " from signatures\n"
-     " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting signature statistics");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(signatures.time / (24 * 60 * 60)) day\n"
-     "    from signatures\n"
-     "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting signature statistics (by day)");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-
-  if (strlist)
-    {
-      /* We expect exactly 4 elements.  */
-      log_assert (strlist->next);
-      log_assert (strlist->next->next);
-      log_assert (strlist->next->next->next);
-      log_assert (! strlist->next->next->next->next);
+  /* Make sure that queued signatures are counted.  */
+  if (dbs->pending_sigs)
+    write_pending_signatures (dbs);
 
-      string_to_ulong (&signature_days, strlist->d, -1, __LINE__);
-      string_to_ulong (&signature_count, strlist->next->d, -1, __LINE__);
-      string_to_ulong (&signature_first_seen,
-                       strlist->next->next->d, -1, __LINE__);
-      string_to_ulong (&signature_most_recent,
-                       strlist->next->next->next->d, -1, __LINE__);
-
-      free_strlist (strlist);
-      strlist = NULL;
-    }
+  fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
-  /* Get the encryption stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (encryptions.time), 0),\n"
-     "  coalesce (max (encryptions.time), 0)\n"
-     " from encryptions\n"
-     " left join bindings on encryptions.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting encryption statistics");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
-     "    from encryptions\n"
-     "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
+  /* Get the signature and encryption stats.  */
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.get_binding_stats, strings_collect_cb2, &strlist, &err,
+     "select sig_count, sig_first, sig_last, sig_days,\n"
+     "  enc_count, enc_first, enc_last, enc_days\n"
+     " from binding_stats\n"
+     " left join bindings on binding_stats.binding = bindings.oid\n"
+     " where fingerprint = ? and email = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting encryption statistics (by day)");
+      print_further_info ("getting statistics");
       sqlite3_free (err);
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
@@ -3102,18 +3304,26 @@ show_statistics (tofu_dbs_t dbs,
 
   if (strlist)
     {
-      /* We expect exactly 4 elements.  */
-      log_assert (strlist->next);
-      log_assert (strlist->next->next);
-      log_assert (strlist->next->next->next);
-      log_assert (! strlist->next->next->next->next);
-
-      string_to_ulong (&encryption_days, strlist->d, -1, __LINE__);
-      string_to_ulong (&encryption_count, strlist->next->d, -1, __LINE__);
-      string_to_ulong (&encryption_first_done,
-                       strlist->next->next->d, -1, __LINE__);
-      string_to_ulong (&encryption_most_recent,
-                       strlist->next->next->next->d, -1, __LINE__);
+      strlist_t sl = strlist;
+
+      /* We expect exactly 8 elements.  */
+      log_assert (strlist_length (strlist) == 8);
+
+      string_to_ulong (&signature_count, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&signature_first_seen, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&signature_most_recent, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&signature_days, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&encryption_count, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&encryption_first_done, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&encryption_most_recent, sl->d, -1, __LINE__);
+      sl = sl->next;
+      string_to_ulong (&encryption_days, sl->d, -1, __LINE__);
 
       free_strlist (strlist);
       strlist = NULL;
@@ -3300,6 +3510,180 @@ email_from_user_id (const char *user_id)
   return email;
 }
 
+/* Account for a signature (PREFIX is "sig") or an encryption (PREFIX
+ * is "enc") registered at time ?1 for the binding <?2, ?3> in the
+ * binding_stats table.  This must be run before the record is
+ * inserted into TABLE so that the check whether there is already a
+ * record for that day does not find the new one.  */
+#define UPDATE_STATS_SQL(prefix, table)                                  \
+  "insert into binding_stats\n"                                          \
+  " (binding, "prefix"_count, "prefix"_first, "prefix"_last,"            \
+  "  "prefix"_days)\n"                                                   \
+  " select oid, 1, ?1, ?1, 1 from bindings\n"                            \
+  "  where fingerprint = ?2 and email = ?3\n"                            \
+  " on conflict (binding) do update set\n"                               \
+  "  "prefix"_days = "prefix"_days + case\n"                             \
+  "   when "prefix"_count = 0 or ?1 / 86400 > "prefix"_last / 86400\n"   \
+  "    then 1\n"                                                         \
+  "   when ?1 / 86400 = "prefix"_last / 86400 then 0\n"                  \
+  "   when exists (select 1 from "table"\n"                              \
+  "                 where binding = binding_stats.binding\n"             \
+  "                  and time / 86400 = ?1 / 86400) then 0\n"            \
+  "   else 1 end,\n"                                                     \
+  "  "prefix"_first = case\n"                                            \
+  "   when "prefix"_count = 0 or ?1 < "prefix"_first then ?1\n"          \
+  "   else "prefix"_first end,\n"                                        \
+  "  "prefix"_last = max ("prefix"_last, ?1),\n"                         \
+  "  "prefix"_count = "prefix"_count + 1;"
+
+
+/* Update the statistics of the binding <FINGERPRINT, EMAIL> for a
+ * signature or, if IS_ENCRYPTION is set, an encryption registered at
+ * NOW.  */
+static gpg_error_t
+update_binding_stats (tofu_dbs_t dbs, int is_encryption,
+                      const char *fingerprint, const char *email,
+                      time_t now)
+{
+  int rc;
+  char *sqlerr = NULL;
+
+  if (is_encryption)
+    rc = gpgsql_stepx
+      (dbs->db, &dbs->s.register_encryption_stats, NULL, NULL, &sqlerr,
+       UPDATE_STATS_SQL ("enc", "encryptions"),
+       GPGSQL_ARG_LONG_LONG, (long long) now,
+       GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+       GPGSQL_ARG_END);
+  else
+    rc = gpgsql_stepx
+      (dbs->db, &dbs->s.register_signature_stats, NULL, NULL, &sqlerr,
+       UPDATE_STATS_SQL ("sig", "signatures"),
+       GPGSQL_ARG_LONG_LONG, (long long) now,
+       GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+       GPGSQL_ARG_END);
+  if (rc)
+    {
+      log_error (_("error updating TOFU database: %s\n"), sqlerr);
+      print_further_info ("update binding_stats");
+      sqlite3_free (sqlerr);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+  return 0;
+}
+
+
+/* Write the signature observations queued by tofu_register_signature
+ * to the DB.  The queue is emptied even on error.  This function
+ * should be called while in a transaction.  */
+static gpg_error_t
+write_pending_signatures (tofu_dbs_t dbs)
+{
+  gpg_error_t rc = 0;
+  struct pending_signature *ps;
+  char *sqlerr = NULL;
+  unsigned long c;
+
+  while ((ps = dbs->pending_sigs))
+    {
+      dbs->pending_sigs = ps->next;
+
+      if (rc)
+        goto next;  /* Drop the remaining items after an error.  */
+
+      /* If we've already seen this signature before, then don't add
+         it again.  */
+      rc = gpgsql_stepx
+        (dbs->db, &dbs->s.register_already_seen,
+         get_single_unsigned_long_cb2, &c, &sqlerr,
+         "select count (*)\n"
+         " from signatures left join bindings\n"
+         "  on signatures.binding = bindings.oid\n"
+         " where fingerprint = ? and email = ? and sig_time = ?\n"
+         "  and sig_digest = ?",
+         GPGSQL_ARG_STRING, ps->fingerprint, GPGSQL_ARG_STRING, ps->email,
+         GPGSQL_ARG_LONG_LONG, (long long) ps->sig_time,
+         GPGSQL_ARG_STRING, ps->sig_digest,
+         GPGSQL_ARG_END);
+      if (rc)
+        {
+          log_error (_("error reading TOFU database: %s\n"), sqlerr);
+          print_further_info ("checking existence");
+          sqlite3_free (sqlerr);
+          rc = gpg_error (GPG_ERR_GENERAL);
+        }
+      else if (c > 1)
+        /* Duplicates!  This should not happen.  In particular,
+           because <fingerprint, email, sig_time, sig_digest> is the
+           primary key!  */
+        log_debug ("SIGNATURES DB contains duplicate records"
+                   " <key: %s, email: %s, time: 0x%lx, sig: %s,"
+                   " origin: %s>."
+                   "  Please report.\n",
+                   ps->fingerprint, ps->email, (unsigned long) ps->sig_time,
+                   ps->sig_digest, ps->origin);
+      else if (c == 1)
+        {
+          if (DBG_TRUST)
+            log_debug ("Already observed the signature and binding"
+                       " <key: %s, email: %s, time: 0x%lx, sig: %s,"
+                       " origin: %s>\n",
+                       ps->fingerprint, ps->email,
+                       (unsigned long) ps->sig_time,
+                       ps->sig_digest, ps->origin);
+        }
+      else if (opt.dry_run)
+        {
+          log_info ("TOFU database update skipped due to --dry-run\n");
+        }
+      else
+        /* This is the first time that we've seen this signature and
+           binding.  Record it.  */
+        {
+          if (DBG_TRUST)
+            log_debug ("TOFU: Saving signature"
+                       " <key: %s, user id: %s, sig: %s>\n",
+                       ps->fingerprint, ps->email, ps->sig_digest);
+
+          log_assert (c == 0);
+
+          rc = update_binding_stats (dbs, 0, ps->fingerprint, ps->email,
+                                     ps->now);
+          if (rc)
+            goto next;
+
+          rc = gpgsql_stepx
+            (dbs->db, &dbs->s.register_signature, NULL, NULL, &sqlerr,
+             "insert into signatures\n"
+             " (binding, sig_digest, origin, sig_time, time)\n"
+             " values\n"
+             " ((select oid from bindings\n"
+             "    where fingerprint = ? and email = ?),\n"
+             "  ?, ?, ?, ?);",
+             GPGSQL_ARG_STRING, ps->fingerprint, GPGSQL_ARG_STRING, ps->email,
+             GPGSQL_ARG_STRING, ps->sig_digest, GPGSQL_ARG_STRING, ps->origin,
+             GPGSQL_ARG_LONG_LONG, (long long) ps->sig_time,
+             GPGSQL_ARG_LONG_LONG, (long long) ps->now,
+             GPGSQL_ARG_END);
+          if (rc)
+            {
+              log_error (_("error updating TOFU database: %s\n"), sqlerr);
+              print_further_info ("insert signatures");
+              sqlite3_free (sqlerr);
+              rc = gpg_error (GPG_ERR_GENERAL);
+            }
+        }
+
+    next:
+      xfree (ps);
+    }
+  dbs->pending_sigs_tail = NULL;
+  dbs->pending_sigs_count = 0;
+
+  return rc;
+}
+
+
 /* Register the signature with the bindings <fingerprint, USER_ID>,
    for each USER_ID in USER_ID_LIST.  The fingerprint is taken from
    the primary key packet PK.
@@ -3318,6 +3702,10 @@ email_from_user_id (const char *user_id)
    This is necessary if there is a conflict or the binding's policy is
    TOFU_POLICY_ASK.
 
+   During a batch update the signatures are only queued and written
+   to the DB at the end of the batch update or before the signature
+   statistics are read.
+
    This function returns 0 on success and an error code if an error
    occurred.  */
 gpg_error_t
@@ -3332,9 +3720,12 @@ tofu_register_signature (ctrl_t ctrl,
   char *fingerprint = NULL;
   strlist_t user_id;
   char *email = NULL;
-  char *sqlerr = NULL;
   char *sig_digest = NULL;
-  unsigned long c;
+  struct pending_signature *queue = NULL;
+  struct pending_signature **queue_tail = &queue;
+  struct pending_signature *ps;
+  unsigned int queue_count = 0;
+  char *p;
 
   dbs = opendbs (ctrl);
   if (! dbs)
@@ -3389,90 +3780,54 @@ tofu_register_signature (ctrl_t ctrl,
           break;
         }
 
-      /* If we've already seen this signature before, then don't add
-         it again.  */
-      rc = gpgsql_stepx
-        (dbs->db, &dbs->s.register_already_seen,
-         get_single_unsigned_long_cb2, &c, &sqlerr,
-         "select count (*)\n"
-         " from signatures left join bindings\n"
-         "  on signatures.binding = bindings.oid\n"
-         " where fingerprint = ? and email = ? and sig_time = ?\n"
-         "  and sig_digest = ?",
-         GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
-         GPGSQL_ARG_LONG_LONG, (long long) sig_time,
-         GPGSQL_ARG_STRING, sig_digest,
-         GPGSQL_ARG_END);
-      if (rc)
-        {
-          log_error (_("error reading TOFU database: %s\n"), sqlerr);
-          print_further_info ("checking existence");
-          sqlite3_free (sqlerr);
-          rc = gpg_error (GPG_ERR_GENERAL);
-        }
-      else if (c > 1)
-        /* Duplicates!  This should not happen.  In particular,
-           because <fingerprint, email, sig_time, sig_digest> is the
-           primary key!  */
-        log_debug ("SIGNATURES DB contains duplicate records"
-                   " <key: %s, email: %s, time: 0x%lx, sig: %s,"
-                   " origin: %s>."
-                   "  Please report.\n",
-                   fingerprint, email, (unsigned long) sig_time,
-                   sig_digest, origin);
-      else if (c == 1)
-        {
-          if (DBG_TRUST)
-            log_debug ("Already observed the signature and binding"
-                       " <key: %s, email: %s, time: 0x%lx, sig: %s,"
-                       " origin: %s>\n",
-                       fingerprint, email, (unsigned long) sig_time,
-                       sig_digest, origin);
-        }
-      else if (opt.dry_run)
-        {
-          log_info ("TOFU database update skipped due to --dry-run\n");
-        }
-      else
-        /* This is the first time that we've seen this signature and
-           binding.  Record it.  */
+      /* Queue the signature.  */
+      ps = xtrymalloc (sizeof *ps + strlen (fingerprint) + strlen (email)
+                       + strlen (sig_digest) + strlen (origin) + 3);
+      if (!ps)
         {
-          if (DBG_TRUST)
-            log_debug ("TOFU: Saving signature"
-                       " <key: %s, user id: %s, sig: %s>\n",
-                       fingerprint, email, sig_digest);
-
-          log_assert (c == 0);
-
-          rc = gpgsql_stepx
-            (dbs->db, &dbs->s.register_signature, NULL, NULL, &sqlerr,
-             "insert into signatures\n"
-             " (binding, sig_digest, origin, sig_time, time)\n"
-             " values\n"
-             " ((select oid from bindings\n"
-             "    where fingerprint = ? and email = ?),\n"
-             "  ?, ?, ?, ?);",
-             GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
-             GPGSQL_ARG_STRING, sig_digest, GPGSQL_ARG_STRING, origin,
-             GPGSQL_ARG_LONG_LONG, (long long) sig_time,
-             GPGSQL_ARG_LONG_LONG, (long long) now,
-             GPGSQL_ARG_END);
-          if (rc)
-            {
-              log_error (_("error updating TOFU database: %s\n"), sqlerr);
-              print_further_info ("insert signatures");
-              sqlite3_free (sqlerr);
-              rc = gpg_error (GPG_ERR_GENERAL);
-            }
+          rc = gpg_error_from_syserror ();
+          xfree (email);
+          break;
         }
+      p = stpcpy (ps->fingerprint, fingerprint) + 1;
+      ps->email = p;
+      p = stpcpy (p, email) + 1;
+      ps->sig_digest = p;
+      p = stpcpy (p, sig_digest) + 1;
+      ps->origin = p;
+      strcpy (p, origin);
+      ps->next = NULL;
+      ps->sig_time = sig_time;
+      ps->now = now;
+      *queue_tail = ps;
+      queue_tail = &ps->next;
+      queue_count++;
 
       xfree (email);
+    }
 
-      if (rc)
-        break;
+  if (!rc && queue)
+    {
+      if (dbs->pending_sigs)
+        *dbs->pending_sigs_tail = queue;
+      else
+        dbs->pending_sigs = queue;
+      dbs->pending_sigs_tail = queue_tail;
+      dbs->pending_sigs_count += queue_count;
+      queue = NULL;
+
+      if (!ctrl->tofu.batch_updated_wanted
+          || dbs->pending_sigs_count >= MAX_PENDING_SIGNATURES)
+        rc = write_pending_signatures (dbs);
     }
 
  leave:
+  while ((ps = queue))
+    {
+      queue = ps->next;
+      xfree (ps);
+    }
+
   if (rc)
     rollback_transaction (ctrl);
   else
@@ -3592,6 +3947,13 @@ tofu_register_encryption (ctrl_t ctrl,
 
       free_strlist (conflict_set);
 
+      rc = update_binding_stats (dbs, 1, fingerprint, email, now);
+      if (rc)
+        {
+          xfree (email);
+          break;
+        }
+
       rc = gpgsql_stepx
         (dbs->db, &dbs->s.register_encryption, NULL, NULL, &sqlerr,
          "insert into encryptions\n"
@@ -4033,6 +4395,7 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
                      GPGSQL_ARG_INT, (int) TOFU_POLICY_NONE,
                      GPGSQL_ARG_STRING, fingerprint,
                      GPGSQL_ARG_END);
+  invalidate_cached_binding (dbs, fingerprint, NULL);
   xfree (fingerprint);
 
   if (rc == _tofu_GET_POLICY_ERROR)
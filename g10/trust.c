@@ -297,6 +297,20 @@ revalidation_mark (ctrl_t ctrl)
 }
 
 
+/* Same as revalidation_mark but used if only the signatures on the
+ * primary key PK have changed.  */
+void
+revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+#ifdef NO_TRUST_MODELS
+  (void)ctrl;
+  (void)pk;
+#else
+  tdb_revalidation_mark_key (ctrl, pk);
+#endif
+}
+
+
 void
 check_trustdb_stale (ctrl_t ctrl)
 {
@@ -40,6 +40,8 @@
 #include "key-clean.h"
 
 static void write_record (ctrl_t ctrl, TRUSTREC *rec);
+static int read_trust_record (ctrl_t ctrl, PKT_public_key *pk,
+                              TRUSTREC *rec);
 static void do_sync(void);
 
 
@@ -116,6 +118,11 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 
 static int pending_check_trustdb;
 
+/* Value of the nextcheck stamp requesting that only the keys flagged
+ * with WOT_FLAG_CHANGED are revalidated.  Any other stamp in the past
+ * requests a full check; older versions treat this one alike.  */
+#define NEXTCHECK_KEYS_PENDING 2
+
 static int validate_keys (ctrl_t ctrl, int interactive);
 
 
@@ -511,6 +518,36 @@ do_sync(void)
       }
 }
 
+
+/*
+ * Start a trustdb transaction and die on error
+ */
+static void
+begin_transaction (void)
+{
+  int rc = tdbio_begin_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+}
+
+
+/*
+ * Commit a trustdb transaction and die on error
+ */
+static void
+end_transaction (void)
+{
+  int rc = tdbio_end_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: commit failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+}
+
 const char *
 trust_model_string (int model)
 {
@@ -714,6 +751,78 @@ tdb_revalidation_mark (ctrl_t ctrl)
   pending_check_trustdb = 1;
 }
 
+
+/* Same as tdb_revalidation_mark but used if only the signatures on
+ * the primary key PK have changed.  Unless a full check is required
+ * anyway, the key is flagged in the trustdb so that the next check
+ * needs to revalidate only the flagged keys.  */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC vr, trec;
+  gpg_error_t err;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  if (!(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
+        || opt.trust_model == TM_TOFU_PGP))
+    {
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  read_record (0, &vr, RECTYPE_VER);
+  if (!(vr.r.ver.wotflags & TDB_WOTFLAG_SIGNERS)
+      || (vr.r.ver.nextcheck != NEXTCHECK_KEYS_PENDING
+          && vr.r.ver.nextcheck
+          && vr.r.ver.nextcheck <= make_timestamp ()))
+    {
+      /* No signer info or a full check is due anyway.  */
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  err = read_trust_record (ctrl, pk, &trec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      memset (&trec, 0, sizeof trec);
+      trec.recnum = tdbio_new_recnum (ctrl);
+      trec.rectype = RECTYPE_TRUST;
+      fpr20_from_pk (pk, trec.r.trust.fingerprint);
+    }
+  else if (err)
+    {
+      tdbio_invalid ();
+      return;
+    }
+
+  if (trec.r.trust.wot_depth)
+    {
+      /* The key is a signer and thus the validity of other keys may
+       * change as well.  */
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  if (!(trec.r.trust.wot_flags & WOT_FLAG_CHANGED))
+    {
+      trec.r.trust.wot_flags |= WOT_FLAG_CHANGED;
+      write_record (ctrl, &trec);
+    }
+
+  if (vr.r.ver.nextcheck != NEXTCHECK_KEYS_PENDING)
+    {
+      vr.r.ver.wotnextcheck = vr.r.ver.nextcheck;
+      vr.r.ver.nextcheck = NEXTCHECK_KEYS_PENDING;
+      write_record (ctrl, &vr);
+    }
+  do_sync ();
+  pending_check_trustdb = 1;
+}
+
+
 int
 trustdb_pending_check(void)
 {
@@ -857,6 +966,36 @@ tdb_get_min_ownertrust (ctrl_t ctrl, PKT_public_key *pk, int no_create)
 }
 
 
+/* Return true if changing the ownertrust of the key with the trust
+ * record REC from OLD_TRUST to NEW_TRUST can't change the validity of
+ * any key.  This is the case if the last full check did not use the
+ * key as a signer, because then the key is not fully valid and its
+ * ownertrust is never looked at.  REC may be NULL for a key without a
+ * trust record.  */
+static int
+ownertrust_change_is_local (TRUSTREC *rec,
+                            unsigned int old_trust, unsigned int new_trust)
+{
+  TRUSTREC vr;
+
+  if (!(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
+        || opt.trust_model == TM_TOFU_PGP))
+    return 0;
+  if ((old_trust & TRUST_MASK) == TRUST_ULTIMATE
+      || (new_trust & TRUST_MASK) == TRUST_ULTIMATE)
+    return 0;  /* The set of ultimately trusted keys changes.  */
+
+  read_record (0, &vr, RECTYPE_VER);
+  if (!(vr.r.ver.wotflags & TDB_WOTFLAG_SIGNERS)
+      || (vr.r.ver.nextcheck != NEXTCHECK_KEYS_PENDING
+          && vr.r.ver.nextcheck
+          && vr.r.ver.nextcheck <= make_timestamp ()))
+    return 0;  /* No signer info or a full check is due anyway.  */
+
+  return !rec || !rec->r.trust.wot_depth;
+}
+
+
 /*
  * Set the trust value of the given public key to the new value.
  * The key should be a primary one.
@@ -871,6 +1010,7 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust,
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return;
 
+  begin_transaction ();
   err = read_trust_record (ctrl, pk, &rec);
   if (!err)
     {
@@ -880,6 +1020,10 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust,
                    as_trusted_key? " via --trusted-key":"");
       if (rec.r.trust.ownertrust != new_trust)
         {
+          int local = ownertrust_change_is_local (&rec,
+                                                  rec.r.trust.ownertrust,
+                                                  new_trust);
+
           rec.r.trust.ownertrust = new_trust;
           /* Clear or set the trusted key flag if the new value is
            * ultimate.  This is required so that we know which keys
@@ -894,8 +1038,8 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust,
           else
             rec.r.trust.flags &= ~(rec.r.trust.flags & 1);
           write_record (ctrl, &rec);
-          tdb_revalidation_mark (ctrl);
-          do_sync ();
+          if (!local)
+            tdb_revalidation_mark (ctrl);
         }
     }
   else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
@@ -913,13 +1057,14 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust,
           && as_trusted_key)
         rec.r.trust.flags = 1;
       write_record (ctrl, &rec);
-      tdb_revalidation_mark (ctrl);
-      do_sync ();
+      if (!ownertrust_change_is_local (NULL, TRUST_UNKNOWN, new_trust))
+        tdb_revalidation_mark (ctrl);
     }
   else
     {
       tdbio_invalid ();
     }
+  end_transaction ();
 }
 
 static void
@@ -1708,6 +1853,92 @@ sanitize_regexp(const char *old)
 }
 
 
+/* The compiled trust signature regexps are cached during a run of
+ * validate_keys.  The cache is a list with the most recently used
+ * item first and limited to REGEXP_CACHE_SIZE items.  */
+#define REGEXP_CACHE_SIZE 64
+struct regexp_cache_item
+{
+  struct regexp_cache_item *next;
+  char *regexp;   /* The sanitized regexp.  */
+  int failed;     /* Compiling the regexp failed.  */
+  regex_t pat;    /* The compiled regexp if not FAILED.  */
+  char expr[1];   /* The regexp from the signature.  */
+};
+static struct regexp_cache_item *regexp_cache;
+static unsigned int regexp_cache_count;
+
+
+static void
+release_regexp_cache_item (struct regexp_cache_item *item)
+{
+  if (!item->failed)
+    regfree (&item->pat);
+  xfree (item->regexp);
+  xfree (item);
+}
+
+
+/* Release all cached regexps.  */
+static void
+flush_regexp_cache (void)
+{
+  struct regexp_cache_item *item;
+
+  while ((item = regexp_cache))
+    {
+      regexp_cache = item->next;
+      release_regexp_cache_item (item);
+    }
+  regexp_cache_count = 0;
+}
+
+
+/* Return the cache item for the trust signature regexp EXPR.  The
+ * regexp is compiled if it is not yet in the cache.  */
+static struct regexp_cache_item *
+get_compiled_regexp (const char *expr)
+{
+  struct regexp_cache_item *item, *prev;
+
+  for (prev = NULL, item = regexp_cache; item; prev = item, item = item->next)
+    if (!strcmp (item->expr, expr))
+      {
+        if (prev)
+          {
+            prev->next = item->next;
+            item->next = regexp_cache;
+            regexp_cache = item;
+          }
+        return item;
+      }
+
+  if (regexp_cache_count >= REGEXP_CACHE_SIZE)
+    {
+      /* Drop the least recently used item.  */
+      for (prev = NULL, item = regexp_cache; item->next;
+           prev = item, item = item->next)
+        ;
+      if (prev)
+        prev->next = NULL;
+      else
+        regexp_cache = NULL;
+      release_regexp_cache_item (item);
+      regexp_cache_count--;
+    }
+
+  item = xmalloc (sizeof *item + strlen (expr));
+  strcpy (item->expr, expr);
+  item->regexp = sanitize_regexp (expr);
+  item->failed = !!regcomp (&item->pat, item->regexp,
+                            (REG_ICASE|REG_EXTENDED));
+  item->next = regexp_cache;
+  regexp_cache = item;
+  regexp_cache_count++;
+  return item;
+}
+
+
 /* Used by validate_one_keyblock to confirm a regexp within a trust
  * signature.  Returns 1 for match, and 0 for no match or regex
  * error. */
@@ -1715,16 +1946,15 @@ static int
 check_regexp (const char *expr,const char *string)
 {
   int ret;
-  char *regexp;
+  struct regexp_cache_item *item;
   char *stringbuf = NULL;
-  regex_t pat;
 
-  regexp = sanitize_regexp (expr);
+  item = get_compiled_regexp (expr);
 
-  ret = regcomp (&pat, regexp, (REG_ICASE|REG_EXTENDED));
+  ret = item->failed;
   if (!ret)
     {
-      if (*regexp == '<' && !strchr (string, '<')
+      if (*item->regexp == '<' && !strchr (string, '<')
           && is_valid_mailbox (string))
         {
           /* The R.E. starts with an angle bracket but STRING seems to
@@ -1735,17 +1965,16 @@ check_regexp (const char *expr,const char *string)
           stringbuf = xstrconcat ("<", string, ">", NULL);
           string = stringbuf;
         }
-      ret = regexec (&pat, string, 0, NULL, 0);
-      regfree (&pat);
+      ret = regexec (&item->pat, string, 0, NULL, 0);
     }
 
   ret = !ret;
 
   if (DBG_TRUST)
     log_debug ("regexp '%s' ('%s') on '%s'%s: %s\n",
-               regexp, expr, string, stringbuf? " (fixed)":"", ret? "YES":"NO");
+               item->regexp, expr, string, stringbuf? " (fixed)":"",
+               ret? "YES":"NO");
 
-  xfree (regexp);
   xfree (stringbuf);
   return ret;
 }
@@ -1936,12 +2165,170 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* Number of keyblocks validate_key_list processes at once if the
+ * signatures are verified by several threads.  */
+#define VALIDATE_BATCH_SIZE 256
+
+
+/* Verify the signatures on the keyblocks BATCH which are needed for
+ * the validation using opt.trustdb_threads.  With KLIST NULL the
+ * self-signatures of the yet unmerged keyblocks are verified;
+ * otherwise the certifications by keys in KLIST.  */
+static void
+check_batch_signatures (ctrl_t ctrl, kbnode_t *batch, size_t nbatch,
+                        struct key_item *klist)
+{
+  struct key_sig_ref_s *items = NULL;
+  size_t nitems = 0, maxitems = 0;
+  kbnode_t node;
+  PKT_signature *sig;
+  size_t n;
+  u32 kid[2];
+  int uid_ok;
+
+  for (n = 0; n < nbatch; n++)
+    {
+      if (!batch[n])
+        continue;
+      keyid_from_pk (batch[n]->pkt->pkt.public_key, kid);
+      uid_ok = 0;
+      for (node = batch[n]; node; node = node->next)
+        {
+          if (node->pkt->pkttype == PKT_USER_ID)
+            {
+              uid_ok = (!node->pkt->pkt.user_id->flags.revoked
+                        && !node->pkt->pkt.user_id->flags.expired);
+              continue;
+            }
+          if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            uid_ok = 0;
+          if (node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+
+          sig = node->pkt->pkt.signature;
+          if (sig->flags.checked)
+            continue;
+          if (!klist)
+            {
+              if (sig->keyid[0] != kid[0] || sig->keyid[1] != kid[1])
+                continue;
+            }
+          else
+            {
+              /* Same selection as in mark_usable_uid_certs.  */
+              if (!uid_ok
+                  || (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1])
+                  || !(IS_UID_SIG (sig) || IS_UID_REV (sig))
+                  || (sig->sig_class >= 0x11 && sig->sig_class <= 0x13
+                      && sig->sig_class - 0x10 < opt.min_cert_level)
+                  || !is_in_klist (klist, sig))
+                continue;
+            }
+
+          if (nitems == maxitems)
+            {
+              maxitems += 256;
+              items = xrealloc (items, maxitems * sizeof *items);
+            }
+          items[nitems].root = batch[n];
+          items[nitems].node = node;
+          nitems++;
+        }
+    }
+
+  check_key_signatures_parallel (ctrl, items, nitems, opt.trustdb_threads);
+  xfree (items);
+}
+
+
+/*
+ * Validate the keyblocks BATCH and append those with a signed user
+ * ID to the array R_KEYS with R_NKEYS items and space for R_MAXKEYS
+ * items.  The other keyblocks are released.  See validate_key_list
+ * for the other args.
+ */
+static void
+validate_key_batch (ctrl_t ctrl, kbnode_t *batch, size_t nbatch,
+                    KeyHashTable full_trust, struct key_item *klist,
+                    u32 curtime, u32 *next_expire,
+                    struct key_array **r_keys, size_t *r_nkeys,
+                    size_t *r_maxkeys)
+{
+  KBNODE keyblock;
+  PKT_public_key *pk;
+  size_t n;
+
+  if (opt.trustdb_threads > 1)
+    check_batch_signatures (ctrl, batch, nbatch, NULL);
+
+  /* prepare the keyblocks for further processing */
+  for (n = 0; n < nbatch; n++)
+    {
+      keyblock = batch[n];
+      merge_keys_and_selfsig (ctrl, keyblock);
+      clear_kbnode_flags (keyblock);
+      pk = keyblock->pkt->pkt.public_key;
+      if (pk->has_expired || pk->flags.revoked)
+        {
+          /* it does not make sense to look further at those keys */
+          mark_keyblock_seen (full_trust, keyblock);
+          release_kbnode (keyblock);
+          batch[n] = NULL;
+        }
+    }
+
+  if (opt.trustdb_threads > 1)
+    check_batch_signatures (ctrl, batch, nbatch, klist);
+
+  for (n = 0; n < nbatch; n++)
+    {
+      keyblock = batch[n];
+      batch[n] = NULL;
+      if (!keyblock)
+        continue;
+      pk = keyblock->pkt->pkt.public_key;
+      if (validate_one_keyblock (ctrl, keyblock, klist,
+                                 curtime, next_expire))
+        {
+	  KBNODE node;
+
+          if (pk->expiredate && pk->expiredate >= curtime
+              && pk->expiredate < *next_expire)
+            *next_expire = pk->expiredate;
+
+          if (*r_nkeys == *r_maxkeys) {
+            *r_maxkeys += 1000;
+            *r_keys = xrealloc (*r_keys, (*r_maxkeys+1) * sizeof **r_keys);
+          }
+          (*r_keys)[(*r_nkeys)++].keyblock = keyblock;
+
+	  /* Optimization - if all uids are fully trusted, then we
+	     never need to consider this key as a candidate again. */
+
+	  for (node=keyblock; node; node = node->next)
+	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+	      break;
+
+	  if(node==NULL)
+	    mark_keyblock_seen (full_trust, keyblock);
+
+          keyblock = NULL;
+        }
+
+      release_kbnode (keyblock);
+    }
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * klist.  The caller has to pass keydb handle so that we don't use
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
- * Caller hast to release the returned array.
+ * Caller hast to release the returned array.  If threads are enabled
+ * the keyblocks are processed in batches so that their signatures
+ * can be verified in parallel; everything else is still done in the
+ * order of the keyblocks.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
@@ -1950,17 +2337,23 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   KBNODE keyblock = NULL;
   struct key_array *keys = NULL;
   size_t nkeys, maxkeys;
+  kbnode_t *batch;
+  size_t nbatch, maxbatch;
   int rc;
   KEYDB_SEARCH_DESC desc;
 
   maxkeys = 1000;
   keys = xmalloc ((maxkeys+1) * sizeof *keys);
   nkeys = 0;
+  maxbatch = opt.trustdb_threads > 1? VALIDATE_BATCH_SIZE : 1;
+  batch = xmalloc (maxbatch * sizeof *batch);
+  nbatch = 0;
 
   rc = keydb_search_reset (hd);
   if (rc)
     {
       log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
+      xfree (batch);
       xfree (keys);
       return NULL;
     }
@@ -1972,6 +2365,7 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   rc = keydb_search (hd, &desc, 1, NULL);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
+      xfree (batch);
       keys[nkeys].keyblock = NULL;
       return keys;
     }
@@ -1984,8 +2378,6 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
@@ -1999,48 +2391,18 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
                      keyblock->pkt->pkttype);
           dump_kbnode (keyblock);
           release_kbnode(keyblock);
+          keyblock = NULL;
           continue;
         }
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
+      batch[nbatch++] = keyblock;
+      keyblock = NULL;
+      if (nbatch == maxbatch)
         {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
+          validate_key_batch (ctrl, batch, nbatch, full_trust, klist,
+                              curtime, next_expire, &keys, &nkeys, &maxkeys);
+          nbatch = 0;
         }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
-        {
-	  KBNODE node;
-
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
-
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
-
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
-
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
-
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
-
-          keyblock = NULL;
-        }
-
-      release_kbnode (keyblock);
-      keyblock = NULL;
     }
   while (!(rc = keydb_search (hd, &desc, 1, NULL)));
 
@@ -2050,10 +2412,16 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
+  validate_key_batch (ctrl, batch, nbatch, full_trust, klist,
+                      curtime, next_expire, &keys, &nkeys, &maxkeys);
+  xfree (batch);
   keys[nkeys].keyblock = NULL;
   return keys;
 
  die:
+  while (nbatch)
+    release_kbnode (batch[--nbatch]);
+  xfree (batch);
   keys[nkeys].keyblock = NULL;
   release_key_array (keys);
   return NULL;
@@ -2072,9 +2440,12 @@ reset_trust_records (ctrl_t ctrl)
       if(rec.rectype==RECTYPE_TRUST)
 	{
 	  count++;
-	  if(rec.r.trust.min_ownertrust)
+	  if(rec.r.trust.min_ownertrust
+             || rec.r.trust.wot_depth || rec.r.trust.wot_flags)
 	    {
 	      rec.r.trust.min_ownertrust=0;
+	      rec.r.trust.wot_depth = 0;
+	      rec.r.trust.wot_flags = 0;
 	      write_record (ctrl, &rec);
 	    }
 
@@ -2103,6 +2474,461 @@ reset_trust_records (ctrl_t ctrl)
     }
 }
 
+/* Store the signer info state FLAGS in the version record.  */
+static void
+write_wot_flags (ctrl_t ctrl, ulong flags)
+{
+  TRUSTREC vr;
+
+  read_record (0, &vr, RECTYPE_VER);
+  if (vr.r.ver.wotflags != flags || vr.r.ver.wotnextcheck)
+    {
+      vr.r.ver.wotflags = flags;
+      vr.r.ver.wotnextcheck = 0;
+      write_record (ctrl, &vr);
+    }
+}
+
+
+/* Record in the trust record of PK that the key has been put into the
+ * list of signers at DEPTH.  REGEXP is the regexp of the trust
+ * signature the key carries or NULL.  */
+static void
+set_wot_signer (ctrl_t ctrl, PKT_public_key *pk, int depth,
+                const char *regexp)
+{
+  TRUSTREC rec;
+
+  if (read_trust_record (ctrl, pk, &rec))
+    return;  /* Only keys with a validity are used as signers.  */
+
+  rec.r.trust.wot_depth = depth < 255? depth + 1 : 255;
+  if (regexp)
+    rec.r.trust.wot_flags |= WOT_FLAG_REGEXP;
+  write_record (ctrl, &rec);
+}
+
+
+/* A signer of a key to be revalidated.  */
+struct wot_signer
+{
+  u32 kid[2];
+  int depth;                /* Depth the signer is used at.  */
+  unsigned int ownertrust;  /* Its effective ownertrust.  */
+};
+
+
+/* Revalidate the key described by the trust record TREC using the
+ * signer info stored by the last full run.  This gives the same
+ * result as a full run as long as the key did not and does not
+ * become a signer itself; returns false if that can't be assured.
+ * The other args are the same as for validate_one_keyblock.  */
+static int
+revalidate_one_key (ctrl_t ctrl, TRUSTREC *trec, u32 curtime,
+                    u32 *next_expire, KeyHashTable stored)
+{
+  kbnode_t kb = NULL;
+  kbnode_t node;
+  PKT_public_key *pk;
+  struct wot_signer *signers = NULL;
+  size_t nsigners = 0, maxsigners = 0;
+  size_t n;
+  struct key_item *klist, *k;
+  TRUSTREC vrec;
+  ulong recno;
+  byte fpr[20];
+  u32 kid[2];
+  int depth;
+  int okay = 0;
+
+  if (trec->r.trust.wot_depth)
+    return 0;  /* The key has been used as a signer.  */
+
+  /* Keys which can't be found (e.g. deleted ones) are left to the
+   * full run.  */
+  if (get_pubkey_byfprint (ctrl, NULL, &kb, trec->r.trust.fingerprint, 20))
+    return 0;
+  pk = kb->pkt->pkt.public_key;
+  fpr20_from_pk (pk, fpr);
+  if (memcmp (fpr, trec->r.trust.fingerprint, 20))
+    goto leave;  /* Found via a subkey.  */
+  keyid_from_pk (pk, kid);
+  if (tdb_keyid_is_utk (kid))
+    goto leave;
+
+  merge_keys_and_selfsig (ctrl, kb);
+  clear_kbnode_flags (kb);
+
+  /* Collect the signers which are part of the web of trust.  */
+  for (node = kb; node; node = node->next)
+    {
+      PKT_signature *sig;
+      PKT_public_key *spk;
+      TRUSTREC srec;
+
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!IS_UID_SIG (sig)
+          || (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1]))
+        continue;
+      for (n = 0; n < nsigners; n++)
+        if (signers[n].kid[0] == sig->keyid[0]
+            && signers[n].kid[1] == sig->keyid[1])
+          break;
+      if (n < nsigners)
+        continue;
+
+      if (nsigners == maxsigners)
+        {
+          maxsigners += 16;
+          signers = xrealloc (signers, maxsigners * sizeof *signers);
+        }
+      signers[nsigners].kid[0] = sig->keyid[0];
+      signers[nsigners].kid[1] = sig->keyid[1];
+      signers[nsigners].depth = -1;
+      if (tdb_keyid_is_utk (sig->keyid))
+        {
+          signers[nsigners].depth = 0;
+          signers[nsigners].ownertrust = TRUST_ULTIMATE;
+        }
+      else
+        {
+          spk = xmalloc_clear (sizeof *spk);
+          if (!get_pubkey (ctrl, spk, sig->keyid)
+              && spk->main_keyid[0] == sig->keyid[0]
+              && spk->main_keyid[1] == sig->keyid[1]
+              && !read_trust_record (ctrl, spk, &srec)
+              && srec.r.trust.wot_depth)
+            {
+              if ((srec.r.trust.wot_flags & WOT_FLAG_REGEXP)
+                  && (opt.trust_model == TM_PGP
+                      || opt.trust_model == TM_TOFU_PGP))
+                {
+                  /* Regexps depend on the user ID; keep it simple.  */
+                  free_public_key (spk);
+                  goto leave;
+                }
+              signers[nsigners].depth = srec.r.trust.wot_depth - 1;
+              signers[nsigners].ownertrust
+                = srec.r.trust.ownertrust & TRUST_MASK;
+              if (signers[nsigners].ownertrust < srec.r.trust.min_ownertrust)
+                signers[nsigners].ownertrust = srec.r.trust.min_ownertrust;
+            }
+          free_public_key (spk);
+        }
+      nsigners++;
+    }
+
+  /* Reset the key's records like reset_trust_records does.  */
+  if (trec->r.trust.min_ownertrust)
+    {
+      trec->r.trust.min_ownertrust = 0;
+      write_record (ctrl, trec);
+    }
+  for (recno = trec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (ctrl, &vrec);
+        }
+    }
+
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      okay = 1;
+      goto leave;
+    }
+
+  /* validate_key_list looks at this key at every depth but except
+   * for the user ID expiration only the signers of that depth
+   * matter.  */
+  for (node = kb; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID
+        && !node->pkt->pkt.user_id->flags.revoked
+        && !node->pkt->pkt.user_id->flags.expired
+        && node->pkt->pkt.user_id->expiredate
+        && node->pkt->pkt.user_id->expiredate < *next_expire)
+      *next_expire = node->pkt->pkt.user_id->expiredate;
+
+  for (depth = 0; depth < opt.max_cert_depth; depth++)
+    {
+      klist = NULL;
+      for (n = 0; n < nsigners; n++)
+        if (signers[n].depth == depth)
+          {
+            k = new_key_item ();
+            k->kid[0] = signers[n].kid[0];
+            k->kid[1] = signers[n].kid[1];
+            k->ownertrust = signers[n].ownertrust;
+            k->next = klist;
+            klist = k;
+          }
+      if (!klist)
+        continue;
+
+      clear_kbnode_flags (kb);
+      if (validate_one_keyblock (ctrl, kb, klist, curtime, next_expire))
+        {
+          if (pk->expiredate && pk->expiredate >= curtime
+              && pk->expiredate < *next_expire)
+            *next_expire = pk->expiredate;
+
+          for (node = kb; node; node = node->next)
+            if (node->pkt->pkttype == PKT_USER_ID && (node->flag & 4))
+              break;
+          if (node)
+            {
+              /* The key would now be used as a signer.  */
+              release_key_items (klist);
+              goto leave;
+            }
+
+          store_validation_status (ctrl, depth, kb, stored);
+        }
+      release_key_items (klist);
+    }
+  okay = 1;
+
+ leave:
+  xfree (signers);
+  release_kbnode (kb);
+  return okay;
+}
+
+
+/* Revalidate only the keys flagged as changed by
+ * tdb_revalidation_mark_key.  Returns true if that was done or false
+ * if a full run is required.  */
+static int
+validate_changed_keys (ctrl_t ctrl)
+{
+  TRUSTREC vr, rec;
+  ulong recnum;
+  ulong *changed = NULL;
+  size_t nchanged = 0, maxchanged = 0;
+  size_t n;
+  KeyHashTable stored;
+  u32 start_time, next_expire;
+  int okay = 1;
+
+  if (!(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
+        || opt.trust_model == TM_TOFU_PGP))
+    return 0;
+  if (!tdbio_db_matches_options ())
+    return 0;
+
+  read_record (0, &vr, RECTYPE_VER);
+  if (!(vr.r.ver.wotflags & TDB_WOTFLAG_SIGNERS)
+      || vr.r.ver.nextcheck != NEXTCHECK_KEYS_PENDING)
+    return 0;
+
+  start_time = make_timestamp ();
+  if (vr.r.ver.wotnextcheck && vr.r.ver.wotnextcheck <= start_time)
+    return 0;  /* A scheduled check is due.  */
+  next_expire = vr.r.ver.wotnextcheck? vr.r.ver.wotnextcheck : 0xffffffff;
+
+  /* First collect the keys because revalidating them adds records.  */
+  for (recnum=1; !tdbio_read_record (recnum, &rec, 0); recnum++)
+    {
+      if (rec.rectype != RECTYPE_TRUST
+          || !(rec.r.trust.wot_flags & WOT_FLAG_CHANGED))
+        continue;
+      if (nchanged == maxchanged)
+        {
+          maxchanged += 64;
+          changed = xrealloc (changed, maxchanged * sizeof *changed);
+        }
+      changed[nchanged++] = recnum;
+    }
+
+  stored = new_key_hash_table ();
+  for (n = 0; okay && n < nchanged; n++)
+    {
+      read_record (changed[n], &rec, RECTYPE_TRUST);
+      okay = revalidate_one_key (ctrl, &rec, start_time, &next_expire, stored);
+    }
+  release_key_hash_table (stored);
+
+  if (okay)
+    {
+      for (n = 0; n < nchanged; n++)
+        {
+          read_record (changed[n], &rec, RECTYPE_TRUST);
+          rec.r.trust.wot_flags &= ~WOT_FLAG_CHANGED;
+          write_record (ctrl, &rec);
+        }
+
+      read_record (0, &vr, RECTYPE_VER);
+      if (next_expire == 0xffffffff || next_expire < start_time)
+        vr.r.ver.nextcheck = 0;
+      else
+        vr.r.ver.nextcheck = next_expire;
+      vr.r.ver.wotnextcheck = 0;
+      write_record (ctrl, &vr);
+      do_sync ();
+
+      if (!opt.quiet)
+        {
+          log_info (ngettext ("%d changed key revalidated\n",
+                              "%d changed keys revalidated\n",
+                              (int)nchanged), (int)nchanged);
+          if (vr.r.ver.nextcheck)
+            log_info (_("next trustdb check due at %s\n"),
+                      strtimestamp (vr.r.ver.nextcheck));
+        }
+    }
+  else if (opt.verbose)
+    log_info ("trustdb: incremental check not possible\n");
+
+  xfree (changed);
+  return okay;
+}
+
+
+/* An item of the validity snapshot used by --debug-verify-trustdb.
+ * NAMEHASH is all zero for the values of the trust record.  */
+struct wot_snapshot_item
+{
+  byte fpr[20];
+  byte namehash[20];
+  byte is_uid;
+  byte value[3];
+};
+
+struct wot_snapshot
+{
+  size_t nitems;
+  struct wot_snapshot_item *items;
+};
+
+
+static int
+cmp_wot_snapshot_items (const void *a_arg, const void *b_arg)
+{
+  const struct wot_snapshot_item *a = a_arg;
+  const struct wot_snapshot_item *b = b_arg;
+
+  return memcmp (a->fpr, b->fpr, 40);
+}
+
+
+/* Take a sorted snapshot of all validity values in the trustdb.  */
+static struct wot_snapshot *
+take_wot_snapshot (void)
+{
+  struct wot_snapshot *snap;
+  struct wot_snapshot_item *item;
+  size_t maxitems = 0;
+  TRUSTREC rec, vrec;
+  ulong recnum, recno;
+
+  snap = xmalloc_clear (sizeof *snap);
+  for (recnum=1; !tdbio_read_record (recnum, &rec, 0); recnum++)
+    {
+      if (rec.rectype != RECTYPE_TRUST)
+        continue;
+
+      recno = 0;
+      do
+        {
+          if (recno)
+            read_record (recno, &vrec, RECTYPE_VALID);
+          if (snap->nitems == maxitems)
+            {
+              maxitems += 1024;
+              snap->items = xrealloc (snap->items,
+                                      maxitems * sizeof *snap->items);
+            }
+          item = snap->items + snap->nitems++;
+          memset (item, 0, sizeof *item);
+          memcpy (item->fpr, rec.r.trust.fingerprint, 20);
+          if (recno)
+            {
+              memcpy (item->namehash, vrec.r.valid.namehash, 20);
+              item->is_uid = 1;
+              item->value[0] = vrec.r.valid.validity;
+              item->value[1] = vrec.r.valid.full_count;
+              item->value[2] = vrec.r.valid.marginal_count;
+              recno = vrec.r.valid.next;
+            }
+          else
+            {
+              item->value[0] = rec.r.trust.min_ownertrust;
+              item->value[1] = rec.r.trust.depth;
+              recno = rec.r.trust.validlist;
+            }
+        }
+      while (recno);
+    }
+
+  if (snap->nitems)
+    qsort (snap->items, snap->nitems, sizeof *snap->items,
+           cmp_wot_snapshot_items);
+  return snap;
+}
+
+
+static void
+release_wot_snapshot (struct wot_snapshot *snap)
+{
+  if (snap)
+    {
+      xfree (snap->items);
+      xfree (snap);
+    }
+}
+
+
+/* Log all differences between the snapshots A and B.  Items missing
+ * in one of them are taken as all zero.  */
+static void
+compare_wot_snapshots (struct wot_snapshot *a, struct wot_snapshot *b)
+{
+  static const byte zero[3];
+  size_t ia = 0, ib = 0;
+  unsigned int ndiffs = 0;
+  const struct wot_snapshot_item *item;
+  const byte *va, *vb;
+  char hexfpr[41];
+  int cmp;
+
+  while (ia < a->nitems || ib < b->nitems)
+    {
+      if (ia == a->nitems)
+        cmp = 1;
+      else if (ib == b->nitems)
+        cmp = -1;
+      else
+        cmp = cmp_wot_snapshot_items (a->items + ia, b->items + ib);
+      item = cmp > 0? b->items + ib : a->items + ia;
+      va = cmp > 0? zero : a->items[ia].value;
+      vb = cmp < 0? zero : b->items[ib].value;
+      if (cmp <= 0)
+        ia++;
+      if (cmp >= 0)
+        ib++;
+
+      if (!memcmp (va, vb, 3))
+        continue;
+      ndiffs++;
+      bin2hex (item->fpr, 20, hexfpr);
+      log_error ("trustdb: %s %s: incremental %d/%d/%d, full %d/%d/%d\n",
+                 hexfpr, item->is_uid? "uid":"key",
+                 va[0], va[1], va[2], vb[0], vb[1], vb[2]);
+    }
+
+  if (ndiffs)
+    log_error ("trustdb: incremental check differs in %u values\n", ndiffs);
+  else
+    log_info ("trustdb: incremental check verified\n");
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2128,10 +2954,11 @@ reset_trust_records (ctrl_t ctrl)
  *
  */
 static int
-validate_keys (ctrl_t ctrl, int interactive)
+validate_all_keys (ctrl_t ctrl, int interactive)
 {
   int rc = 0;
   int quit=0;
+  int wot_complete = 0;
   struct key_item *klist = NULL;
   struct key_item *k;
   struct key_array *keys = NULL;
@@ -2160,6 +2987,8 @@ validate_keys (ctrl_t ctrl, int interactive)
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
 
+  /* The signer info is rebuilt from scratch.  */
+  write_wot_flags (ctrl, 0);
   reset_trust_records (ctrl);
 
   /* Fixme: Instead of always building a UTK list, we could just build it
@@ -2195,6 +3024,7 @@ validate_keys (ctrl_t ctrl, int interactive)
 	    update_validity (ctrl, pk, node->pkt->pkt.user_id,
                              0, TRUST_ULTIMATE);
         }
+      set_wot_signer (ctrl, pk, 0, NULL);
       if ( pk->expiredate && pk->expiredate >= start_time
            && pk->expiredate < next_expire)
         next_expire = pk->expiredate;
@@ -2209,6 +3039,7 @@ validate_keys (ctrl_t ctrl, int interactive)
     goto leave;
 
   klist = utk_list;
+  wot_complete = 1;
 
   if (!opt.quiet)
     log_info ("marginals needed: %d  completes needed: %d  trust model: %s\n",
@@ -2344,6 +3175,9 @@ validate_keys (ctrl_t ctrl, int interactive)
 				   pkt.public_key->trust_regexp);
 		      k->next = klist;
 		      klist = k;
+		      set_wot_signer (ctrl,
+                                      kar->keyblock->pkt->pkt.public_key,
+                                      depth + 1, k->trust_regexp);
 		      break;
 		    }
 		}
@@ -2367,6 +3201,9 @@ validate_keys (ctrl_t ctrl, int interactive)
     {
       int rc2;
 
+      if (wot_complete)
+        write_wot_flags (ctrl, TDB_WOTFLAG_SIGNERS);
+
       if (next_expire == 0xffffffff || next_expire < start_time )
         tdbio_write_nextcheck (ctrl, 0);
       else
@@ -2391,3 +3228,44 @@ validate_keys (ctrl_t ctrl, int interactive)
 
   return rc;
 }
+
+
+/*
+ * Run the key validation procedure.  If only some imported keys need
+ * to be revalidated and the trustdb allows for it, only these keys
+ * are revalidated.  All changes are done in one transaction.
+ */
+static int
+validate_keys (ctrl_t ctrl, int interactive)
+{
+  struct wot_snapshot *incr, *full;
+  int rc = 0;
+
+  begin_transaction ();
+  if (interactive || !validate_changed_keys (ctrl))
+    rc = validate_all_keys (ctrl, interactive);
+  else
+    {
+      pending_check_trustdb = 0;
+      if (opt.verify_trustdb)
+        {
+          /* Debug mode: compare with the result of a full run.  */
+          incr = take_wot_snapshot ();
+          rc = validate_all_keys (ctrl, 0);
+          if (!rc)
+            {
+              full = take_wot_snapshot ();
+              compare_wot_snapshots (incr, full);
+              release_wot_snapshot (full);
+            }
+          release_wot_snapshot (incr);
+        }
+    }
+
+  flush_regexp_cache ();
+  if (rc)
+    tdbio_cancel_transaction ();
+  else
+    end_transaction ();
+  return rc;
+}
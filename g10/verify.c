@@ -38,6 +38,7 @@
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
+#include "tofu.h"
 
 
 /****************
@@ -197,6 +198,11 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
     int i, rc;
     int first_rc = 0;
 
+#ifdef USE_TOFU
+    /* Let the TOFU code write its updates in one go.  */
+    tofu_begin_batch_update (ctrl);
+#endif
+
     if( !nfiles ) { /* read the filenames from stdin */
 	char line[2048];
 	unsigned int lno = 0;
@@ -205,7 +211,8 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 	    lno++;
 	    if( !*line || line[strlen(line)-1] != '\n' ) {
 		log_error(_("input line %u too long or missing LF\n"), lno );
-		return GPG_ERR_GENERAL;
+		first_rc = GPG_ERR_GENERAL;
+		goto leave;
 	    }
 	    /* This code does not work on MSDOS but hwo cares there are
 	     * also no script languages available.  We don't strip any
@@ -226,6 +233,10 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
           }
     }
 
+ leave:
+#ifdef USE_TOFU
+    tofu_end_batch_update (ctrl);
+#endif
     return first_rc;
 }
 
@@ -38,12 +38,22 @@
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The number of buckets of the hash tables is adjusted to the number
+ * of cached items.  The sizes must be a power of two.  A table is
+ * grown if the average chain length exceeds CACHE_TABLE_MAX_LOAD and
+ * shrunk if the table is less than 1/8 filled.  */
+#define CACHE_TABLE_MIN_SIZE      256
+#define CACHE_TABLE_MAX_SIZE      (1 << 20)
+#define CACHE_TABLE_MAX_LOAD      2
+
+/* Number of buckets moved to the new table by each table operation
+ * while a resize is in progress.  */
+#define CACHE_TABLE_REHASH_STEPS  4
+
+/* The memory limits for the tables.  If they are exceeded the least
+ * recently used items are evicted.  */
+#define BLOB_CACHE_MEMLIMIT       (32 * 1024 * 1024)
+#define KEY_CACHE_MEMLIMIT        (4 * 1024 * 1024)
 
 
 /* Our definition of the backend handle.  */
@@ -54,25 +64,63 @@ struct backend_handle_s
 };
 
 
+/* The header of each item stored in a cache table.  This must be the
+ * first member of the item so that the table code can cast between
+ * the item and its header.  */
+typedef struct cache_link_s *cache_link_t;
+struct cache_link_s
+{
+  cache_link_t next;       /* Next item in the hash chain.  */
+  cache_link_t lru_prev;   /* The next more recently used item.  */
+  cache_link_t lru_next;   /* The next less recently used item.  */
+  u32 hashval;             /* The full hash value of the item.  */
+  size_t memsize;          /* The memory accounted to this item.  */
+};
+
+
+/* A hash table which is resized using incremental rehashing and
+ * whose items are evicted in LRU order when the memory limit is
+ * exceeded.  While a resize is in progress OLD_BUCKETS holds the
+ * previous table; all of its buckets below REHASH_IDX have already
+ * been moved to BUCKETS.  */
+struct cache_table_s
+{
+  const char *name;          /* Name of the table for diagnostics.  */
+  cache_link_t *buckets;     /* The hash table.  */
+  unsigned int size;         /* Number of allocated buckets.  */
+  cache_link_t *old_buckets; /* The table we are moving away from.  */
+  unsigned int old_size;     /* Number of buckets of that table.  */
+  unsigned int rehash_idx;   /* Next bucket of OLD_BUCKETS to move.  */
+  unsigned int nitems;       /* Number of items in the table.  */
+  struct cache_link_s lru;   /* Head of the LRU list.  */
+  size_t memused;            /* Sum of the MEMSIZE of all items.  */
+  size_t memlimit;           /* Evict items if MEMUSED exceeds this.  */
+  void (*release) (cache_link_t item);  /* Release an evicted item.  */
+
+  /* Statistics.  */
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long added;
+  unsigned long evicted;
+  unsigned long resizes;
+};
+
+
 /* The object holding a blob.  */
 typedef struct blob_s
 {
-  struct blob_s *next;
+  struct cache_link_s link;   /* Must be the first member.  */
+  struct blob_s *next;        /* Used for the attic.  */
   enum pubkey_types pktype;
   unsigned int refcount;
-  unsigned int usecount;
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
 } *blob_t;
 
 
-static blob_t *blob_table;                /* Hash table with the blobs.   */
-static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
-static blob_t blob_attic;                 /* List of freed blobs.         */
+static struct cache_table_s blob_table;  /* Hash table with the blobs.  */
+static blob_t blob_attic;                /* List of freed blobs.        */
 
 
 /* A list item to blob data.  This is so that a next operation on a
@@ -105,48 +153,259 @@ static bloblist_t bloblist_attic;  /* List of freed items.  */
  */
 typedef struct key_item_s
 {
-  struct key_item_s *next;
-  bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
-  unsigned int refcount;   /* Reference counter for this item.  */
-  u32 kid_h;               /* Upper 4 bytes of the keyid.  */
-  u32 kid_l;               /* Lower 4 bytes of the keyid.  */
+  struct cache_link_s link; /* Must be the first member.  */
+  struct key_item_s *next;  /* Used for the attic.  */
+  bloblist_t  blist;        /* List of blobs or NULL for not-found.  */
+  unsigned int refcount;    /* Reference counter for this item.  */
+  u32 kid_h;                /* Upper 4 bytes of the keyid.  */
+  u32 kid_l;                /* Lower 4 bytes of the keyid.  */
 } *key_item_t;
 
-static key_item_t *key_table;            /* Hash table with the keys.    */
-static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
-static key_item_t key_item_attic;        /* List of freed items.         */
+static struct cache_table_s key_table;  /* Hash table with the keys.  */
+static key_item_t key_item_attic;       /* List of freed items.       */
 
 
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
-static inline unsigned int
-blob_table_hasher (const unsigned char *ubid)
-{
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
-}
-
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Initialize the cache table TBL.  NAME is used for diagnostics,
+ * MEMLIMIT is the amount of memory the items may use and RELEASE is
+ * called to release an evicted item.  */
 static gpg_error_t
-blob_table_init (void)
+cache_table_init (struct cache_table_s *tbl, const char *name,
+                  size_t memlimit, void (*release) (cache_link_t))
 {
-  if (blob_table)
+  if (tbl->buckets)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
-  blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
-  if (!blob_table)
+  tbl->buckets = xtrycalloc (CACHE_TABLE_MIN_SIZE, sizeof *tbl->buckets);
+  if (!tbl->buckets)
     return gpg_error_from_syserror ();
+  tbl->name = name;
+  tbl->size = CACHE_TABLE_MIN_SIZE;
+  tbl->lru.lru_prev = tbl->lru.lru_next = &tbl->lru;
+  tbl->memlimit = memlimit;
+  tbl->release = release;
   return 0;
 }
 
+
+/* Return the address of the chain for HASHVAL in TBL.  While a resize
+ * is in progress this is either a chain of the old or of the new
+ * table.  Note that we may not use any system call here.  */
+static inline cache_link_t *
+cache_table_chain (struct cache_table_s *tbl, u32 hashval)
+{
+  if (tbl->old_buckets
+      && (hashval & (tbl->old_size - 1)) >= tbl->rehash_idx)
+    return tbl->old_buckets + (hashval & (tbl->old_size - 1));
+  return tbl->buckets + (hashval & (tbl->size - 1));
+}
+
+
+/* If a resize of TBL is in progress move a few more buckets to the
+ * new table.  This spreads the cost of a resize over many
+ * operations.  */
+static void
+cache_table_rehash_step (struct cache_table_s *tbl)
+{
+  cache_link_t item, item_next, *chain;
+  unsigned int n;
+
+  if (!tbl->old_buckets)
+    return;
+
+  for (n=0;
+       n < CACHE_TABLE_REHASH_STEPS && tbl->rehash_idx < tbl->old_size;
+       n++, tbl->rehash_idx++)
+    {
+      for (item = tbl->old_buckets[tbl->rehash_idx]; item; item = item_next)
+        {
+          item_next = item->next;
+          chain = tbl->buckets + (item->hashval & (tbl->size - 1));
+          item->next = *chain;
+          *chain = item;
+        }
+      tbl->old_buckets[tbl->rehash_idx] = NULL;
+    }
+
+  if (tbl->rehash_idx == tbl->old_size)
+    {
+      xfree (tbl->old_buckets);
+      tbl->old_buckets = NULL;
+      tbl->old_size = 0;
+      tbl->rehash_idx = 0;
+    }
+}
+
+
+/* Start a resize of TBL if the number of items asks for this and no
+ * resize is already in progress.  Returns true if a new table has
+ * been allocated, in which case the caller needs to start over.  */
+static int
+cache_table_maybe_resize (struct cache_table_s *tbl)
+{
+  cache_link_t *newbuckets;
+  unsigned int newsize;
+
+  if (tbl->old_buckets)
+    return 0;  /* Still moving items to the current table.  */
+
+  if (tbl->nitems > tbl->size * CACHE_TABLE_MAX_LOAD
+      && tbl->size < CACHE_TABLE_MAX_SIZE)
+    newsize = tbl->size * 2;
+  else if (tbl->nitems < tbl->size / 8 && tbl->size > CACHE_TABLE_MIN_SIZE)
+    newsize = tbl->size / 2;
+  else
+    return 0;  /* Nothing to do.  */
+
+  newbuckets = xtrycalloc (newsize, sizeof *newbuckets);
+  if (!newbuckets)
+    {
+      log_info ("Note: malloc failed while resizing the %s cache: %s\n",
+                tbl->name, gpg_strerror (gpg_error_from_syserror ()));
+      return 0;  /* Keep on using the current table.  */
+    }
+
+  tbl->old_buckets = tbl->buckets;
+  tbl->old_size = tbl->size;
+  tbl->rehash_idx = 0;
+  tbl->buckets = newbuckets;
+  tbl->size = newsize;
+  tbl->resizes++;
+  if (DBG_CACHE)
+    log_debug ("cache: resizing %s table from %u to %u buckets (%u items)\n",
+               tbl->name, tbl->old_size, tbl->size, tbl->nitems);
+  return 1;
+}
+
+
+/* Put ITEM at the head of the LRU list of TBL.  */
+static inline void
+cache_table_lru_push (struct cache_table_s *tbl, cache_link_t item)
+{
+  item->lru_prev = &tbl->lru;
+  item->lru_next = tbl->lru.lru_next;
+  tbl->lru.lru_next->lru_prev = item;
+  tbl->lru.lru_next = item;
+}
+
+
+/* Remove ITEM from the LRU list.  */
+static inline void
+cache_table_lru_unlink (cache_link_t item)
+{
+  item->lru_prev->lru_next = item->lru_next;
+  item->lru_next->lru_prev = item->lru_prev;
+  item->lru_prev = item->lru_next = NULL;
+}
+
+
+/* Mark ITEM of TBL as the most recently used one.  */
+static inline void
+cache_table_touch (struct cache_table_s *tbl, cache_link_t item)
+{
+  cache_table_lru_unlink (item);
+  cache_table_lru_push (tbl, item);
+}
+
+
+/* Insert ITEM with HASHVAL into TBL and account MEMSIZE bytes for
+ * it.  Note that we may not use any system call here.  */
+static void
+cache_table_insert (struct cache_table_s *tbl, cache_link_t item,
+                    u32 hashval, size_t memsize)
+{
+  cache_link_t *chain;
+
+  item->hashval = hashval;
+  item->memsize = memsize;
+  chain = cache_table_chain (tbl, hashval);
+  item->next = *chain;
+  *chain = item;
+  cache_table_lru_push (tbl, item);
+  tbl->nitems++;
+  tbl->memused += memsize;
+  tbl->added++;
+}
+
+
+/* Account further MEMSIZE bytes to ITEM of TBL.  */
+static void
+cache_table_account (struct cache_table_s *tbl, cache_link_t item,
+                     size_t memsize)
+{
+  item->memsize += memsize;
+  tbl->memused += memsize;
+}
+
+
+/* Remove ITEM from TBL.  The caller is responsible for releasing the
+ * item.  */
+static void
+cache_table_remove (struct cache_table_s *tbl, cache_link_t item)
+{
+  cache_link_t *itemp;
+
+  for (itemp = cache_table_chain (tbl, item->hashval); *itemp;
+       itemp = &(*itemp)->next)
+    if (*itemp == item)
+      {
+        *itemp = item->next;
+        break;
+      }
+  item->next = NULL;
+  cache_table_lru_unlink (item);
+  tbl->nitems--;
+  tbl->memused -= item->memsize;
+}
+
+
+/* Evict the least recently used items from TBL until its memory
+ * limit is met.  Items still in use are only released by the table;
+ * they are freed by their last user.  */
+static void
+cache_table_evict (struct cache_table_s *tbl)
+{
+  cache_link_t item;
+
+  while (tbl->memused > tbl->memlimit
+         && (item = tbl->lru.lru_prev) != &tbl->lru)
+    {
+      cache_table_remove (tbl, item);
+      tbl->evicted++;
+      tbl->release (item);
+    }
+}
+
+
+/* Return a malloced string with the statistics of TBL or NULL on
+ * error.  */
+static char *
+cache_table_stats (struct cache_table_s *tbl)
+{
+  return xtryasprintf ("%s items=%u buckets=%u%s mem=%lu limit=%lu"
+                       " hits=%lu misses=%lu added=%lu evicted=%lu"
+                       " resizes=%lu",
+                       tbl->name, tbl->nitems, tbl->size,
+                       tbl->old_buckets? "(resizing)":"",
+                       (unsigned long)tbl->memused,
+                       (unsigned long)tbl->memlimit,
+                       tbl->hits, tbl->misses, tbl->added, tbl->evicted,
+                       tbl->resizes);
+}
+
+
+
+
+/* The hash function we use for the blob_table.  The UBID is a hash
+ * and thus its first bytes are good enough.  Must not call a system
+ * function.  */
+static inline u32
+blob_table_hasher (const unsigned char *ubid)
+{
+  return buf32_to_u32 (ubid);
+}
+
+
 /* Free a blob.  This is done by moving it to the attic list.  */
 static void
 blob_unref (blob_t blob)
@@ -167,40 +426,35 @@ blob_unref (blob_t blob)
 }
 
 
-/* Given the hash value and the ubid, find the blob in the bucket.
- * Returns NULL if not found or the blob item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  */
-static blob_t
-find_blob (unsigned int hash, const unsigned char *ubid,
-           unsigned int *r_count)
+/* The release function for the blob_table.  */
+static void
+blob_release (cache_link_t item)
 {
-  blob_t b;
-  unsigned int count = 0;
+  blob_unref ((blob_t)item);
+}
 
-  for (b = blob_table[hash]; b; b = b->next, count++)
-    if (!memcmp (b->ubid, ubid, UBID_LEN))
-      break;
-  if (r_count)
-    *r_count = count;
-  return b;
+
+/* Runtime allocation of the blob table.  */
+static gpg_error_t
+blob_table_init (void)
+{
+  return cache_table_init (&blob_table, "blob", BLOB_CACHE_MEMLIMIT,
+                           blob_release);
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* Given the hash value and the ubid, find the blob in the table.
+ * Returns NULL if not found or the blob item if found.  */
+static blob_t
+find_blob (u32 hashval, const unsigned char *ubid)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  blob_t b;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  for (b = (blob_t)*cache_table_chain (&blob_table, hashval); b;
+       b = (blob_t)b->link.next)
+    if (b->link.hashval == hashval && !memcmp (b->ubid, ubid, UBID_LEN))
+      break;
+  return b;
 }
 
 
@@ -210,14 +464,15 @@ static void
 blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
                 const void *blobdata, unsigned int blobdatalen)
 {
-  unsigned int hash;
+  u32 hashval;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
-  hash = blob_table_hasher (ubid);
+  hashval = blob_table_hasher (ubid);
  find_again:
-  b = find_blob (hash, ubid, &count);
+  cache_table_rehash_step (&blob_table);
+  b = find_blob (hashval, ubid);
   if (b)
     {
       xfree (blobdatacopy);
@@ -237,73 +492,12 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       memcpy (blobdatacopy, blobdata, blobdatalen);
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
-    }
+  /* Grow the table if needed.  During the malloc another thread
+   * might have changed the table.  Thus we need to start over.  */
+  if (cache_table_maybe_resize (&blob_table))
+    goto find_again;
 
-  /* Add an item to the bucket.  We allocate a whole block of items
+  /* Add an item to the table.  We allocate a whole block of items
    * for cache performance reasons.  */
   if (!blob_attic)
     {
@@ -331,7 +525,7 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
     }
 
   /* We now know that there is an item in the attic.  Put it into the
-   * chain.  Note that we may not use any system call here. */
+   * table.  Note that we may not use any system call here. */
   b = blob_attic;
   blob_attic = b->next;
   b->next = NULL;
@@ -339,11 +533,12 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
   b->data = blobdatacopy;
   b->datalen = blobdatalen;
   memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
   b->refcount = 1;
-  b->next = blob_table[hash];
-  blob_table[hash] = b;
-  blob_table_added++;
+  cache_table_insert (&blob_table, &b->link, hashval,
+                      sizeof *b + blobdatalen);
+
+  /* Make room by dropping the least recently used blobs.  */
+  cache_table_evict (&blob_table);
 }
 
 
@@ -352,47 +547,33 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
 static blob_t
 blob_table_get (const unsigned char *ubid)
 {
-  unsigned int hash;
   blob_t b;
 
-  hash = blob_table_hasher (ubid);
-  b = find_blob (hash, ubid, NULL);
+  cache_table_rehash_step (&blob_table);
+  b = find_blob (blob_table_hasher (ubid), ubid);
   if (b)
     {
-      b->usecount++;
+      cache_table_touch (&blob_table, &b->link);
+      blob_table.hits++;
       b->refcount++;
       return b;  /* Found  */
     }
 
+  blob_table.misses++;
   return NULL;
 }
 
 
-
+
 /* The hash function we use for the key_table.  Must not call a system
  * function.  */
-static inline unsigned int
+static inline u32
 key_table_hasher (u32 kid_l)
 {
-  return kid_l % key_table_size;
+  return kid_l;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
-static gpg_error_t
-key_table_init (void)
-{
-  if (key_table)
-    return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
-  key_table = xtrycalloc (key_table_size, sizeof *key_table);
-  if (!key_table)
-    return gpg_error_from_syserror ();
-  return 0;
-}
-
 /* Free a key_item.  This is done by moving it to the attic list.  */
 static void
 key_item_unref (key_item_t ki)
@@ -420,41 +601,35 @@ key_item_unref (key_item_t ki)
 }
 
 
-/* Given the hash value and the search info, find the key item in the
- * bucket.  Return NULL if not found or the key item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  Note that FPR may only be NULL
- * if FPRLEN is 0. */
-static key_item_t
-find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
-               unsigned int *r_count)
+/* The release function for the key_table.  */
+static void
+key_item_release (cache_link_t item)
 {
-  key_item_t ki = key_table[hash];
-  unsigned int count = 0;
+  key_item_unref ((key_item_t)item);
+}
 
-  for (; ki; ki = ki->next, count++)
-    if (ki->kid_h == kid_h && ki->kid_l == kid_l)
-      break;
-  if (r_count)
-    *r_count = count;
-  return ki;
+
+/* Runtime allocation of the key table.  */
+static gpg_error_t
+key_table_init (void)
+{
+  return cache_table_init (&key_table, "key", KEY_CACHE_MEMLIMIT,
+                           key_item_release);
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
+/* Given the hash value and the search info, find the key item in the
+ * table.  Return NULL if not found or the key item if found.  */
+static key_item_t
+find_in_chain (u32 hashval, u32 kid_h, u32 kid_l)
 {
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
+  key_item_t ki;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  for (ki = (key_item_t)*cache_table_chain (&key_table, hashval); ki;
+       ki = (key_item_t)ki->link.next)
+    if (ki->kid_h == kid_h && ki->kid_l == kid_l)
+      break;
+  return ki;
 }
 
 
@@ -545,85 +720,6 @@ new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
-{
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
-
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
-    {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
-
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
-}
-
-
 /* This is the core of
  *   key_table_put,
  *   key_table_put_no_fpr,
@@ -634,17 +730,17 @@ do_key_table_put (u32 kid_h, u32 kid_l,
                   const unsigned char *fpr, unsigned int fprlen,
                   const unsigned char *ubid, int subkey)
 {
-  unsigned int hash;
+  u32 hashval;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
   int do_find_again;
   int mark_not_found = !fpr;
 
-  hash = key_table_hasher (kid_l);
+  hashval = key_table_hasher (kid_l);
  find_again:
   do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  cache_table_rehash_step (&key_table);
+  ki = find_in_chain (hashval, kid_h, kid_l);
   if (ki)
     {
       if (mark_not_found)
@@ -673,17 +769,17 @@ do_key_table_put (u32 kid_h, u32 kid_l,
         bl_tail->next = bl;
       else
         ki->blist = bl;
-
+      cache_table_account (&key_table, &ki->link, sizeof *bl);
+      cache_table_touch (&key_table, &ki->link);
+      cache_table_evict (&key_table);
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
+  /* Grow the table if needed.  During the function call another
+   * thread might have changed the table.  Thus we need to start
+   * over.  */
+  if (cache_table_maybe_resize (&key_table))
+    do_find_again = 1;
 
   if (!key_item_attic)
     {
@@ -703,7 +799,7 @@ do_key_table_put (u32 kid_h, u32 kid_l,
     goto find_again;
 
   /* We now know that there are items in the attics.  Put them into
-   * the chain.  Note that we may not use any system call here. */
+   * the table.  Note that we may not use any system call here. */
   ki = key_item_attic;
   key_item_attic = ki->next;
   ki->next = NULL;
@@ -715,12 +811,12 @@ do_key_table_put (u32 kid_h, u32 kid_l,
 
   ki->kid_h = kid_h;
   ki->kid_l = kid_l;
-  ki->usecount = 1;
   ki->refcount = 1;
+  cache_table_insert (&key_table, &ki->link, hashval,
+                      sizeof *ki + (ki->blist? sizeof *ki->blist : 0));
 
-  ki->next = key_table[hash];
-  key_table[hash] = ki;
-  key_table_added++;
+  /* Make room by dropping the least recently used key items.  */
+  cache_table_evict (&key_table);
 }
 
 
@@ -789,18 +885,19 @@ key_table_put_no_kid (u32 kid_h, u32 kid_l)
 static key_item_t
 key_table_get (u32 kid_h, u32 kid_l)
 {
-  unsigned int hash;
   key_item_t ki;
 
-  hash = key_table_hasher (kid_l);
-  ki = find_in_chain (hash, kid_h, kid_l, NULL);
+  cache_table_rehash_step (&key_table);
+  ki = find_in_chain (key_table_hasher (kid_l), kid_h, kid_l);
   if (ki)
     {
-      ki->usecount++;
+      cache_table_touch (&key_table, &ki->link);
+      key_table.hits++;
       ki->refcount++;
       return ki;  /* Found  */
     }
 
+  key_table.misses++;
   return NULL;
 }
 
@@ -1199,3 +1296,22 @@ be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
         }
     }
 }
+
+
+/* Return a malloced string with statistics about the cache tables.
+ * Each table is described by one line.  Returns NULL on error.  */
+char *
+be_cache_get_stats (void)
+{
+  char *blobstats, *keystats, *result;
+
+  blobstats = cache_table_stats (&blob_table);
+  keystats = cache_table_stats (&key_table);
+  if (blobstats && keystats)
+    result = strconcat (blobstats, "\n", keystats, "\n", NULL);
+  else
+    result = NULL;
+  xfree (blobstats);
+  xfree (keystats);
+  return result;
+}
@@ -28,6 +28,7 @@
 #include "../common/i18n.h"
 #include "../common/asshelp.h"
 #include "../common/tlv.h"
+#include "../common/host2net.h"
 #include "backend.h"
 #include "keybox-defs.h"
 
@@ -172,6 +173,26 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
 
+  if (ctrl->batch_result)
+    {
+      /* Batch mode (MSEARCH): Append a record to the result buffer
+       * instead of sending a status and data line.  */
+      unsigned char hdr[4+40];
+      size_t datalen = ctrl->no_data_return? 0 : buflen;
+
+      ulongtobuf (hdr, (40 + datalen));
+      ulongtobuf (hdr+4, ctrl->batch_index);
+      ulongtobuf (hdr+8, pubkey_type);
+      memcpy (hdr+12, ubid, UBID_LEN);
+      ulongtobuf (hdr+32, ((is_ephemeral? 1:0) | (is_revoked? 2:0)));
+      ulongtobuf (hdr+36, uid_no);
+      ulongtobuf (hdr+40, pk_no);
+      put_membuf (ctrl->batch_result, hdr, sizeof hdr);
+      if (datalen)
+        put_membuf (ctrl->batch_result, buffer, datalen);
+      return 0;
+    }
+
   bin2hex (ubid, UBID_LEN, hexubid);
   err = kbxd_status_printf (ctrl, "PUBKEY_INFO", "%d %s %c%c %d %d",
                             pubkey_type, hexubid,
@@ -133,6 +133,7 @@ void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       enum pubkey_types pubkey_type);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+char *be_cache_get_stats (void);
 
 
 /*-- backend-kbx.c --*/
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -40,6 +42,28 @@ struct
 } the_database;
 
 
+/* The number of recent changes kept for WAITCHANGES.  */
+#define CHANGE_RING_SIZE 256
+
+/* An object to track the changes of the database.  GENERATION is
+ * incremented with each change; the changes are stored in RING at
+ * the index GENERATION % CHANGE_RING_SIZE.  INSTANCE is a random
+ * string identifying this run of the keyboxd so that clients can
+ * detect that the generation numbers started over.  */
+static struct
+{
+  int initialized;
+  npth_mutex_t lock;
+  npth_cond_t cond;
+  unsigned long generation;
+  char instance[2*8+1];
+  struct {
+    unsigned char ubid[UBID_LEN];
+    int what;
+  } ring[CHANGE_RING_SIZE];
+} changes;
+
+
 
 /* Take a lock for reading the databases.  */
 static void
@@ -69,6 +93,164 @@ release_lock (ctrl_t ctrl)
 }
 
 
+/* Initialize the change tracking.  */
+static gpg_error_t
+init_changes (void)
+{
+  unsigned char nonce[8];
+  int rc;
+
+  if (changes.initialized)
+    return 0;
+
+  rc = npth_mutex_init (&changes.lock, NULL);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  rc = npth_cond_init (&changes.cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&changes.lock);
+      return gpg_error_from_errno (rc);
+    }
+  gcry_create_nonce (nonce, sizeof nonce);
+  bin2hex (nonce, sizeof nonce, changes.instance);
+  changes.initialized = 1;
+  return 0;
+}
+
+
+/* Record a change of the object identified by UBID.  WHAT is 'u' for
+ * an insert or update, 'd' for a delete, or '*' if an unknown set of
+ * objects changed; in the latter case UBID is NULL.  */
+static void
+record_change (int what, const unsigned char *ubid)
+{
+  unsigned int idx;
+
+  if (!changes.initialized)
+    return;
+
+  npth_mutex_lock (&changes.lock);
+  changes.generation++;
+  idx = changes.generation % CHANGE_RING_SIZE;
+  changes.ring[idx].what = what;
+  if (ubid)
+    memcpy (changes.ring[idx].ubid, ubid, UBID_LEN);
+  else
+    memset (changes.ring[idx].ubid, 0, UBID_LEN);
+  npth_cond_broadcast (&changes.cond);
+  npth_mutex_unlock (&changes.lock);
+
+  if (DBG_CACHE)
+    log_debug ("database generation now %lu (%c)\n",
+               changes.generation, what);
+}
+
+
+/* Return the current generation of the database.  If R_INSTANCE is
+ * not NULL the identifier of this keyboxd instance is stored there.  */
+unsigned long
+kbxd_get_generation (const char **r_instance)
+{
+  unsigned long generation;
+
+  if (r_instance)
+    *r_instance = changes.instance;
+  if (!changes.initialized)
+    return 0;
+
+  npth_mutex_lock (&changes.lock);
+  generation = changes.generation;
+  npth_mutex_unlock (&changes.lock);
+  return generation;
+}
+
+
+/* Return a malloced string with statistics about the cache or NULL
+ * on error.  */
+char *
+kbxd_get_cache_stats (void)
+{
+  return be_cache_get_stats ();
+}
+
+
+/* Call CB for each change with a generation larger than SINCE, in
+ * ascending order.  If these changes are not anymore known, CB is
+ * called only once with UBID set to NULL and WHAT set to '*'.  If no
+ * changes are pending and TIMEOUT is not zero, wait up to TIMEOUT
+ * seconds for a change.  */
+gpg_error_t
+kbxd_list_changes (unsigned long since, unsigned int timeout,
+                   gpg_error_t (*cb)(void *opaque, unsigned long generation,
+                                     const unsigned char *ubid, int what),
+                   void *opaque)
+{
+  gpg_error_t err = 0;
+  struct {
+    unsigned long generation;
+    unsigned char ubid[UBID_LEN];
+    int what;
+  } *list = NULL;
+  unsigned int nlist = 0;
+  unsigned long gen, last;
+  struct timespec abstime;
+  int rc;
+
+  if (!changes.initialized)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  list = xtrycalloc (CHANGE_RING_SIZE, sizeof *list);
+  if (!list)
+    return gpg_error_from_syserror ();
+
+  npth_mutex_lock (&changes.lock);
+  if (since == changes.generation && timeout)
+    {
+      npth_clock_gettime (&abstime);
+      abstime.tv_sec += timeout;
+      while (since == changes.generation)
+        {
+          rc = npth_cond_timedwait (&changes.cond, &changes.lock, &abstime);
+          if (rc)
+            break;  /* Timeout or error.  */
+        }
+    }
+
+  last = changes.generation;
+  if (since > last || last - since > CHANGE_RING_SIZE)
+    {
+      /* Unknown generation or the changes are not anymore in the ring
+       * buffer: Tell the caller to assume that everything changed.  */
+      list[0].generation = last;
+      list[0].what = '*';
+      nlist = 1;
+    }
+  else
+    {
+      for (gen = since + 1; gen <= last; gen++)
+        {
+          list[nlist].generation = gen;
+          list[nlist].what = changes.ring[gen % CHANGE_RING_SIZE].what;
+          memcpy (list[nlist].ubid,
+                  changes.ring[gen % CHANGE_RING_SIZE].ubid, UBID_LEN);
+          nlist++;
+        }
+    }
+  npth_mutex_unlock (&changes.lock);
+
+  /* Call the callback without holding the lock.  */
+  for (gen = 0; gen < nlist && !err; gen++)
+    err = cb (opaque, list[gen].generation,
+              list[gen].what == '*'? NULL : list[gen].ubid,
+              list[gen].what);
+
+  xfree (list);
+  return err;
+}
+
+
+
 /* Set the database to use.  Depending on the FILENAME suffix we
  * decide which one to use.  This function must be called at daemon
  * startup because it employs no locking.  If FILENAME has no
@@ -110,6 +292,10 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   if (err)
     goto leave;
 
+  err = init_changes ();
+  if (err)
+    goto leave;
+
   n = strlen (filename);
   if (db_type)
     ; /* We already know it.  */
@@ -176,7 +362,12 @@ kbxd_release_session_info (ctrl_t ctrl)
 gpg_error_t
 kbxd_rollback (void)
 {
-  return be_sqlite_rollback ();
+  gpg_error_t err;
+
+  err = be_sqlite_rollback ();
+  /* We don't know which objects have been reverted.  */
+  record_change ('*', NULL);
+  return err;
 }
 
 
@@ -486,6 +677,8 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
+  if (!err)
+    record_change ('u', (const unsigned char *)ubid);
 
  leave:
   release_lock (ctrl);
@@ -557,6 +750,8 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
+  if (!err)
+    record_change ('d', ubid);
 
  leave:
   release_lock (ctrl);
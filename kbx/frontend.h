@@ -36,6 +36,14 @@ gpg_error_t kbxd_search (ctrl_t ctrl,
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
+unsigned long kbxd_get_generation (const char **r_instance);
+gpg_error_t kbxd_list_changes (unsigned long since, unsigned int timeout,
+                               gpg_error_t (*cb)(void *opaque,
+                                                 unsigned long generation,
+                                                 const unsigned char *ubid,
+                                                 int what),
+                               void *opaque);
+char *kbxd_get_cache_stats (void);
 
 
 #endif /*KBX_FRONTEND_H*/
@@ -365,6 +365,21 @@ gpg_error_t
 kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
                      gpg_error_t (*status_cb)(void *opaque, const char *line),
                      void *status_cb_value)
+{
+  return kbx_client_data_inq_cmd (kcd, command, NULL, NULL,
+                                  status_cb, status_cb_value);
+}
+
+
+/* Same as kbx_client_data_cmd but with an additional inquiry
+ * callback INQ_CB and its argument INQ_CB_VALUE.  */
+gpg_error_t
+kbx_client_data_inq_cmd (kbx_client_data_t kcd, const char *command,
+                         gpg_error_t (*inq_cb)(void *opaque, const char *line),
+                         void *inq_cb_value,
+                         gpg_error_t (*status_cb)(void *opaque,
+                                                  const char *line),
+                         void *status_cb_value)
 {
   gpg_error_t err;
 
@@ -378,7 +393,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       /* log_debug ("%s: sending command '%s'\n", __func__, command); */
       err = assuan_transact (kcd->ctx, command,
                              NULL, NULL,
-                             NULL, NULL,
+                             inq_cb, inq_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
@@ -401,7 +416,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       init_membuf (&mb, 8192);
       err = assuan_transact (kcd->ctx, command,
                              put_membuf_cb, &mb,
-                             NULL, NULL,
+                             inq_cb, inq_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
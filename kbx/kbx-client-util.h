@@ -33,6 +33,14 @@ gpg_error_t kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
                                  gpg_error_t (*status_cb)(void *opaque,
                                                           const char *line),
                                  void *status_cb_value);
+gpg_error_t kbx_client_data_inq_cmd (kbx_client_data_t kcd,
+                                     const char *command,
+                                     gpg_error_t (*inq_cb)(void *opaque,
+                                                           const char *line),
+                                     void *inq_cb_value,
+                                     gpg_error_t (*status_cb)(void *opaque,
+                                                              const char *line),
+                                     void *status_cb_value);
 gpg_error_t kbx_client_data_wait (kbx_client_data_t kcd,
                                   char **r_data, size_t *r_datalen);
 
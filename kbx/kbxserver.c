@@ -36,6 +36,7 @@
 #include "../common/userids.h"
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
+#include "../common/cmdstats.h"
 #include "frontend.h"
 
 
@@ -87,6 +88,12 @@ struct server_local_s
   /* This flag is set if the last search command was successful.  */
   unsigned int search_any_found : 1;
 
+  /* Set if an ERR line has been sent for the current command.  */
+  unsigned int cmd_failed : 1;
+
+  /* The start time of the current command for the statistics.  */
+  struct timespec cmd_start;
+
   /* The first is the current search description as parsed by the
    * cmd_search.  If more than one pattern is required, cmd_search
    * also allocates and sets multi_search_desc and
@@ -276,10 +283,20 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
 
 
 
-/* Helper to print a message while leaving a command.  */
+/* Helper to print a message while leaving a command.  This also
+ * emits the current database generation so that clients are able to
+ * detect changes of the database.  */
 static gpg_error_t
 leave_cmd (assuan_context_t ctx, gpg_error_t err)
 {
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  const char *instance;
+  unsigned long generation;
+
+  generation = kbxd_get_generation (&instance);
+  if (ctrl && *instance)
+    kbxd_status_printf (ctrl, "GENERATION", "%lu %s", generation, instance);
+
   if (err && opt.verbose)
     {
       const char *name = assuan_get_command_name (ctx);
@@ -567,6 +584,152 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+/* The maximum size of the pattern list accepted by MSEARCH.  */
+#define MAX_MSEARCH_PATTERNS_SIZE (1024*1024)
+
+static const char hlp_msearch[] =
+  "MSEARCH [--no-data] [--openpgp|--x509]\n"
+  "\n"
+  "Search for all keys matching any of the patterns which are\n"
+  "requested using the inquiry\n"
+  "  INQUIRE PATTERNS\n"
+  "The patterns are delimited by linefeeds; they are indexed in\n"
+  "the order given, starting at zero.  All matches are returned\n"
+  "as one data object made up of records with this layout (all\n"
+  "integers are in network byte order):\n"
+  "\n"
+  "  u32  Length of the record not counting this field\n"
+  "  u32  Index of the pattern which matched\n"
+  "  u32  Public key type\n"
+  "  b20  UBID\n"
+  "  u32  Flags (bit 0 = ephemeral, bit 1 = revoked)\n"
+  "  u32  Ordinal of the matching user ID\n"
+  "  u32  Ordinal of the matching key\n"
+  "  bN   The blob (not with --no-data)\n"
+  "\n"
+  "If no key matched at all, the error NOT_FOUND is returned.\n"
+  "A previous SEARCH can't be continued with NEXT after this\n"
+  "command.";
+static gpg_error_t
+cmd_msearch (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  int opt_no_data, opt_openpgp, opt_x509;
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *patterns = NULL;
+  char *p, *pend;
+  unsigned int idx;
+  KEYBOX_SEARCH_DESC desc;
+  membuf_t mb;
+  int mb_active = 0;
+  void *result;
+  size_t resultlen;
+
+  opt_no_data = has_option (line, "--no-data");
+  opt_openpgp = has_option (line, "--openpgp");
+  opt_x509 = has_option (line, "--x509");
+  line = skip_options (line);
+  if (*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "no args expected");
+      goto leave;
+    }
+
+  /* This command uses the same search state as SEARCH; thus we
+   * invalidate a pending SEARCH.  */
+  ctrl->server_local->search_any_found = 0;
+  ctrl->server_local->search_expecting_more = 0;
+  ctrl->server_local->multi_search_desc_len = 0;
+
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen,
+                        MAX_MSEARCH_PATTERNS_SIZE);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+  if (!valuelen)
+    {
+      err = set_error (GPG_ERR_MISSING_VALUE, "no patterns");
+      goto leave;
+    }
+  /* Make a string from the inquired data.  */
+  patterns = xtrymalloc (valuelen + 1);
+  if (!patterns)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (patterns, value, valuelen);
+  patterns[valuelen] = 0;
+
+  ctrl->server_local->inhibit_data_logging = 1;
+  ctrl->server_local->inhibit_data_logging_now = 0;
+  ctrl->server_local->inhibit_data_logging_count = 0;
+  ctrl->no_data_return = opt_no_data;
+  ctrl->filter_opgp = opt_openpgp;
+  ctrl->filter_x509 = opt_x509;
+
+  init_membuf (&mb, 8192);
+  mb_active = 1;
+  ctrl->batch_result = &mb;
+
+  for (idx=0, p = patterns; *p; idx++, p = pend)
+    {
+      pend = strchr (p, '\n');
+      if (pend)
+        *pend++ = 0;
+      else
+        pend = p + strlen (p);
+      trim_trailing_spaces (p);
+      if (!*p)
+        {
+          /* An empty pattern would return the entire database.  */
+          err = set_error (GPG_ERR_INV_USER_ID, "empty pattern");
+          goto leave;
+        }
+      err = classify_user_id (p, &desc, 1);
+      if (err)
+        goto leave;
+
+      /* Collect all matches for this pattern.  */
+      ctrl->batch_index = idx;
+      err = kbxd_search (ctrl, &desc, 1, 1);
+      while (!err)
+        err = kbxd_search (ctrl, &desc, 1, 0);
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+        goto leave;
+      err = 0;
+    }
+
+  ctrl->batch_result = NULL;
+  mb_active = 0;
+  result = get_membuf (&mb, &resultlen);
+  if (!result)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!resultlen)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  else if (!(err = prepare_outstream (ctrl)))
+    err = kbxd_write_data_line (ctrl, result, resultlen);
+  xfree (result);
+
+ leave:
+  ctrl->batch_result = NULL;
+  if (mb_active)
+    xfree (get_membuf (&mb, NULL));
+  ctrl->no_data_return = 0;
+  ctrl->server_local->inhibit_data_logging = 0;
+  xfree (patterns);
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_store[] =
   "STORE [--update|--insert]\n"
   "\n"
@@ -735,6 +898,88 @@ cmd_transaction (assuan_context_t ctx, char *line)
 
 
 
+/* The default and maximum timeout for WAITCHANGES.  */
+#define WAITCHANGES_DEFAULT_TIMEOUT 60
+#define WAITCHANGES_MAX_TIMEOUT     3600
+
+/* Callback for kbxd_list_changes as used by cmd_waitchanges.  */
+static gpg_error_t
+waitchanges_cb (void *opaque, unsigned long generation,
+                const unsigned char *ubid, int what)
+{
+  ctrl_t ctrl = opaque;
+  char hexubid[2*UBID_LEN+1];
+
+  if (ubid)
+    bin2hex (ubid, UBID_LEN, hexubid);
+  else
+    strcpy (hexubid, "*");
+  return kbxd_status_printf (ctrl, "CHANGED", "%lu %s %c",
+                             generation, hexubid, what);
+}
+
+
+static const char hlp_waitchanges[] =
+  "WAITCHANGES [--nowait] [--timeout=N] GENERATION\n"
+  "\n"
+  "Return the changes of the database made after GENERATION, which\n"
+  "is usually taken from the last GENERATION status line.  If there\n"
+  "are no such changes, wait up to N seconds (default is 60) for a\n"
+  "change or return immediately with --nowait.  For each change a\n"
+  "status line\n"
+  "  CHANGED <generation> <ubid> <what>\n"
+  "is emitted; WHAT is 'u' for an inserted or updated key and 'd'\n"
+  "for a deleted key.  If the changes after GENERATION are not\n"
+  "anymore known, only one line with an UBID and WHAT of \"*\" is\n"
+  "emitted to indicate that any key may have changed.";
+static gpg_error_t
+cmd_waitchanges (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int opt_nowait;
+  const char *s;
+  unsigned int timeout = WAITCHANGES_DEFAULT_TIMEOUT;
+  unsigned long since;
+  char *endp;
+
+  opt_nowait = has_option (line, "--nowait");
+  if ((s = has_option_name (line, "--timeout")))
+    {
+      if (*s != '=' || !digitp (s+1))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "value for --timeout missing");
+          goto leave;
+        }
+      timeout = atoi (s+1);
+      if (timeout > WAITCHANGES_MAX_TIMEOUT)
+        timeout = WAITCHANGES_MAX_TIMEOUT;
+    }
+  if (opt_nowait)
+    timeout = 0;
+  line = skip_options (line);
+
+  if (!digitp (line))
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "generation number missing");
+      goto leave;
+    }
+  gpg_err_set_errno (0);
+  since = strtoul (line, &endp, 10);
+  if (errno || *endp)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "invalid generation number");
+      goto leave;
+    }
+
+  err = kbxd_list_changes (since, timeout, waitchanges_cb, ctrl);
+
+ leave:
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -745,6 +990,10 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server.\n"
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
+  "generation  - Return the database generation and the instance id.\n"
+  "cache_stats - Return statistics about the cache tables.\n"
+  "stats       - Return per command statistics.\n"
+  "stats --reset - Return and reset the per command statistics.\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -775,6 +1024,32 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%u", ctrl->server_local->session_id);
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "generation"))
+    {
+      const char *instance;
+      unsigned long generation = kbxd_get_generation (&instance);
+
+      snprintf (numbuf, sizeof numbuf, "%lu %s", generation, instance);
+      err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *s = kbxd_get_cache_stats ();
+
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "stats") || !strcmp (line, "stats --reset"))
+    {
+      err = cmdstats_send (ctx);
+      if (!err && line[5])
+        cmdstats_reset ();
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -853,9 +1128,11 @@ register_commands (assuan_context_t ctx)
   } table[] = {
     { "SEARCH",     cmd_search,     hlp_search },
     { "NEXT",       cmd_next,       hlp_next   },
+    { "MSEARCH",    cmd_msearch,    hlp_msearch },
     { "STORE",      cmd_store,      hlp_store  },
     { "DELETE",     cmd_delete,     hlp_delete  },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
+    { "WAITCHANGES",cmd_waitchanges,hlp_waitchanges },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
     { "OUTPUT",     NULL,           hlp_output },
     { "KILLKEYBOXD",cmd_killkeyboxd,hlp_killkeyboxd },
@@ -875,6 +1152,52 @@ register_commands (assuan_context_t ctx)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  cmdstats_start (&ctrl->server_local->cmd_start);
+  ctrl->server_local->cmd_failed = 0;
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  ERR is the error from
+ * writing the response; thus we use the flag set by io_monitor.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  cmdstats_record (assuan_get_command_name (ctx),
+                   &ctrl->server_local->cmd_start,
+                   ctrl->server_local->cmd_failed);
+}
+
+
+/* Called by libassuan for all I/O.  We use it to detect failed
+ * commands for the statistics.  */
+static unsigned int
+io_monitor (assuan_context_t ctx, void *hook, int direction,
+            const char *line, size_t linelen)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)hook;
+
+  if (ctrl && ctrl->server_local
+      && cmdstats_err_line_p (direction, line, linelen))
+    ctrl->server_local->cmd_failed = 1;
+  return 0;
+}
+
+
 /* Note that we do not reset the list of configured keyservers.  */
 static gpg_error_t
 reset_notify (assuan_context_t ctx, char *line)
@@ -989,6 +1312,9 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
+  assuan_set_io_monitor (ctx, io_monitor, NULL);
 
   ctrl->server_local->session_id = session_id;
 
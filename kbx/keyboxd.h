@@ -126,6 +126,11 @@ struct server_control_s
   /* Used by SEARCH and NEXT.  */
   unsigned int no_data_return : 1;
 
+  /* If not NULL search results are not sent to the client but
+   * appended to this buffer using the MSEARCH record format.
+   * BATCH_INDEX is the index of the pattern currently searched.  */
+  membuf_t *batch_result;
+  unsigned int batch_index;
 };
 
 
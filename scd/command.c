@@ -42,6 +42,7 @@
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
 #include "../common/ssh-utils.h"
+#include "../common/cmdstats.h"
 
 /* Maximum length allowed as a PIN; used for INQUIRE NEEDPIN.  That
  * length needs to small compared to the maximum Assuan line length.  */
@@ -98,6 +99,12 @@ struct server_local_s
 
   /* If set to true, status change will be reported. */
   unsigned int watching_status:1;
+
+  /* Set if an ERR line has been sent for the current command.  */
+  unsigned int cmd_failed:1;
+
+  /* The start time of the current command for the statistics.  */
+  struct timespec cmd_start;
 };
 
 
@@ -190,6 +197,56 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  if (ctrl && ctrl->server_local)
+    {
+      cmdstats_start (&ctrl->server_local->cmd_start);
+      ctrl->server_local->cmd_failed = 0;
+    }
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  ERR is the error from
+   writing the response; thus we use the flag set by io_monitor.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  if (ctrl && ctrl->server_local)
+    cmdstats_record (assuan_get_command_name (ctx),
+                     &ctrl->server_local->cmd_start,
+                     ctrl->server_local->cmd_failed);
+}
+
+
+/* Called by libassuan for all I/O.  We use it to detect failed
+   commands for the statistics.  */
+static unsigned int
+io_monitor (assuan_context_t ctx, void *hook, int direction,
+            const char *line, size_t linelen)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)hook;
+
+  if (ctrl && ctrl->server_local
+      && cmdstats_err_line_p (direction, line, linelen))
+    ctrl->server_local->cmd_failed = 1;
+  return 0;
+}
+
+
 static gpg_error_t
 option_handler (assuan_context_t ctx, const char *key, const char *value)
 {
@@ -1875,7 +1932,9 @@ static const char hlp_getinfo[] =
   "  cmd_has_option CMD OPT\n"
   "              - Returns OK if command CMD has option OPT.\n"
   "  apdu_strerror NUMBER\n"
-  "              - Return a string for a status word.\n";
+  "              - Return a string for a status word.\n"
+  "  stats [--reset]\n"
+  "              - Return per command statistics.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -2008,6 +2067,12 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       s = apdu_strerror (ul);
       rc = assuan_send_data (ctx, s, strlen (s));
     }
+  else if (!strcmp (line, "stats") || !strcmp (line, "stats --reset"))
+    {
+      rc = cmdstats_send (ctx);
+      if (!rc && line[5])
+        cmdstats_reset ();
+    }
   else
     rc = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
   return rc;
@@ -2467,6 +2532,9 @@ register_commands (assuan_context_t ctx)
 
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
+  assuan_set_io_monitor (ctx, io_monitor, NULL);
   return 0;
 }
 
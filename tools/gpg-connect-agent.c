@@ -1193,6 +1193,51 @@ do_serverpid (assuan_context_t ctx)
 }
 
 
+/* Print the per command statistics of the server.  If RESET is set
+ * the statistics are reset by the server after printing.  */
+static void
+do_stats (assuan_context_t ctx, int reset)
+{
+  const char *command = reset? "GETINFO stats --reset" : "GETINFO stats";
+  int rc;
+  membuf_t mb;
+  char *buffer, *line, *next;
+  char name[64];
+  unsigned long count, errors;
+  unsigned long long p50, p99, maxtime;
+
+  init_membuf (&mb, 1024);
+  rc = assuan_transact (ctx, command, getinfo_pid_cb, &mb,
+                        NULL, NULL, NULL, NULL);
+  put_membuf (&mb, "", 1);
+  buffer = get_membuf (&mb, NULL);
+  if (rc || !buffer)
+    {
+      log_error ("command \"%s\" failed: %s\n", command, gpg_strerror (rc));
+      xfree (buffer);
+      return;
+    }
+
+  printf ("%-24s %10s %8s %10s %10s %10s\n",
+          "Command", "Count", "Errors", "p50(ms)", "p99(ms)", "max(ms)");
+  for (line = buffer; *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next)
+        *next++ = 0;
+      else
+        next = line + strlen (line);
+      if (sscanf (line, "%63s %lu %lu %llu %llu %llu",
+                  name, &count, &errors, &p50, &p99, &maxtime) != 6)
+        continue;
+      printf ("%-24s %10lu %8lu %10.3f %10.3f %10.3f\n",
+              name, count, errors,
+              p50 / 1000.0, p99 / 1000.0, maxtime / 1000.0);
+    }
+  xfree (buffer);
+}
+
+
 /* Return true if the command is either "HELP" or "SCD HELP".  */
 static int
 help_cmd_p (const char *line)
@@ -1758,6 +1803,13 @@ main (int argc, char **argv)
             {
               do_serverpid (ctx);
             }
+          else if (!strcmp (cmd, "stats"))
+            {
+              if (!*p || !strcmp (p, "--reset"))
+                do_stats (ctx, !!*p);
+              else
+                log_error ("Only \"/stats [--reset]\" is supported\n");
+            }
           else if (!strcmp (cmd, "hex"))
             opt.hex = 1;
           else if (!strcmp (cmd, "nohex"))
@@ -1937,6 +1989,7 @@ main (int argc, char **argv)
 "/close FD              Close file with descriptor FD.\n"
 "/showopen              Show descriptors of all open files.\n"
 "/serverpid             Retrieve the pid of the server.\n"
+"/stats [--reset]       Show (and reset) the server's command statistics.\n"
 "/[no]hex               Enable hex dumping of received data lines.\n"
 "/[no]decode            Enable decoding of received data lines.\n"
 "/[no]subst             Enable variable substitution.\n"